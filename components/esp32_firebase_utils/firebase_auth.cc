@@ -12,10 +12,12 @@
 
 #include "firebase_auth.h"
 #include <string.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "esp_log.h"
 #include "esp_http_client.h"
+#include "firebase_transport.h"
 #include "cJSON.h"
 
 #define FIREBASE_TOKEN_REQUEST_HOSTNAME "securetoken.googleapis.com"
@@ -23,193 +25,188 @@
 
 static const char FIREBASE_AUTH_BODY_FORMAT[] = "grant_type=refresh_token&refresh_token=%s";
 static constexpr int FIREBASE_AUTH_BODY_SIZE = 42 + 1024 + 1;
-static char auth_body[FIREBASE_AUTH_BODY_SIZE];
 
 static const char *TAG = "FB_AUTH";
-static const char *TAG_EVENT_HANDLER = "FB_EVENT";
 
-static const int SEND_BUF_SIZE = 1024; // this is also called transmit (tx) buffer size
 static const int RECEIVE_BUF_SIZE = 4096;
 
-static char *RECEIVE_BODY = NULL;
-static int receive_body_len = 0;
+static const firebase_transport_t *transport = firebase_transport_default();
 
-void firebase_auth_init()
+// the endpoint of the project of the menuconfig options
+static const firebase_auth_endpoint_t DEFAULT_ENDPOINT = {FIREBASE_AUTH_PATH, NULL};
+
+/**
+ * The response body of one token request, so the requests don't share a buffer
+ */
+typedef struct
 {
-  // initialize the receive body buffer over SPIRAM
-  RECEIVE_BODY = (char *)heap_caps_malloc(RECEIVE_BUF_SIZE, MALLOC_CAP_SPIRAM);
-}
+  char *body;
+  int len;
+} auth_response_t;
 
-void firebase_auth_cleanup()
+void firebase_auth_set_transport(const firebase_transport_t *new_transport)
 {
-  heap_caps_free(RECEIVE_BODY);
-  RECEIVE_BODY = NULL;
+  transport = new_transport != NULL ? new_transport : firebase_transport_default();
 }
 
-static esp_err_t firebase_http_event_handler(esp_http_client_event_t *client_event);
-
-/**
- * @brief Get the value from json object
- *
- * @param[in] json e.g. '\{"key1": "value1", "key2": "value2"\}'
- * @param[in] key e.g. "key1"
- * @param[out] value The output buffer to store the value, e.g. "value1"
- */
-void get_value_from_json(const char *json, const char *key, char *value)
+esp_err_t firebase_auth_endpoint_init(firebase_auth_endpoint_t *endpoint, const char *api_key, const firebase_transport_t *endpoint_transport)
 {
-  cJSON *root = cJSON_Parse(json);
-  cJSON *field = cJSON_GetObjectItem(root, key);
-  if (field != NULL)
+  if (snprintf(endpoint->path, FIREBASE_AUTH_PATH_MAX_LEN, "/v1/token?key=%s", api_key != NULL ? api_key : FIREBASE_API_KEY) >= FIREBASE_AUTH_PATH_MAX_LEN)
   {
-    strcpy(value, field->valuestring);
+    ESP_LOGE(TAG, "The API key is too long");
+    return ESP_ERR_INVALID_SIZE;
   }
-  cJSON_Delete(root);
+  endpoint->transport = endpoint_transport;
+  return ESP_OK;
 }
 
-esp_err_t set_auth_body(char *refresh_token)
+/**
+ * @brief Append a piece of the response body to the auth_response_t (user_ctx), the part that doesn't fit in it is dropped
+ */
+static void receive_body_on_chunk(const char *data, int len, void *user_ctx)
 {
-  // if refresh_token is NULL
-  if (refresh_token == NULL)
-  {
-#ifdef CONFIG_FIREBASE_REFRESH_TOKEN
-    ESP_LOGI(TAG, "Using the refresh token from the configuration");
-    snprintf(auth_body, FIREBASE_AUTH_BODY_SIZE, FIREBASE_AUTH_BODY_FORMAT, CONFIG_FIREBASE_REFRESH_TOKEN);
-#else
-    ESP_LOGE(TAG, "The refresh token cannot be NULL, if CONFIG_FIREBASE_REFRESH_TOKEN is not set");
-    return ESP_FAIL;
-#endif
-  }
-  else
+  auth_response_t *response = (auth_response_t *)user_ctx;
+  int copy_len = len;
+  if (response->len + copy_len > RECEIVE_BUF_SIZE - 1)
   {
-    snprintf(auth_body, FIREBASE_AUTH_BODY_SIZE, FIREBASE_AUTH_BODY_FORMAT, refresh_token);
+    copy_len = RECEIVE_BUF_SIZE - 1 - response->len;
   }
-  return ESP_OK;
+  memcpy(response->body + response->len, data, copy_len);
+  response->len += copy_len;
+  response->body[response->len] = '\0';
 }
 
-esp_err_t abstract_auth_request()
+static void receive_body_on_error(esp_err_t error, void *user_ctx)
 {
+  ESP_LOGE(TAG, "The auth request failed: %s", esp_err_to_name(error));
+}
 
-  esp_http_client_config_t http_config = {
-      .host = FIREBASE_TOKEN_REQUEST_HOSTNAME,
-      .path = FIREBASE_AUTH_PATH,
-      .method = HTTP_METHOD_POST,
-      .event_handler = firebase_http_event_handler,
-      .transport_type = HTTP_TRANSPORT_OVER_SSL,
-      .buffer_size = RECEIVE_BUF_SIZE,
-      .buffer_size_tx = SEND_BUF_SIZE,
-      .user_data = RECEIVE_BODY // note that this is the response body buffer
+/**
+ * @brief Post the token request `auth_body` to the endpoint, the response body is written to `response`
+ */
+static esp_err_t abstract_auth_request(const firebase_auth_endpoint_t *endpoint, const char *auth_body, auth_response_t *response)
+{
+  firebase_transport_request_t request = {};
+  request.host = FIREBASE_TOKEN_REQUEST_HOSTNAME;
+  request.path = endpoint->path;
+  request.method = HTTP_METHOD_POST;
+  request.content_type = "application/x-www-form-urlencoded";
+  request.body = auth_body;
+  request.body_len = strlen(auth_body);
+  firebase_transport_handler_t handler = {
+      .on_chunk = receive_body_on_chunk,
+      .on_error = receive_body_on_error,
+      .user_ctx = response,
   };
 
-  esp_http_client_handle_t firebase_client_handle = esp_http_client_init(&http_config);
-  ESP_LOGI(TAG, "http config initialized");
-
-  esp_http_client_set_header(firebase_client_handle, "Content-Type", "application/x-www-form-urlencoded");
-  esp_http_client_set_post_field(firebase_client_handle, auth_body, strlen(auth_body));
-
-  ESP_LOGI(TAG, "http headers set up! Making request...");
-  if (esp_http_client_perform(firebase_client_handle) != ESP_OK)
+  const firebase_transport_t *request_transport = endpoint->transport != NULL ? endpoint->transport : transport;
+  response->body[0] = '\0';
+  response->len = 0;
+  int response_code = 0;
+  ESP_LOGI(TAG, "Making request...");
+  if (request_transport->request(request_transport, &request, &handler, &response_code) != ESP_OK)
   {
     ESP_LOGE(TAG, "Failed to perform HTTP request");
-    esp_http_client_cleanup(firebase_client_handle);
-    receive_body_len = 0;
     return ESP_FAIL;
   }
 
-  ESP_LOGI(TAG, "HTTP request performed");
-  int response_code = esp_http_client_get_status_code(firebase_client_handle);
-  ESP_LOGI(TAG,
-           "HTTP Response code: %d, content_length: %d",
-           response_code,
-           (int)esp_http_client_get_content_length(firebase_client_handle));
-
+  ESP_LOGI(TAG, "HTTP Response code: %d, received length: %d", response_code, response->len);
   if (response_code != 200)
   {
     ESP_LOGE(TAG, "Firestore REST API call failed with HTTP code: %d", response_code);
     {
-      ESP_LOGE(TAG, "Error message: %s", RECEIVE_BODY);
+      ESP_LOGE(TAG, "Error message: %s", response->body);
     }
-    esp_http_client_cleanup(firebase_client_handle);
-    receive_body_len = 0;
     return ESP_FAIL;
   }
   // the auth request should return a json object of size about 1870 bytes
-  ESP_LOGD(TAG, "total received body length: %d", strlen(RECEIVE_BODY));
-
-  esp_http_client_cleanup(firebase_client_handle);
-  receive_body_len = 0;
-  ESP_LOGI(TAG, "HTTP request cleanup");
+  ESP_LOGD(TAG, "total received body length: %d", response->len);
   return ESP_OK;
 }
 
-esp_err_t firebase_get_access_token_from_refresh_token(char *refresh_token, char *access_token)
+/**
+ * @brief Get the ID token (and its lifetime) from the response of a token request, e.g.
+ * {"expires_in": "3600", "token_type": "Bearer", "refresh_token": "...", "id_token": "...", ...}
+ */
+static esp_err_t parse_token_response(const char *json, char *id_token, int id_token_size, int *expires_in_s)
 {
-  firebase_auth_init();
-
-  if (set_auth_body(refresh_token) != ESP_OK)
+  cJSON *root = cJSON_Parse(json);
+  cJSON *token = cJSON_GetObjectItem(root, "id_token");
+  if (!cJSON_IsString(token))
   {
-    ESP_LOGE(TAG, "Failed to set the auth body (or say failed to get the refresh token)");
+    ESP_LOGE(TAG, "The response has no id_token");
+    cJSON_Delete(root);
     return ESP_FAIL;
   }
-
-  if (abstract_auth_request() != ESP_OK)
+  if (snprintf(id_token, id_token_size, "%s", token->valuestring) >= id_token_size)
   {
-    ESP_LOGE(TAG, "Failed to get the access token from the refresh token");
-    return ESP_FAIL;
+    ESP_LOGE(TAG, "The ID token (%d characters) doesn't fit in the buffer", (int)strlen(token->valuestring));
+    cJSON_Delete(root);
+    return ESP_ERR_INVALID_SIZE;
   }
-  get_value_from_json(RECEIVE_BODY, "id_token", access_token);
-
-  firebase_auth_cleanup();
+  if (expires_in_s != NULL)
+  {
+    // a number in a string, e.g. "3600"
+    cJSON *expires_in = cJSON_GetObjectItem(root, "expires_in");
+    *expires_in_s = cJSON_IsString(expires_in) ? atoi(expires_in->valuestring) : cJSON_IsNumber(expires_in) ? expires_in->valueint : 0;
+  }
+  cJSON_Delete(root);
   return ESP_OK;
 }
 
-/**
- * @brief HTTP event handler for FirebaseAPI
- *
- * TODO: this is exactly copy-pasted from firebase_auth.cc, I can't find a way to make this a shared function
- * (because there is a static variable `receive_body_len` that is used in the function)
- */
-static esp_err_t firebase_http_event_handler(esp_http_client_event_t *client_event)
+esp_err_t firebase_auth_refresh_id_token(
+    const firebase_auth_endpoint_t *endpoint,
+    const char *refresh_token,
+    char *id_token,
+    int id_token_size,
+    int *expires_in_s)
 {
+  if (endpoint == NULL || refresh_token == NULL || id_token == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char *auth_body = (char *)heap_caps_malloc(FIREBASE_AUTH_BODY_SIZE, MALLOC_CAP_SPIRAM);
+  auth_response_t response = {(char *)heap_caps_malloc(RECEIVE_BUF_SIZE, MALLOC_CAP_SPIRAM), 0};
+  esp_err_t result = ESP_OK;
+  if (auth_body == NULL || response.body == NULL)
+  {
+    result = ESP_ERR_NO_MEM;
+  }
+  else if (snprintf(auth_body, FIREBASE_AUTH_BODY_SIZE, FIREBASE_AUTH_BODY_FORMAT, refresh_token) >= FIREBASE_AUTH_BODY_SIZE)
+  {
+    ESP_LOGE(TAG, "The refresh token is too long");
+    result = ESP_ERR_INVALID_SIZE;
+  }
+  else if (abstract_auth_request(endpoint, auth_body, &response) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to get the access token from the refresh token");
+    result = ESP_FAIL;
+  }
+  else
+  {
+    result = parse_token_response(response.body, id_token, id_token_size, expires_in_s);
+  }
+  heap_caps_free(auth_body);
+  heap_caps_free(response.body);
+  return result;
+}
 
-  switch (client_event->event_id)
+esp_err_t firebase_get_access_token_from_refresh_token(char *refresh_token, char *access_token)
+{
+  // if refresh_token is NULL
+  if (refresh_token == NULL)
   {
-  case HTTP_EVENT_ERROR:
-    ESP_LOGI(TAG_EVENT_HANDLER, "HTTP error");
-    receive_body_len = 0; // reset the receive body length
-    break;
-  case HTTP_EVENT_ON_CONNECTED:
-    ESP_LOGI(TAG_EVENT_HANDLER, "HTTP connected to server");
-    receive_body_len = 0; // reset the receive body length
-    break;
-  case HTTP_EVENT_HEADERS_SENT:
-    ESP_LOGI(TAG_EVENT_HANDLER, "All HTTP headers are sent to server");
-    break;
-  case HTTP_EVENT_ON_HEADER:
-    ESP_LOGI(TAG_EVENT_HANDLER, "HTTP header received");
-    break;
-  case HTTP_EVENT_ON_DATA: // note that this might be called multiple times because the data might be chunked
-    ESP_LOGI(TAG_EVENT_HANDLER, "HTTP data received, with length: %d", client_event->data_len);
-    if (client_event->user_data)
-    {
-      strncpy((char *)client_event->user_data + receive_body_len, // destination buffer
-              (char *)client_event->data,                         // source buffer
-              client_event->data_len);
-      receive_body_len += client_event->data_len;
-    }
-    break;
-  case HTTP_EVENT_ON_FINISH:
-    ESP_LOGI(TAG_EVENT_HANDLER, "HTTP session is finished");
-    *((char *)client_event->user_data + receive_body_len) = '\0'; // write the null terminator to the buffer
-    receive_body_len = 0;                                         // reset the receive body length
-    break;
-  case HTTP_EVENT_DISCONNECTED:
-    ESP_LOGI(TAG_EVENT_HANDLER, "HTTP connection is closed");
-    receive_body_len = 0; // reset the receive body length
-    break;
-  case HTTP_EVENT_REDIRECT:
-    ESP_LOGI(TAG_EVENT_HANDLER, "HTTP redirect");
-    receive_body_len = 0; // reset the receive body length
-    break;
+#ifdef CONFIG_FIREBASE_REFRESH_TOKEN
+    ESP_LOGI(TAG, "Using the refresh token from the configuration");
+    refresh_token = (char *)CONFIG_FIREBASE_REFRESH_TOKEN;
+#else
+    ESP_LOGE(TAG, "The refresh token cannot be NULL, if CONFIG_FIREBASE_REFRESH_TOKEN is not set");
+    return ESP_FAIL;
+#endif
+  }
+  if (firebase_auth_refresh_id_token(&DEFAULT_ENDPOINT, refresh_token, access_token, FIREBASE_ID_TOKEN_MAX_LEN, NULL) != ESP_OK)
+  {
+    return ESP_FAIL;
   }
   return ESP_OK;
 }
@@ -7,11 +7,25 @@ extern "C"
 #endif
 
 #include "esp_err.h"
+#include "firebase_transport.h"
 
 
 
 #define FIREBASE_API_KEY CONFIG_FIREBASE_API_KEY
 
+#define FIREBASE_ID_TOKEN_MAX_LEN 1024 // the size of a buffer that holds an ID token (usually about 758 characters)
+#define FIREBASE_AUTH_PATH_MAX_LEN 128 // the max length of the token request path, "/v1/token?key=" + the Web API key
+
+/**
+ * Where the ID tokens of a project are requested: the token path with the Web API key of the project,
+ * formatted once by `firebase_auth_endpoint_init`, and the transport.
+ */
+typedef struct
+{
+  char path[FIREBASE_AUTH_PATH_MAX_LEN]; // e.g. "/v1/token?key=<api key>"
+  const firebase_transport_t *transport; // NULL for the transport of `firebase_auth_set_transport`
+} firebase_auth_endpoint_t;
+
 /**
  * @brief Exchange a refresh token for an ID token
  * https://cloud.google.com/identity-platform/docs/use-rest-api#section-refresh-token
@@ -23,6 +37,42 @@ extern "C"
  */
 esp_err_t firebase_get_access_token_from_refresh_token(char* refresh_token, char *access_token);
 
+/**
+ * @brief Make the endpoint of the token requests of a project
+ *
+ * @param[out] endpoint The endpoint to initialize.
+ * @param[in] api_key The Web API key of the project, NULL for CONFIG_FIREBASE_API_KEY.
+ * @param[in] transport The transport of the token requests, NULL for the one of `firebase_auth_set_transport`.
+ * @return ESP_ERR_INVALID_SIZE if the API key is too long.
+ */
+esp_err_t firebase_auth_endpoint_init(firebase_auth_endpoint_t *endpoint, const char *api_key, const firebase_transport_t *transport);
+
+/**
+ * @brief Exchange a refresh token for an ID token, at the endpoint of a project
+ * Nothing is shared between the calls, so the tokens of different projects can be refreshed from different tasks at the same time.
+ *
+ * @param[in] endpoint The endpoint of the project (see `firebase_auth_endpoint_init`).
+ * @param[in] refresh_token The refresh token.
+ * @param[out] id_token The ID token.
+ * @param[in] id_token_size The size of `id_token`, usually FIREBASE_ID_TOKEN_MAX_LEN.
+ * @param[out] expires_in_s The number of seconds the ID token is valid for (usually 3600), or NULL.
+ * @return ESP_ERR_INVALID_SIZE if the ID token doesn't fit in `id_token`.
+ */
+esp_err_t firebase_auth_refresh_id_token(
+    const firebase_auth_endpoint_t *endpoint,
+    const char *refresh_token,
+    char *id_token,
+    int id_token_size,
+    int *expires_in_s);
+
+/**
+ * @brief Set the transport of the following token requests, e.g. a plain HTTP one to the Auth emulator
+ * (see firebase_transport.h)
+ *
+ * @param[in] transport The transport, it has to stay valid as long as it is used. NULL for the default (TLS to Google).
+ */
+void firebase_auth_set_transport(const firebase_transport_t *transport);
+
 #ifdef __cplusplus
 }
 #endif
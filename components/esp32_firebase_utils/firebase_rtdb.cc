@@ -0,0 +1,660 @@
+/**
+ * @file firebase_rtdb.cc
+ * @brief Firebase Realtime Database streaming listener (Server-Sent Events) and REST reads and writes
+ * https://firebase.google.com/docs/reference/rest/database#section-streaming
+ * The stream is read with esp_http_client open / fetch_headers / read (not the transport of firebase_transport.h,
+ * which only returns once the response is finished). The reads time out every READ_TIMEOUT_MS, so the task can
+ * notice that it is stopped, and that the server went silent.
+ */
+
+#include "firebase_rtdb.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "firebase_transport.h"
+
+#define EVENT_BUFFER_SIZE CONFIG_FIREBASE_RTDB_EVENT_BUFFER_SIZE
+#define MAX_CALLBACKS CONFIG_FIREBASE_RTDB_MAX_CALLBACKS
+#define KEEPALIVE_TIMEOUT_MS CONFIG_FIREBASE_RTDB_KEEPALIVE_TIMEOUT_MS
+#define REST_PATH_BUFFER_SIZE 256
+#define QUERY_BUFFER_SIZE (FIREBASE_RTDB_TOKEN_SIZE + 8) // "auth=" + token
+#define EVENT_NAME_SIZE 16                               // e.g. "auth_revoked"
+#define ERROR_MESSAGE_SIZE 128
+
+static const char *TAG = "FB_RTDB";
+
+static const int CONNECT_TIMEOUT_MS = 10000;
+static const int READ_TIMEOUT_MS = 1000;
+static const int READ_BUFFER_SIZE = 512;
+static const int RECONNECT_BACKOFF_MIN_MS = 1000;
+static const int RECONNECT_BACKOFF_MAX_MS = 60000;
+static const int MAX_REDIRECTS = 3; // the database can redirect the stream to the server that holds the data
+
+typedef enum
+{
+    STREAM_CONTINUE,
+    STREAM_RECONNECT,
+    STREAM_REAUTHENTICATE, // reconnect with a refreshed token
+} stream_action_t;
+
+typedef struct
+{
+    const char *path;
+    firebase_rtdb_callback_t callback;
+    void *user_ctx;
+} rtdb_callback_t;
+
+struct firebase_rtdb_stream
+{
+    firebase_rtdb_config_t config;
+    rtdb_callback_t callbacks[MAX_CALLBACKS];
+    int num_callbacks;
+    TaskHandle_t task;
+    volatile bool stop_requested;
+    SemaphoreHandle_t task_done; // given by the task when it returns
+
+    char *token; // FIREBASE_RTDB_TOKEN_SIZE bytes
+    char *query; // QUERY_BUFFER_SIZE bytes, "auth=<token>"
+
+    // the event being parsed
+    char *line; // EVENT_BUFFER_SIZE bytes, the current line of the stream
+    int line_len;
+    bool line_overflow;
+    char *data; // EVENT_BUFFER_SIZE bytes, the data lines of the event
+    int data_len;
+    bool data_overflow;
+    char event_name[EVENT_NAME_SIZE];
+    bool initial_pending; // no put is received since the connection is opened
+
+    firebase_rtdb_stats_t stats;
+};
+
+static const char *host_of(const firebase_rtdb_config_t *config)
+{
+    return config->host != NULL ? config->host : FIREBASE_RTDB_HOST;
+}
+
+static esp_err_t rest_path_of(char *rest_path, const char *path)
+{
+    if (snprintf(rest_path, REST_PATH_BUFFER_SIZE, "%s%s.json", path[0] == '/' ? "" : "/", path) >= REST_PATH_BUFFER_SIZE)
+    {
+        ESP_LOGE(TAG, "The path %s is too long", path);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Check if `path` is `ancestor` or below it, e.g. "/command/id" is within "/command" and "/"
+ */
+static bool is_within(const char *path, const char *ancestor)
+{
+    int ancestor_len = strlen(ancestor);
+    if (ancestor_len > 0 && ancestor[ancestor_len - 1] == '/')
+    {
+        ancestor_len--; // "/" is the ancestor of everything
+    }
+    return strncmp(path, ancestor, ancestor_len) == 0 && (path[ancestor_len] == '\0' || path[ancestor_len] == '/');
+}
+
+static void dispatch(firebase_rtdb_stream *stream, const firebase_rtdb_event_t *event, bool to_all)
+{
+    for (int i = 0; i < stream->num_callbacks; i++)
+    {
+        const rtdb_callback_t *callback = &stream->callbacks[i];
+        if (to_all || is_within(event->path, callback->path) || is_within(callback->path, event->path))
+        {
+            callback->callback(event, callback->user_ctx);
+        }
+    }
+}
+
+static stream_action_t dispatch_data_event(firebase_rtdb_stream *stream, firebase_rtdb_event_type_t type)
+{
+    if (stream->data_overflow)
+    {
+        ESP_LOGW(TAG, "The %s event is longer than %d bytes, it is dropped", stream->event_name, EVENT_BUFFER_SIZE);
+        stream->stats.dropped_events++;
+        return STREAM_CONTINUE;
+    }
+    cJSON *root = cJSON_Parse(stream->data);
+    cJSON *path = cJSON_GetObjectItem(root, "path");
+    if (!cJSON_IsString(path))
+    {
+        ESP_LOGW(TAG, "The %s event is not valid: %s", stream->event_name, stream->data);
+        stream->stats.dropped_events++;
+        cJSON_Delete(root);
+        return STREAM_CONTINUE;
+    }
+
+    firebase_rtdb_event_t event = {};
+    event.type = type;
+    event.path = path->valuestring;
+    event.data = cJSON_GetObjectItem(root, "data");
+    event.initial = type == FIREBASE_RTDB_EVENT_PUT && stream->initial_pending;
+    if (type == FIREBASE_RTDB_EVENT_PUT)
+    {
+        stream->initial_pending = false;
+    }
+    stream->stats.events++;
+    dispatch(stream, &event, false);
+    cJSON_Delete(root);
+    return STREAM_CONTINUE;
+}
+
+/**
+ * @brief Handle the event that is parsed (on the empty line that ends it)
+ */
+static stream_action_t dispatch_event(firebase_rtdb_stream *stream)
+{
+    const char *name = stream->event_name;
+    stream_action_t action = STREAM_CONTINUE;
+    if (strcmp(name, "keep-alive") == 0)
+    {
+        stream->stats.keep_alives++;
+    }
+    else if (strcmp(name, "put") == 0)
+    {
+        action = dispatch_data_event(stream, FIREBASE_RTDB_EVENT_PUT);
+    }
+    else if (strcmp(name, "patch") == 0)
+    {
+        action = dispatch_data_event(stream, FIREBASE_RTDB_EVENT_PATCH);
+    }
+    else if (strcmp(name, "cancel") == 0 || strcmp(name, "auth_revoked") == 0)
+    {
+        bool revoked = name[0] == 'a';
+        ESP_LOGW(TAG, "The stream is %s: %s", revoked ? "revoked" : "cancelled", stream->data);
+        firebase_rtdb_event_t event = {};
+        event.type = revoked ? FIREBASE_RTDB_EVENT_AUTH_REVOKED : FIREBASE_RTDB_EVENT_CANCEL;
+        event.path = "/";
+        event.message = stream->data;
+        dispatch(stream, &event, true);
+        action = revoked ? STREAM_REAUTHENTICATE : STREAM_RECONNECT;
+    }
+    else if (name[0] != '\0')
+    {
+        ESP_LOGD(TAG, "Unknown event %s is ignored", name);
+    }
+
+    stream->event_name[0] = '\0';
+    stream->data[0] = '\0';
+    stream->data_len = 0;
+    stream->data_overflow = false;
+    return action;
+}
+
+/**
+ * @brief Handle a line of the stream, e.g. "event: put", "data: {...}", or the empty line that ends the event
+ */
+static stream_action_t process_line(firebase_rtdb_stream *stream)
+{
+    char *line = stream->line;
+    if (stream->line_overflow)
+    {
+        // only a data line can be this long, so the event is incomplete
+        stream->data_overflow = true;
+        return STREAM_CONTINUE;
+    }
+    if (stream->line_len == 0)
+    {
+        return dispatch_event(stream);
+    }
+    if (line[0] == ':')
+    {
+        return STREAM_CONTINUE; // a comment
+    }
+
+    char *value = strchr(line, ':');
+    if (value == NULL)
+    {
+        value = line + stream->line_len; // a field without a value
+    }
+    else
+    {
+        *value++ = '\0';
+        if (*value == ' ')
+        {
+            value++;
+        }
+    }
+    if (strcmp(line, "event") == 0)
+    {
+        snprintf(stream->event_name, EVENT_NAME_SIZE, "%s", value);
+    }
+    else if (strcmp(line, "data") == 0)
+    {
+        int value_len = strlen(value);
+        int separator_len = stream->data_len > 0 ? 1 : 0; // the data lines of an event are joined with "\n"
+        if (stream->data_len + separator_len + value_len >= EVENT_BUFFER_SIZE)
+        {
+            stream->data_overflow = true;
+        }
+        else if (!stream->data_overflow)
+        {
+            if (separator_len > 0)
+            {
+                stream->data[stream->data_len++] = '\n';
+            }
+            memcpy(stream->data + stream->data_len, value, value_len + 1);
+            stream->data_len += value_len;
+        }
+    }
+    return STREAM_CONTINUE; // "id" and "retry" are not used by the database
+}
+
+/**
+ * @brief Parse the bytes received from the stream, and handle the events that are complete
+ */
+static stream_action_t feed(firebase_rtdb_stream *stream, const char *bytes, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        char c = bytes[i];
+        if (c == '\n')
+        {
+            if (stream->line_len > 0 && stream->line[stream->line_len - 1] == '\r')
+            {
+                stream->line_len--;
+            }
+            stream->line[stream->line_len] = '\0';
+            stream_action_t action = process_line(stream);
+            stream->line_len = 0;
+            stream->line_overflow = false;
+            if (action != STREAM_CONTINUE)
+            {
+                return action;
+            }
+        }
+        else if (stream->line_len < EVENT_BUFFER_SIZE - 1)
+        {
+            stream->line[stream->line_len++] = c;
+        }
+        else
+        {
+            stream->line_overflow = true;
+        }
+    }
+    return STREAM_CONTINUE;
+}
+
+static void reset_parser(firebase_rtdb_stream *stream)
+{
+    stream->line_len = 0;
+    stream->line_overflow = false;
+    stream->data[0] = '\0';
+    stream->data_len = 0;
+    stream->data_overflow = false;
+    stream->event_name[0] = '\0';
+    stream->initial_pending = true;
+}
+
+/**
+ * @brief Open the stream, and handle its events until it has to be reopened (or the stream is stopped)
+ *
+ * @param[out] received_events If any event is received, i.e. the connection worked.
+ */
+static stream_action_t listen_once(firebase_rtdb_stream *stream, bool *received_events)
+{
+    char rest_path[REST_PATH_BUFFER_SIZE];
+    if (rest_path_of(rest_path, stream->config.path) != ESP_OK)
+    {
+        return STREAM_RECONNECT;
+    }
+    if (stream->config.token_provider != NULL)
+    {
+        snprintf(stream->query, QUERY_BUFFER_SIZE, "auth=%s", stream->token);
+    }
+
+    esp_http_client_config_t http_config = {
+        .host = host_of(&stream->config),
+        .port = stream->config.plain_http ? stream->config.port : 0,
+        .path = rest_path,
+        .query = stream->config.token_provider != NULL ? stream->query : NULL,
+        .timeout_ms = CONNECT_TIMEOUT_MS,
+        .transport_type = stream->config.plain_http ? HTTP_TRANSPORT_OVER_TCP : HTTP_TRANSPORT_OVER_SSL,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&http_config);
+    if (client == NULL)
+    {
+        return STREAM_RECONNECT;
+    }
+    esp_http_client_set_header(client, "Accept", "text/event-stream");
+
+    int status_code = 0;
+    for (int redirects = 0; redirects <= MAX_REDIRECTS; redirects++)
+    {
+        if (esp_http_client_open(client, 0) != ESP_OK || esp_http_client_fetch_headers(client) < 0)
+        {
+            ESP_LOGW(TAG, "Failed to connect to %s", http_config.host);
+            status_code = 0;
+            break;
+        }
+        status_code = esp_http_client_get_status_code(client);
+        if (status_code != 301 && status_code != 302 && status_code != 307 && status_code != 308)
+        {
+            break;
+        }
+        esp_http_client_set_redirection(client);
+    }
+
+    stream_action_t action = STREAM_RECONNECT;
+    if (status_code == 200)
+    {
+        ESP_LOGI(TAG, "Listening to %s", stream->config.path);
+        stream->stats.connects++;
+        esp_http_client_set_timeout_ms(client, READ_TIMEOUT_MS);
+        reset_parser(stream);
+
+        char buffer[READ_BUFFER_SIZE];
+        int silent_ms = 0;
+        action = STREAM_CONTINUE;
+        while (action == STREAM_CONTINUE && !stream->stop_requested)
+        {
+            int len = esp_http_client_read(client, buffer, READ_BUFFER_SIZE);
+            if (len > 0)
+            {
+                silent_ms = 0;
+                *received_events = true;
+                action = feed(stream, buffer, len);
+            }
+            else if ((len < 0 && len != -ESP_ERR_HTTP_EAGAIN) || esp_http_client_is_complete_data_received(client))
+            {
+                // a read that times out returns -ESP_ERR_HTTP_EAGAIN (or 0 before ESP-IDF 5), the others are errors
+                ESP_LOGW(TAG, "The stream is closed by the server");
+                action = STREAM_RECONNECT;
+            }
+            else if ((silent_ms += READ_TIMEOUT_MS) >= KEEPALIVE_TIMEOUT_MS)
+            {
+                ESP_LOGW(TAG, "Nothing is received in %d ms, reconnecting", silent_ms);
+                action = STREAM_RECONNECT;
+            }
+        }
+    }
+    else if (status_code == 401)
+    {
+        ESP_LOGW(TAG, "The token is rejected");
+        action = STREAM_REAUTHENTICATE;
+    }
+    else if (status_code != 0)
+    {
+        ESP_LOGE(TAG, "The stream is refused with HTTP code: %d", status_code);
+    }
+    if (status_code != 200)
+    {
+        stream->stats.connect_failures++;
+    }
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return action;
+}
+
+/**
+ * @brief Wait, but return early if the stream is stopped
+ */
+static void wait_unless_stopped(firebase_rtdb_stream *stream, int wait_ms)
+{
+    for (int waited_ms = 0; waited_ms < wait_ms && !stream->stop_requested; waited_ms += 100)
+    {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+static void stream_task(void *arg)
+{
+    firebase_rtdb_stream *stream = (firebase_rtdb_stream *)arg;
+    int backoff_ms = RECONNECT_BACKOFF_MIN_MS;
+    bool refresh_token = false;
+    while (!stream->stop_requested)
+    {
+        if (stream->config.token_provider != NULL)
+        {
+            if (stream->config.token_provider(stream->token, refresh_token, stream->config.token_provider_ctx) != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Failed to get the token");
+                wait_unless_stopped(stream, backoff_ms);
+                backoff_ms = backoff_ms * 2 < RECONNECT_BACKOFF_MAX_MS ? backoff_ms * 2 : RECONNECT_BACKOFF_MAX_MS;
+                continue;
+            }
+            if (refresh_token)
+            {
+                stream->stats.token_refreshes++;
+            }
+        }
+
+        bool received_events = false;
+        stream_action_t action = listen_once(stream, &received_events);
+        refresh_token = action == STREAM_REAUTHENTICATE;
+        if (received_events)
+        {
+            backoff_ms = RECONNECT_BACKOFF_MIN_MS; // the connection worked, start over with the shortest backoff
+            if (refresh_token)
+            {
+                continue; // the token expired, reconnect right away
+            }
+        }
+        ESP_LOGI(TAG, "Reconnecting in %d ms", backoff_ms);
+        wait_unless_stopped(stream, backoff_ms);
+        backoff_ms = backoff_ms * 2 < RECONNECT_BACKOFF_MAX_MS ? backoff_ms * 2 : RECONNECT_BACKOFF_MAX_MS;
+    }
+    xSemaphoreGive(stream->task_done);
+    vTaskDelete(NULL);
+}
+
+static void free_stream(firebase_rtdb_stream *stream)
+{
+    if (stream->task_done != NULL)
+    {
+        vSemaphoreDelete(stream->task_done);
+    }
+    heap_caps_free(stream->token);
+    heap_caps_free(stream->query);
+    heap_caps_free(stream->line);
+    heap_caps_free(stream->data);
+    heap_caps_free(stream);
+}
+
+esp_err_t firebase_rtdb_stream_create(const firebase_rtdb_config_t *config, firebase_rtdb_stream_handle_t *stream)
+{
+    if (config == NULL || config->path == NULL || (config->host == NULL && FIREBASE_RTDB_HOST[0] == '\0') ||
+        (config->plain_http && config->port <= 0))
+    {
+        ESP_LOGE(TAG, "The path and the host (or CONFIG_FIREBASE_RTDB_HOST) are required, and the port with plain_http");
+        return ESP_ERR_INVALID_ARG;
+    }
+    firebase_rtdb_stream *new_stream = (firebase_rtdb_stream *)heap_caps_calloc(1, sizeof(firebase_rtdb_stream), MALLOC_CAP_SPIRAM);
+    if (new_stream == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    new_stream->config = *config;
+    new_stream->token = (char *)heap_caps_calloc(1, FIREBASE_RTDB_TOKEN_SIZE, MALLOC_CAP_SPIRAM);
+    new_stream->query = (char *)heap_caps_malloc(QUERY_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+    new_stream->line = (char *)heap_caps_malloc(EVENT_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+    new_stream->data = (char *)heap_caps_malloc(EVENT_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+    new_stream->task_done = xSemaphoreCreateBinary();
+    if (new_stream->token == NULL || new_stream->query == NULL || new_stream->line == NULL ||
+        new_stream->data == NULL || new_stream->task_done == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate the stream");
+        free_stream(new_stream);
+        return ESP_ERR_NO_MEM;
+    }
+    *stream = new_stream;
+    return ESP_OK;
+}
+
+esp_err_t firebase_rtdb_stream_on(firebase_rtdb_stream_handle_t stream, const char *path, firebase_rtdb_callback_t callback, void *user_ctx)
+{
+    if (path == NULL || callback == NULL || stream->task != NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stream->num_callbacks == MAX_CALLBACKS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    stream->callbacks[stream->num_callbacks++] = {path, callback, user_ctx};
+    return ESP_OK;
+}
+
+esp_err_t firebase_rtdb_stream_start(firebase_rtdb_stream_handle_t stream)
+{
+    if (stream->task != NULL)
+    {
+        ESP_LOGW(TAG, "The stream is already started");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTaskCreate(stream_task,
+                    "rtdb_stream",
+                    CONFIG_FIREBASE_RTDB_TASK_STACK_SIZE,
+                    stream,
+                    CONFIG_FIREBASE_RTDB_TASK_PRIORITY,
+                    &stream->task) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create the stream task");
+        stream->task = NULL;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void firebase_rtdb_stream_stop(firebase_rtdb_stream_handle_t stream)
+{
+    if (stream->task != NULL)
+    {
+        stream->stop_requested = true;
+        xSemaphoreTake(stream->task_done, portMAX_DELAY);
+    }
+    ESP_LOGI(TAG, "Stream of %s stopped", stream->config.path);
+    free_stream(stream);
+}
+
+void firebase_rtdb_stream_get_stats(firebase_rtdb_stream_handle_t stream, firebase_rtdb_stats_t *stats)
+{
+    *stats = stream->stats; // the counters are only written by the task of the stream
+}
+
+typedef struct
+{
+    char *buffer;
+    int size;
+    int len;
+    bool truncated;
+} response_sink_t;
+
+static void response_on_chunk(const char *data, int len, void *user_ctx)
+{
+    response_sink_t *sink = (response_sink_t *)user_ctx;
+    int copy_len = len;
+    if (sink->len + copy_len > sink->size - 1)
+    {
+        copy_len = sink->size - 1 - sink->len;
+        sink->truncated = true;
+    }
+    memcpy(sink->buffer + sink->len, data, copy_len);
+    sink->len += copy_len;
+    sink->buffer[sink->len] = '\0';
+}
+
+static void response_on_error(esp_err_t error, void *user_ctx)
+{
+    ESP_LOGE(TAG, "The request failed: %s", esp_err_to_name(error));
+}
+
+/**
+ * @brief Make a REST request to the database, over the transport of firebase_transport.h
+ */
+static esp_err_t rest_request(const firebase_rtdb_config_t *config,
+                              esp_http_client_method_t method,
+                              const char *path,
+                              const char *json,
+                              char *token,
+                              char *response,
+                              int response_size)
+{
+    char rest_path[REST_PATH_BUFFER_SIZE];
+    esp_err_t result = rest_path_of(rest_path, path);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    // a write is answered with 204 and no body, instead of the echo of the written data
+    const char *print_query = method == HTTP_METHOD_GET ? "" : "print=silent";
+    char *query = (char *)heap_caps_malloc(QUERY_BUFFER_SIZE + sizeof("&print=silent"), MALLOC_CAP_SPIRAM);
+    if (query == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (token != NULL)
+    {
+        snprintf(query, QUERY_BUFFER_SIZE + sizeof("&print=silent"), "auth=%s%s%s", token, print_query[0] ? "&" : "", print_query);
+    }
+    else
+    {
+        snprintf(query, QUERY_BUFFER_SIZE + sizeof("&print=silent"), "%s", print_query);
+    }
+
+    firebase_plain_http_config_t plain_http_config = {host_of(config), config->port, false};
+    firebase_transport_t plain_http_transport;
+    const firebase_transport_t *transport = firebase_transport_default();
+    if (config->plain_http)
+    {
+        if (firebase_transport_plain_http_init(&plain_http_transport, &plain_http_config) != ESP_OK)
+        {
+            heap_caps_free(query);
+            return ESP_ERR_INVALID_ARG;
+        }
+        transport = &plain_http_transport;
+    }
+
+    firebase_transport_request_t request = {};
+    request.host = host_of(config);
+    request.path = rest_path;
+    request.query = query;
+    request.method = method;
+    if (json != NULL)
+    {
+        request.content_type = "application/json";
+        request.body = json;
+        request.body_len = strlen(json);
+    }
+    response_sink_t sink = {response, response_size, 0, false};
+    response[0] = '\0';
+    firebase_transport_handler_t handler = {
+        .on_chunk = response_on_chunk,
+        .on_error = response_on_error,
+        .user_ctx = &sink,
+    };
+    int status_code = 0;
+    result = transport->request(transport, &request, &handler, &status_code);
+    heap_caps_free(query);
+    if (result != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    if (status_code != 200 && status_code != 204)
+    {
+        ESP_LOGE(TAG, "Realtime Database REST API call failed with HTTP code: %d", status_code);
+        ESP_LOGE(TAG, "Error message: %s", response);
+        return ESP_FAIL;
+    }
+    return sink.truncated ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+esp_err_t firebase_rtdb_get(const firebase_rtdb_config_t *config, const char *path, char *token, char *response, int response_size)
+{
+    return rest_request(config, HTTP_METHOD_GET, path, NULL, token, response, response_size);
+}
+
+esp_err_t firebase_rtdb_put(const firebase_rtdb_config_t *config, const char *path, const char *json, char *token)
+{
+    char response[ERROR_MESSAGE_SIZE]; // only for the error message
+    esp_err_t result = rest_request(config, HTTP_METHOD_PUT, path, json, token, response, ERROR_MESSAGE_SIZE);
+    return result == ESP_ERR_INVALID_SIZE ? ESP_OK : result; // a long error message is cut, the status code is what counts
+}
@@ -0,0 +1,144 @@
+#ifndef FIREBASE_RTDB_H_
+#define FIREBASE_RTDB_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+    /**
+     * A listener of a Firebase Realtime Database location, over the REST streaming API (Server-Sent Events).
+     * https://firebase.google.com/docs/reference/rest/database#section-streaming
+     * A task keeps the `Accept: text/event-stream` connection open and parses the events as they arrive,
+     * so a device gets a command as soon as it is written, without polling.
+     *
+     * - The first `put` after each (re)connect holds the whole data of the location (`initial` is set),
+     *   so a device that was offline catches up with what it missed.
+     * - The connection is reopened (with exponential backoff) if it drops, if the server cancels it, or if no
+     *   event (including the keep-alive every 30 s) arrives in CONFIG_FIREBASE_RTDB_KEEPALIVE_TIMEOUT_MS.
+     * - On `auth_revoked` (the token expired) or 401, the token provider is asked for a fresh token.
+     */
+
+#define FIREBASE_RTDB_HOST CONFIG_FIREBASE_RTDB_HOST
+#define FIREBASE_RTDB_TOKEN_SIZE 1024 // the size of the token buffer given to the token provider
+
+    typedef enum
+    {
+        FIREBASE_RTDB_EVENT_PUT,          // `data` replaces the data at `path`
+        FIREBASE_RTDB_EVENT_PATCH,        // each child of `data` replaces the data at `path` + "/" + its key
+        FIREBASE_RTDB_EVENT_CANCEL,       // the server closed the stream (e.g. the security rules deny it), it is reopened later
+        FIREBASE_RTDB_EVENT_AUTH_REVOKED, // the token is no longer valid, the stream is reopened with a fresh one
+    } firebase_rtdb_event_type_t;
+
+    typedef struct
+    {
+        firebase_rtdb_event_type_t type;
+        const char *path;    // relative to the path of the stream, e.g. "/" or "/command"
+        const cJSON *data;   // the data of a put or patch, NULL for the other events. It is only valid during the callback.
+        const char *message; // the reason of a cancel or auth_revoked, NULL for the other events
+        bool initial;        // the first put after (re)connecting, with the whole data of the stream
+    } firebase_rtdb_event_t;
+
+    /**
+     * @brief Called from the task of the stream with each event of the listened path
+     */
+    typedef void (*firebase_rtdb_callback_t)(const firebase_rtdb_event_t *event, void *user_ctx);
+
+    /**
+     * @brief Give the token of the stream
+     *
+     * @param[out] token The buffer of FIREBASE_RTDB_TOKEN_SIZE bytes to write the ID token into.
+     * @param[in] refresh The last token is rejected (expired or revoked), get a new one (e.g. by `firebase_get_access_token_from_refresh_token`).
+     * If false, a cached token can be given.
+     * @param[in] user_ctx The `token_provider_ctx` of the config.
+     */
+    typedef esp_err_t (*firebase_rtdb_token_provider_t)(char *token, bool refresh, void *user_ctx);
+
+    typedef struct
+    {
+        const char *path;                              // the location to listen to, e.g. "/devices/dev1"
+        const char *host;                              // NULL for CONFIG_FIREBASE_RTDB_HOST, e.g. "<project>-default-rtdb.firebaseio.com"
+        int port;                                      // the port of `plain_http`, e.g. 9000 for the emulator
+        bool plain_http;                               // connect without TLS, e.g. to the emulator or a local stub server
+        firebase_rtdb_token_provider_t token_provider; // NULL to connect without a token (the emulator or public data)
+        void *token_provider_ctx;
+    } firebase_rtdb_config_t;
+
+    typedef struct
+    {
+        uint32_t connects;        // successful (re)connections
+        uint32_t connect_failures;
+        uint32_t events;          // put and patch events
+        uint32_t keep_alives;
+        uint32_t dropped_events;  // events longer than CONFIG_FIREBASE_RTDB_EVENT_BUFFER_SIZE, or not valid JSON
+        uint32_t token_refreshes;
+    } firebase_rtdb_stats_t;
+
+    typedef struct firebase_rtdb_stream *firebase_rtdb_stream_handle_t;
+
+    /**
+     * @brief Make a stream of a location (it is not connected until `firebase_rtdb_stream_start`)
+     *
+     * @param[in] config The location and how to connect. The strings have to stay valid as long as the stream is used.
+     * @param[out] stream The handle of the stream.
+     */
+    esp_err_t firebase_rtdb_stream_create(const firebase_rtdb_config_t *config, firebase_rtdb_stream_handle_t *stream);
+
+    /**
+     * @brief Call `callback` with the events at `path`, below it, and above it (e.g. the initial put at "/")
+     * Call this before `firebase_rtdb_stream_start`.
+     *
+     * @param[in] stream The stream.
+     * @param[in] path The path relative to the path of the stream, e.g. "/command", or "/" for all the events.
+     * It has to stay valid as long as the stream is used.
+     * @param[in] callback The callback.
+     * @param[in] user_ctx Passed to `callback`.
+     * @return ESP_ERR_NO_MEM if the stream has CONFIG_FIREBASE_RTDB_MAX_CALLBACKS callbacks already.
+     */
+    esp_err_t firebase_rtdb_stream_on(firebase_rtdb_stream_handle_t stream, const char *path, firebase_rtdb_callback_t callback, void *user_ctx);
+
+    /**
+     * @brief Start the task that keeps the stream connected
+     */
+    esp_err_t firebase_rtdb_stream_start(firebase_rtdb_stream_handle_t stream);
+
+    /**
+     * @brief Stop the stream and release it
+     * This waits for the task to finish, which takes up to a second (or up to the connect timeout, if it is connecting).
+     */
+    void firebase_rtdb_stream_stop(firebase_rtdb_stream_handle_t stream);
+
+    void firebase_rtdb_stream_get_stats(firebase_rtdb_stream_handle_t stream, firebase_rtdb_stats_t *stats);
+
+    /**
+     * @brief Read the data at a path (one REST request), e.g. to poll, or to read once without a stream
+     *
+     * @param[in] config The host, and how to connect, of the database (its `path` is ignored).
+     * @param[in] path The path to read, e.g. "/devices/dev1/command"
+     * @param[in] token The ID token, or NULL.
+     * @param[out] response The JSON of the data ("null" if there is nothing at the path).
+     * @param[in] response_size The size of `response`.
+     * @return ESP_ERR_INVALID_SIZE if the data doesn't fit in `response`.
+     */
+    esp_err_t firebase_rtdb_get(const firebase_rtdb_config_t *config, const char *path, char *token, char *response, int response_size);
+
+    /**
+     * @brief Write the data at a path (one REST request), e.g. to acknowledge a command
+     *
+     * @param[in] config The host, and how to connect, of the database (its `path` is ignored).
+     * @param[in] path The path to write, e.g. "/devices/dev1/ack"
+     * @param[in] json The data, e.g. "{\"id\": 42}"
+     * @param[in] token The ID token, or NULL.
+     */
+    esp_err_t firebase_rtdb_put(const firebase_rtdb_config_t *config, const char *path, const char *json, char *token);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIREBASE_RTDB_H_ */
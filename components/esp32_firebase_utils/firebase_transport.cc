@@ -0,0 +1,367 @@
+/**
+ * @file firebase_transport.cc
+ * @brief The backends of the transport of the Firestore and auth requests (see firebase_transport.h)
+ * The esp_http_client backends send a request with a body in one `esp_http_client_perform`,
+ * and stream a produced body with open / write / fetch_headers / read.
+ */
+
+#include "firebase_transport.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "FB_TRANSPORT";
+
+static const int SEND_BUF_SIZE = 4096; // this is also called transmit (tx) buffer size
+static const int RECEIVE_BUF_SIZE = 4096;
+static const int CHUNK_HEADER_SIZE = 10; // chunk size line of chunked transfer encoding, e.g. "3ff\r\n"
+
+/**
+ * @brief Give the response body of `esp_http_client_perform` to the handler of the request
+ * It is not registered for a streamed request, whose response is read by `stream_request`.
+ */
+static esp_err_t http_event_handler(esp_http_client_event_t *client_event)
+{
+    const firebase_transport_handler_t *handler = (const firebase_transport_handler_t *)client_event->user_data;
+    switch (client_event->event_id)
+    {
+    case HTTP_EVENT_ERROR:
+        ESP_LOGI(TAG, "HTTP error");
+        break;
+    case HTTP_EVENT_ON_CONNECTED:
+        ESP_LOGI(TAG, "HTTP connected to server");
+        break;
+    case HTTP_EVENT_ON_DATA: // note that this might be called multiple times because the data might be chunked
+        ESP_LOGI(TAG, "HTTP data received, with length: %d", client_event->data_len);
+        handler->on_chunk((const char *)client_event->data, client_event->data_len, handler->user_ctx);
+        break;
+    case HTTP_EVENT_ON_FINISH:
+        ESP_LOGI(TAG, "HTTP session is finished");
+        break;
+    default:
+        break;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Write a piece of the request body, framed as a chunk if chunked transfer encoding is used
+ */
+static esp_err_t write_body_piece(esp_http_client_handle_t client_handle, const char *data, int data_len, bool chunked)
+{
+    if (chunked)
+    {
+        char chunk_header[CHUNK_HEADER_SIZE];
+        int header_len = snprintf(chunk_header, CHUNK_HEADER_SIZE, "%x\r\n", data_len);
+        if (esp_http_client_write(client_handle, chunk_header, header_len) != header_len ||
+            esp_http_client_write(client_handle, data, data_len) != data_len ||
+            esp_http_client_write(client_handle, "\r\n", 2) != 2)
+        {
+            return ESP_FAIL;
+        }
+        return ESP_OK;
+    }
+    return esp_http_client_write(client_handle, data, data_len) == data_len ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Produce the body of the request, and give each piece to `consume`
+ *
+ * @param[in] piece_buffer A buffer of `piece_size` bytes, usually FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE.
+ * @param[out] total_len The length of the produced body.
+ */
+template <typename CONSUME>
+static esp_err_t produce_body(const firebase_transport_request_t *request, char *piece_buffer, int piece_size, int *total_len, CONSUME consume)
+{
+    bool chunked = request->content_length < 0;
+    int total_written = 0;
+    while (true)
+    {
+        int piece_len = request->body_producer(piece_buffer, piece_size, request->body_producer_ctx);
+        if (piece_len == 0)
+        {
+            break;
+        }
+        if (piece_len < 0 || piece_len > piece_size)
+        {
+            ESP_LOGE(TAG, "The body producer failed (returned %d)", piece_len);
+            return ESP_FAIL;
+        }
+        if (!chunked && total_written + piece_len > request->content_length)
+        {
+            ESP_LOGE(TAG, "The body is longer than the content length %d", request->content_length);
+            return ESP_FAIL;
+        }
+        if (consume(piece_buffer, piece_len) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to write the request body");
+            return ESP_FAIL;
+        }
+        total_written += piece_len;
+    }
+    if (!chunked && total_written != request->content_length)
+    {
+        ESP_LOGE(TAG, "The body (%d bytes) is shorter than the content length %d", total_written, request->content_length);
+        return ESP_FAIL;
+    }
+    *total_len = total_written;
+    return ESP_OK;
+}
+
+/**
+ * @brief Stream the produced body of the request, and read the response into the handler
+ */
+static esp_err_t stream_request(esp_http_client_handle_t client_handle,
+                                const firebase_transport_request_t *request,
+                                const firebase_transport_handler_t *handler)
+{
+    bool chunked = request->content_length < 0;
+    char *piece_buffer = (char *)heap_caps_malloc(FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE, MALLOC_CAP_SPIRAM);
+    if (piece_buffer == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate the stream chunk buffer");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // with a negative write length, esp_http_client sets `Transfer-Encoding: chunked` (but the chunks are framed by us)
+    esp_err_t result = esp_http_client_open(client_handle, chunked ? -1 : request->content_length);
+    if (result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(result));
+        heap_caps_free(piece_buffer);
+        return result;
+    }
+
+    int total_written = 0;
+    result = produce_body(request, piece_buffer, FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE, &total_written, [&](const char *piece, int piece_len)
+                          { return write_body_piece(client_handle, piece, piece_len, chunked); });
+    if (result == ESP_OK && chunked && esp_http_client_write(client_handle, "0\r\n\r\n", 5) != 5)
+    {
+        ESP_LOGE(TAG, "Failed to write the last chunk");
+        result = ESP_FAIL;
+    }
+    if (result == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Request body streamed, %d bytes", total_written);
+        if (esp_http_client_fetch_headers(client_handle) < 0)
+        {
+            ESP_LOGE(TAG, "Failed to fetch the response headers");
+            result = ESP_FAIL;
+        }
+    }
+
+    // the piece buffer is reused to read the response
+    int len;
+    while (result == ESP_OK && (len = esp_http_client_read(client_handle, piece_buffer, FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE)) > 0)
+    {
+        handler->on_chunk(piece_buffer, len, handler->user_ctx);
+    }
+    heap_caps_free(piece_buffer);
+    esp_http_client_close(client_handle);
+    return result;
+}
+
+/**
+ * @brief Send a request with esp_http_client
+ *
+ * @param[in] port The port, or 0 for the default port of the transport type.
+ * @param[in] path The path to send the request to (instead of the one of the request).
+ */
+static esp_err_t esp_http_client_request(const char *host,
+                                         int port,
+                                         esp_http_client_transport_t transport_type,
+                                         const char *path,
+                                         const firebase_transport_request_t *request,
+                                         const firebase_transport_handler_t *handler,
+                                         int *status_code)
+{
+    esp_http_client_config_t http_config = {
+        .host = host,
+        .port = port,
+        .path = path,
+        .query = request->query,
+        .method = request->method,
+        .timeout_ms = request->timeout_ms,
+        .event_handler = http_event_handler,
+        .transport_type = transport_type,
+        .buffer_size = RECEIVE_BUF_SIZE,
+        .buffer_size_tx = SEND_BUF_SIZE,
+        .user_data = (void *)handler // the response body is given to the handler
+    };
+    if (request->body_producer != NULL)
+    {
+        // esp_http_client_read also fires HTTP_EVENT_ON_DATA, the streamed response is given to the handler by the read loop only
+        http_config.event_handler = NULL;
+    }
+
+    ESP_LOGI(TAG, "HTTP path: %s", path);
+    // the Realtime Database requests carry the token in the query ("auth=<token>"), only the part before it is logged
+    const char *query = request->query ? request->query : "";
+    const char *auth_param = strstr(query, "auth=");
+    ESP_LOGI(TAG, "HTTP query: %.*s", auth_param != NULL ? (int)(auth_param - query) : (int)strlen(query), query);
+    esp_http_client_handle_t client_handle = esp_http_client_init(&http_config);
+    if (client_handle == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to initialize the HTTP client");
+        handler->on_error(ESP_ERR_NO_MEM, handler->user_ctx);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_http_client_set_method(client_handle, request->method);
+    if (request->content_type != NULL)
+    {
+        esp_http_client_set_header(client_handle, "Content-Type", request->content_type);
+    }
+    if (request->authorization != NULL)
+    {
+        esp_http_client_set_header(client_handle, "Authorization", request->authorization);
+    }
+
+    esp_err_t result = ESP_OK;
+    if (request->body_producer != NULL)
+    {
+        result = stream_request(client_handle, request, handler);
+    }
+    else
+    {
+        if (request->body != NULL)
+        {
+            esp_http_client_set_post_field(client_handle, request->body, request->body_len);
+        }
+        result = esp_http_client_perform(client_handle);
+    }
+
+    if (result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to perform HTTP request: %s", esp_err_to_name(result));
+        handler->on_error(result, handler->user_ctx);
+    }
+    else
+    {
+        *status_code = esp_http_client_get_status_code(client_handle);
+        ESP_LOGI(TAG, "HTTP Response code: %d", *status_code);
+    }
+    esp_http_client_cleanup(client_handle);
+    return result;
+}
+
+static esp_err_t ssl_request(const firebase_transport_t *transport,
+                             const firebase_transport_request_t *request,
+                             const firebase_transport_handler_t *handler,
+                             int *status_code)
+{
+    return esp_http_client_request(request->host, 0, HTTP_TRANSPORT_OVER_SSL, request->path, request, handler, status_code);
+}
+
+static const firebase_transport_t SSL_TRANSPORT = {
+    .request = ssl_request,
+    .ctx = NULL,
+};
+
+const firebase_transport_t *firebase_transport_default(void)
+{
+    return &SSL_TRANSPORT;
+}
+
+static esp_err_t plain_http_request(const firebase_transport_t *transport,
+                                    const firebase_transport_request_t *request,
+                                    const firebase_transport_handler_t *handler,
+                                    int *status_code)
+{
+    const firebase_plain_http_config_t *config = (const firebase_plain_http_config_t *)transport->ctx;
+    if (!config->prefix_path_with_host)
+    {
+        return esp_http_client_request(config->host, config->port, HTTP_TRANSPORT_OVER_TCP, request->path, request, handler, status_code);
+    }
+
+    // e.g. "/securetoken.googleapis.com/v1/token?key=..."
+    int path_size = strlen(request->host) + strlen(request->path) + 2;
+    char *path = (char *)heap_caps_malloc(path_size, MALLOC_CAP_SPIRAM);
+    if (path == NULL)
+    {
+        handler->on_error(ESP_ERR_NO_MEM, handler->user_ctx);
+        return ESP_ERR_NO_MEM;
+    }
+    snprintf(path, path_size, "/%s%s", request->host, request->path);
+    esp_err_t result = esp_http_client_request(config->host, config->port, HTTP_TRANSPORT_OVER_TCP, path, request, handler, status_code);
+    heap_caps_free(path);
+    return result;
+}
+
+esp_err_t firebase_transport_plain_http_init(firebase_transport_t *transport, const firebase_plain_http_config_t *config)
+{
+    if (transport == NULL || config == NULL || config->host == NULL || config->port <= 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    transport->request = plain_http_request;
+    transport->ctx = (void *)config;
+    return ESP_OK;
+}
+
+static bool loopback_matches(const firebase_loopback_response_t *response, const firebase_transport_request_t *request)
+{
+    return (response->method < 0 || response->method == request->method) &&
+           (response->path_contains == NULL || strstr(request->path, response->path_contains) != NULL);
+}
+
+static esp_err_t loopback_request(const firebase_transport_t *transport,
+                                  const firebase_transport_request_t *request,
+                                  const firebase_transport_handler_t *handler,
+                                  int *status_code)
+{
+    firebase_loopback_config_t *config = (firebase_loopback_config_t *)transport->ctx;
+
+    // produce the streamed body like it would be sent
+    if (request->body_producer != NULL)
+    {
+        char piece_buffer[FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE];
+        int piece_size = config->body_piece_size > 0 && config->body_piece_size < FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE
+                             ? config->body_piece_size
+                             : FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE;
+        int total_len = 0;
+        esp_err_t result = produce_body(request, piece_buffer, piece_size, &total_len, [](const char *piece, int piece_len)
+                                        { return ESP_OK; });
+        if (result != ESP_OK)
+        {
+            handler->on_error(result, handler->user_ctx);
+            return result;
+        }
+    }
+
+    firebase_loopback_response_t *response = NULL;
+    for (int i = 0; i < config->num_responses && response == NULL; i++)
+    {
+        if (loopback_matches(&config->responses[i], request))
+        {
+            response = &config->responses[i];
+        }
+    }
+    if (response == NULL)
+    {
+        config->unmatched++;
+        *status_code = 404;
+        return ESP_OK;
+    }
+
+    response->hits++;
+    *status_code = response->status_code;
+    int body_len = response->body != NULL ? strlen(response->body) : 0;
+    int chunk_size = config->chunk_size > 0 ? config->chunk_size : body_len;
+    for (int offset = 0; offset < body_len; offset += chunk_size)
+    {
+        int len = body_len - offset < chunk_size ? body_len - offset : chunk_size;
+        handler->on_chunk(response->body + offset, len, handler->user_ctx);
+    }
+    return ESP_OK;
+}
+
+esp_err_t firebase_transport_loopback_init(firebase_transport_t *transport, firebase_loopback_config_t *config)
+{
+    if (transport == NULL || config == NULL || (config->num_responses > 0 && config->responses == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    transport->request = loopback_request;
+    transport->ctx = config;
+    return ESP_OK;
+}
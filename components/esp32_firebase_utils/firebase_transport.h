@@ -0,0 +1,133 @@
+#ifndef FIREBASE_TRANSPORT_H_
+#define FIREBASE_TRANSPORT_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+    /**
+     * The transport the Firestore and auth requests are sent over. A backend implements `request`,
+     * and gives the response body back piece by piece to the `on_chunk` callback of the caller.
+     * Three backends are provided:
+     * - esp_http_client over TLS to the host of the request (the default),
+     * - esp_http_client over plain HTTP to a fixed host and port, e.g. the Firestore or Auth emulator,
+     * - an in-process loopback that serves recorded responses, so the request building and response
+     *   parsing can be run (and timed) without any network.
+     * Set it with `firestore_set_transport` and `firebase_auth_set_transport`.
+     */
+
+    /**
+     * @brief Producer of a streamed request body, it is called until it returns 0
+     * The backends offer a buffer of FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE bytes (the HTTP/2 one too, it sends the piece
+     * across as many DATA frames as its flow control window needs), but a producer has to handle any `buffer_size` >= 1:
+     * it keeps what doesn't fit for the next call, and returns 0 only when the whole body is produced.
+     * The loopback backend can offer smaller buffers (`body_piece_size`) to check that.
+     *
+     * @param[out] buffer The buffer to write the next piece of the body into.
+     * @param[in] buffer_size The size of the buffer.
+     * @param[in] user_ctx The `producer_ctx` given to the streaming API.
+     * @return The number of bytes written into the buffer, 0 when the body is finished, or a negative value to abort the request.
+     */
+    typedef int (*firestore_body_producer_t)(char *buffer, int buffer_size, void *user_ctx);
+
+    typedef struct
+    {
+        const char *host;                        // e.g. "firestore.googleapis.com"
+        const char *path;                        // e.g. "/v1/projects/<id>/databases/(default)/documents/col1/doc1"
+        const char *query;                       // can be NULL
+        esp_http_client_method_t method;
+        const char *content_type;                // the Content-Type of the body, NULL if there is no body
+        const char *authorization;               // the Authorization header, can be NULL
+        const char *body;                        // the body, NULL if there is none or it is streamed
+        int body_len;
+        firestore_body_producer_t body_producer; // if not NULL, the body is streamed from it (in pieces of FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE)
+        void *body_producer_ctx;
+        int content_length;                      // the length of the streamed body, or -1 for chunked transfer encoding
+        int timeout_ms;                          // 0 for the default of the backend
+    } firebase_transport_request_t;
+
+    typedef struct
+    {
+        void (*on_chunk)(const char *data, int len, void *user_ctx); // a piece of the response body, called in order
+        void (*on_error)(esp_err_t error, void *user_ctx);           // the request failed before a response was received
+        void *user_ctx;
+    } firebase_transport_handler_t;
+
+    typedef struct firebase_transport_t firebase_transport_t;
+    struct firebase_transport_t
+    {
+        /**
+         * @brief Send the request, and give the response body to `handler->on_chunk`
+         *
+         * @param[out] status_code The HTTP status code of the response.
+         * @return ESP_OK if a response is received (whatever its status code), otherwise `handler->on_error` is called too.
+         */
+        esp_err_t (*request)(const firebase_transport_t *transport,
+                             const firebase_transport_request_t *request,
+                             const firebase_transport_handler_t *handler,
+                             int *status_code);
+        void *ctx; // the state of the backend
+    };
+
+#define FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE 1024 // the size of the pieces a streamed request body is produced in
+
+    /**
+     * @brief The default backend: esp_http_client over TLS to the host of the request
+     */
+    const firebase_transport_t *firebase_transport_default(void);
+
+    typedef struct
+    {
+        const char *host;           // e.g. "192.168.1.10"
+        int port;                   // e.g. 8080 for the Firestore emulator, 9099 for the Auth emulator
+        bool prefix_path_with_host; // the Auth emulator serves e.g. "/securetoken.googleapis.com/v1/token", set this for it
+    } firebase_plain_http_config_t;
+
+    /**
+     * @brief Make a backend that sends the requests over plain HTTP to a fixed host and port, e.g. the emulators
+     * The Firestore emulator accepts "owner" as the token, e.g. `firestore_patch(path, data, (char *)"owner", ...)`
+     *
+     * @param[out] transport The backend to initialize.
+     * @param[in] config The host and port, it has to stay valid as long as the backend is used.
+     */
+    esp_err_t firebase_transport_plain_http_init(firebase_transport_t *transport, const firebase_plain_http_config_t *config);
+
+    typedef struct
+    {
+        int method;                // the esp_http_client_method_t to match, or -1 for any method
+        const char *path_contains; // matches if the path contains this, NULL for any path
+        int status_code;
+        const char *body;
+        uint32_t hits;             // [out] the number of requests served with this response
+    } firebase_loopback_response_t;
+
+    typedef struct
+    {
+        firebase_loopback_response_t *responses; // the first matching response is served
+        int num_responses;
+        int chunk_size;     // the response body is given back in pieces of this size, 0 for one piece
+        uint32_t unmatched; // [out] the number of requests without a matching response (they are answered with 404)
+        int body_piece_size; // the size of the buffer a streamed request body is produced into, 0 for FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE
+    } firebase_loopback_config_t;
+
+    /**
+     * @brief Make a backend that serves recorded responses in-process, without any network
+     * A streamed request body is produced (and dropped) like it would be sent, and checked against its content length. The counters of the config
+     * are not protected, use the backend from one task at a time.
+     *
+     * @param[out] transport The backend to initialize.
+     * @param[in] config The responses, it has to stay valid as long as the backend is used.
+     */
+    esp_err_t firebase_transport_loopback_init(firebase_transport_t *transport, firebase_loopback_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIREBASE_TRANSPORT_H_ */
@@ -0,0 +1,849 @@
+/**
+ * @file firestore_blob.cc
+ * @brief Blobs split into base64 `bytesValue` chunk documents plus a manifest document (see firestore_blob.h)
+ * A chunk is base64 encoded by the body producer of `firestore_patch_stream_at` while it is sent, and it is
+ * decoded by the response consumer of `firestore_get_document_stream_at` while it is received, so neither
+ * direction holds a whole chunk in RAM (except the HTTP/2 upload, which needs the bodies of the chunks in flight).
+ */
+
+#include "firestore_blob.h"
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "cJSON.h"
+#include "firestore_utils.h"
+#ifdef CONFIG_FIRESTORE_HTTP2_TRANSPORT
+#include "firebase_auth.h"
+#include "firestore_http2.h"
+#endif
+
+#define CHUNK_SIZE CONFIG_FIRESTORE_BLOB_CHUNK_SIZE
+#define BLOB_PATH_MAX_LEN 256 // the path of a chunk document, e.g. "<path_to_blob>/chunks/00042"
+#define MANIFEST_JSON_SIZE 320
+#define MANIFEST_RESPONSE_SIZE 1024
+#define PROGRESS_NVS_NAMESPACE "fs_blob"
+#define PROGRESS_KEY_SIZE 9 // the CRC-32 of the blob path in hex, NVS keys are at most 15 characters
+
+#ifdef CONFIG_FIRESTORE_HTTP2_TRANSPORT
+#define PARALLEL_CHUNKS (CONFIG_FIRESTORE_BLOB_PARALLEL_CHUNKS < CONFIG_FIRESTORE_HTTP2_MAX_CONCURRENT_STREAMS \
+                             ? CONFIG_FIRESTORE_BLOB_PARALLEL_CHUNKS                                         \
+                             : CONFIG_FIRESTORE_HTTP2_MAX_CONCURRENT_STREAMS)
+#define H2_BATCH_TIMEOUT_MS 60000
+#endif
+
+static const char *TAG = "FS_BLOB";
+
+static const char CHUNK_BODY_PREFIX[] = "{\"fields\": {\"data\": {\"bytesValue\": \"";
+static const char CHUNK_BODY_SUFFIX[] = "\"}}}";
+static const char CHUNK_DATA_KEY[] = "\"bytesValue\""; // what the decoder looks for in the response
+static const char *CHUNK_FIELDS[] = {"data"};
+static const char *MANIFEST_FIELDS[] = {"size", "chunkSize", "chunkCount", "crc32", "complete"};
+
+static const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const int RAW_PIECE_SIZE = 192; // the bytes of the blob that are read (and encoded) at a time, a multiple of 3
+
+typedef struct
+{
+    uint32_t size;
+    uint32_t chunk_size;
+    uint32_t crc32;
+    uint32_t chunks_done; // the chunks [0, chunks_done) are uploaded
+} blob_progress_t;
+
+static int read_from_buffer(char *buffer, int size, uint32_t offset, void *ctx)
+{
+    memcpy(buffer, (const char *)ctx + offset, size);
+    return size;
+}
+
+void firestore_blob_source_from_buffer(firestore_blob_source_t *source, const void *data, uint32_t size)
+{
+    source->read = read_from_buffer;
+    source->ctx = (void *)data;
+    source->size = size;
+}
+
+static int read_from_file(char *buffer, int size, uint32_t offset, void *ctx)
+{
+    FILE *file = (FILE *)ctx;
+    if (fseek(file, offset, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    return fread(buffer, 1, size, file);
+}
+
+esp_err_t firestore_blob_source_from_file(firestore_blob_source_t *source, FILE *file)
+{
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    long size = ftell(file);
+    if (size < 0)
+    {
+        return ESP_FAIL;
+    }
+    source->read = read_from_file;
+    source->ctx = file;
+    source->size = size;
+    return ESP_OK;
+}
+
+static int base64_encoded_len(uint32_t raw_len)
+{
+    return 4 * ((raw_len + 2) / 3);
+}
+
+/**
+ * @brief Encode `len` bytes into `dest`, with padding (so only the last piece of a chunk can have a length that is not a multiple of 3)
+ *
+ * @return The number of characters written.
+ */
+static int base64_encode(const uint8_t *src, int len, char *dest)
+{
+    int out = 0;
+    for (int i = 0; i < len; i += 3)
+    {
+        uint32_t bits = (uint32_t)src[i] << 16;
+        if (i + 1 < len)
+        {
+            bits |= (uint32_t)src[i + 1] << 8;
+        }
+        if (i + 2 < len)
+        {
+            bits |= src[i + 2];
+        }
+        dest[out++] = BASE64_ALPHABET[(bits >> 18) & 0x3f];
+        dest[out++] = BASE64_ALPHABET[(bits >> 12) & 0x3f];
+        dest[out++] = i + 1 < len ? BASE64_ALPHABET[(bits >> 6) & 0x3f] : '=';
+        dest[out++] = i + 2 < len ? BASE64_ALPHABET[bits & 0x3f] : '=';
+    }
+    return out;
+}
+
+static int base64_value(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '+' || c == '-') // also accept the URL-safe alphabet
+        return 62;
+    if (c == '/' || c == '_')
+        return 63;
+    return -1;
+}
+
+static uint32_t chunk_len_of(uint32_t blob_size, uint32_t index)
+{
+    uint32_t offset = index * CHUNK_SIZE;
+    return blob_size - offset < CHUNK_SIZE ? blob_size - offset : CHUNK_SIZE;
+}
+
+static int chunk_body_len(uint32_t chunk_len)
+{
+    return sizeof(CHUNK_BODY_PREFIX) - 1 + base64_encoded_len(chunk_len) + sizeof(CHUNK_BODY_SUFFIX) - 1;
+}
+
+static esp_err_t chunk_path_of(char *chunk_path, const char *path_to_blob, uint32_t index)
+{
+    if (snprintf(chunk_path, BLOB_PATH_MAX_LEN, "%s/chunks/%05" PRIu32, path_to_blob, index) >= BLOB_PATH_MAX_LEN)
+    {
+        ESP_LOGE(TAG, "The blob path %s is too long", path_to_blob);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+typedef struct
+{
+    const firestore_blob_source_t *source;
+    uint32_t offset; // the next byte of the blob to encode
+    uint32_t end;    // the end of the chunk in the blob
+    int prefix_pos;  // how much of CHUNK_BODY_PREFIX is produced
+    int suffix_pos;
+    char pending[4]; // a base64 group that didn't fit in the buffer, it goes first in the next one
+    int pending_len;
+    int pending_pos;
+} chunk_producer_t;
+
+/**
+ * @brief Copy what is left of `part` (from `*pos`) into the buffer, as much as fits
+ */
+static int copy_rest(char *buffer, int room, const char *part, int part_len, int *pos)
+{
+    int len = part_len - *pos < room ? part_len - *pos : room;
+    memcpy(buffer, part + *pos, len);
+    *pos += len;
+    return len;
+}
+
+/**
+ * @brief Read the next `raw_len` bytes of the chunk
+ */
+static bool read_raw(chunk_producer_t *producer, uint8_t *raw, int raw_len)
+{
+    if (producer->source->read((char *)raw, raw_len, producer->offset, producer->source->ctx) != raw_len)
+    {
+        ESP_LOGE(TAG, "Failed to read %d bytes of the blob at offset %" PRIu32, raw_len, producer->offset);
+        return false;
+    }
+    producer->offset += raw_len;
+    return true;
+}
+
+/**
+ * @brief The body producer of a chunk document: the prefix, the chunk of the blob in base64, then the suffix
+ * Any buffer size works: a base64 group that doesn't fit is kept for the next call, and 0 is only returned after the suffix.
+ */
+static int produce_chunk_body(char *buffer, int buffer_size, void *ctx)
+{
+    chunk_producer_t *producer = (chunk_producer_t *)ctx;
+    int len = copy_rest(buffer, buffer_size, CHUNK_BODY_PREFIX, sizeof(CHUNK_BODY_PREFIX) - 1, &producer->prefix_pos);
+    len += copy_rest(buffer + len, buffer_size - len, producer->pending, producer->pending_len, &producer->pending_pos);
+
+    uint8_t raw[RAW_PIECE_SIZE];
+    while (producer->offset < producer->end && buffer_size - len >= 4)
+    {
+        int raw_len = (buffer_size - len) / 4 * 3;
+        if (raw_len > RAW_PIECE_SIZE)
+        {
+            raw_len = RAW_PIECE_SIZE;
+        }
+        if ((uint32_t)raw_len > producer->end - producer->offset)
+        {
+            raw_len = producer->end - producer->offset;
+        }
+        if (!read_raw(producer, raw, raw_len))
+        {
+            return -1;
+        }
+        len += base64_encode(raw, raw_len, buffer + len);
+    }
+    if (producer->offset < producer->end && len < buffer_size)
+    {
+        // less room than a base64 group: encode the group aside, and give what fits
+        int raw_len = producer->end - producer->offset < 3 ? producer->end - producer->offset : 3;
+        if (!read_raw(producer, raw, raw_len))
+        {
+            return -1;
+        }
+        producer->pending_len = base64_encode(raw, raw_len, producer->pending);
+        producer->pending_pos = 0;
+        len += copy_rest(buffer + len, buffer_size - len, producer->pending, producer->pending_len, &producer->pending_pos);
+    }
+
+    if (producer->offset == producer->end && producer->pending_pos == producer->pending_len)
+    {
+        len += copy_rest(buffer + len, buffer_size - len, CHUNK_BODY_SUFFIX, sizeof(CHUNK_BODY_SUFFIX) - 1, &producer->suffix_pos);
+    }
+    return len;
+}
+
+static void chunk_producer_init(chunk_producer_t *producer, const firestore_blob_source_t *source, uint32_t index)
+{
+    producer->source = source;
+    producer->offset = index * CHUNK_SIZE;
+    producer->end = producer->offset + chunk_len_of(source->size, index);
+    producer->prefix_pos = 0;
+    producer->suffix_pos = 0;
+    producer->pending_len = 0;
+    producer->pending_pos = 0;
+}
+
+static esp_err_t compute_crc32(const firestore_blob_source_t *source, uint32_t *crc32)
+{
+    uint8_t raw[RAW_PIECE_SIZE];
+    uint32_t crc = 0;
+    for (uint32_t offset = 0; offset < source->size; offset += RAW_PIECE_SIZE)
+    {
+        int len = source->size - offset < (uint32_t)RAW_PIECE_SIZE ? source->size - offset : RAW_PIECE_SIZE;
+        if (source->read((char *)raw, len, offset, source->ctx) != len)
+        {
+            ESP_LOGE(TAG, "Failed to read %d bytes of the blob at offset %" PRIu32, len, offset);
+            return ESP_FAIL;
+        }
+        crc = esp_rom_crc32_le(crc, raw, len);
+    }
+    *crc32 = crc;
+    return ESP_OK;
+}
+
+static void progress_key_of(char *key, const char *path_to_blob)
+{
+    snprintf(key, PROGRESS_KEY_SIZE, "%08" PRIx32, esp_rom_crc32_le(0, (const uint8_t *)path_to_blob, strlen(path_to_blob)));
+}
+
+static bool load_progress(const char *path_to_blob, blob_progress_t *progress)
+{
+    char key[PROGRESS_KEY_SIZE];
+    progress_key_of(key, path_to_blob);
+    nvs_handle_t nvs;
+    if (nvs_open(PROGRESS_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return false;
+    }
+    size_t len = sizeof(blob_progress_t);
+    esp_err_t result = nvs_get_blob(nvs, key, progress, &len);
+    nvs_close(nvs);
+    return result == ESP_OK && len == sizeof(blob_progress_t);
+}
+
+/**
+ * @brief Save the progress of the upload. If it fails, the upload goes on (only resuming it is affected).
+ */
+static void save_progress(const char *path_to_blob, const blob_progress_t *progress)
+{
+    char key[PROGRESS_KEY_SIZE];
+    progress_key_of(key, path_to_blob);
+    nvs_handle_t nvs;
+    esp_err_t result = nvs_open(PROGRESS_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (result == ESP_OK)
+    {
+        result = nvs_set_blob(nvs, key, progress, sizeof(blob_progress_t));
+        if (result == ESP_OK)
+        {
+            result = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (result != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to save the upload progress: %s", esp_err_to_name(result));
+    }
+}
+
+esp_err_t firestore_blob_clear_progress(const char *path_to_blob)
+{
+    char key[PROGRESS_KEY_SIZE];
+    progress_key_of(key, path_to_blob);
+    nvs_handle_t nvs;
+    esp_err_t result = nvs_open(PROGRESS_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (result == ESP_ERR_NVS_NOT_FOUND)
+    {
+        return ESP_OK; // nothing was ever saved
+    }
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    result = nvs_erase_key(nvs, key);
+    if (result == ESP_OK)
+    {
+        result = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return result == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : result;
+}
+
+static esp_err_t write_manifest(const firestore_path_t *manifest, const blob_progress_t *progress, uint32_t num_chunks, bool complete, char *token)
+{
+    char manifest_json[MANIFEST_JSON_SIZE];
+    snprintf(manifest_json, MANIFEST_JSON_SIZE,
+             "{\"fields\": {\"size\": {\"integerValue\": \"%" PRIu32 "\"}, \"chunkSize\": {\"integerValue\": \"%" PRIu32 "\"}, "
+             "\"chunkCount\": {\"integerValue\": \"%" PRIu32 "\"}, \"crc32\": {\"integerValue\": \"%" PRIu32 "\"}, "
+             "\"complete\": {\"booleanValue\": %s}}}",
+             progress->size, progress->chunk_size, num_chunks, progress->crc32, complete ? "true" : "false");
+    return firestore_patch_at(manifest, manifest_json, token, FIRESTORE_DOC_OVERWRITE, NULL);
+}
+
+#ifdef CONFIG_FIRESTORE_HTTP2_TRANSPORT
+static void on_chunk_response(int status_code, const char *body, int body_len, void *user_ctx)
+{
+    *(int *)user_ctx = status_code;
+}
+
+/**
+ * @brief Get the token of the chunk requests: `token`, or if it is NULL, the ID token of the default client
+ * `firestore_h2_submit` does not fall back to the managed token like the `_at` functions do.
+ *
+ * @param[out] auth_token `token`, the managed token in `managed_token`, or NULL if the default client has no refresh token.
+ */
+static esp_err_t resolve_token(char *token, char *managed_token, const char **auth_token)
+{
+    *auth_token = token;
+    if (token != NULL)
+    {
+        return ESP_OK;
+    }
+    esp_err_t result = firestore_client_get_token(NULL, managed_token, FIREBASE_ID_TOKEN_MAX_LEN);
+    if (result == ESP_OK)
+    {
+        *auth_token = managed_token;
+    }
+    // without a refresh token the requests are sent without an Authorization header, like the `_at` functions do
+    return result == ESP_ERR_INVALID_STATE ? ESP_OK : result;
+}
+
+/**
+ * @brief Upload the chunks from `progress->chunks_done` on, PARALLEL_CHUNKS at a time over one HTTP/2 connection
+ */
+static esp_err_t upload_chunks(const char *path_to_blob, const firestore_blob_source_t *source, uint32_t num_chunks,
+                               blob_progress_t *progress, char *token)
+{
+    int body_size = chunk_body_len(CHUNK_SIZE) + 1;
+    char *managed_token = NULL;
+    if (token == NULL && (managed_token = (char *)heap_caps_malloc(FIREBASE_ID_TOKEN_MAX_LEN, MALLOC_CAP_SPIRAM)) == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate the token buffer");
+        return ESP_ERR_NO_MEM;
+    }
+    char *bodies[PARALLEL_CHUNKS] = {};
+    for (int i = 0; i < PARALLEL_CHUNKS; i++)
+    {
+        bodies[i] = (char *)heap_caps_malloc(body_size, MALLOC_CAP_SPIRAM);
+        if (bodies[i] == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to allocate the chunk bodies");
+            for (int j = 0; j < i; j++)
+            {
+                heap_caps_free(bodies[j]);
+            }
+            heap_caps_free(managed_token);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    firestore_h2_client_handle_t h2_client = NULL;
+    esp_err_t result = firestore_h2_connect(&h2_client);
+    char chunk_path[BLOB_PATH_MAX_LEN];
+    firestore_path_t chunk_document;
+    while (result == ESP_OK && progress->chunks_done < num_chunks)
+    {
+        // resolved for every batch, the managed token is refreshed when it is about to expire
+        const char *auth_token;
+        if ((result = resolve_token(token, managed_token, &auth_token)) != ESP_OK)
+        {
+            break;
+        }
+        int status_codes[PARALLEL_CHUNKS];
+        int batch = 0;
+        for (; batch < PARALLEL_CHUNKS && progress->chunks_done + batch < num_chunks && result == ESP_OK; batch++)
+        {
+            uint32_t index = progress->chunks_done + batch;
+            chunk_producer_t producer;
+            chunk_producer_init(&producer, source, index);
+            int body_len = 0;
+            int piece_len;
+            while ((piece_len = produce_chunk_body(bodies[batch] + body_len, body_size - 1 - body_len, &producer)) > 0)
+            {
+                body_len += piece_len;
+            }
+            bodies[batch][body_len] = '\0';
+            status_codes[batch] = -1;
+            result = piece_len < 0 ? ESP_FAIL : chunk_path_of(chunk_path, path_to_blob, index);
+            if (result == ESP_OK)
+            {
+                result = firestore_document_path_init(&chunk_document, chunk_path);
+            }
+            if (result == ESP_OK)
+            {
+                result = firestore_h2_submit(h2_client, HTTP_METHOD_PATCH, &chunk_document, "mask.fieldPaths=z", bodies[batch],
+                                             auth_token, on_chunk_response, &status_codes[batch]);
+            }
+        }
+        if (firestore_h2_wait_all(h2_client, H2_BATCH_TIMEOUT_MS) != ESP_OK)
+        {
+            result = ESP_FAIL;
+        }
+
+        // only the chunks up to the first failed one count as done, the rest are uploaded again when resuming
+        int done = 0;
+        while (done < batch && status_codes[done] == 200)
+        {
+            done++;
+        }
+        if (done > 0)
+        {
+            progress->chunks_done += done;
+            save_progress(path_to_blob, progress);
+        }
+        if (done < batch)
+        {
+            ESP_LOGE(TAG, "Chunk %" PRIu32 " failed with status %d", progress->chunks_done, status_codes[done]);
+            result = ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "%" PRIu32 " / %" PRIu32 " chunks uploaded", progress->chunks_done, num_chunks);
+    }
+    if (h2_client != NULL)
+    {
+        firestore_h2_disconnect(h2_client);
+    }
+    for (int i = 0; i < PARALLEL_CHUNKS; i++)
+    {
+        heap_caps_free(bodies[i]);
+    }
+    heap_caps_free(managed_token);
+    return result;
+}
+#else
+static esp_err_t upload_chunk(const char *path_to_blob, const firestore_blob_source_t *source, uint32_t index, char *token)
+{
+    char chunk_path[BLOB_PATH_MAX_LEN];
+    firestore_path_t chunk_document;
+    esp_err_t result = chunk_path_of(chunk_path, path_to_blob, index);
+    if (result == ESP_OK)
+    {
+        result = firestore_document_path_init(&chunk_document, chunk_path);
+    }
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    chunk_producer_t producer;
+    chunk_producer_init(&producer, source, index);
+    return firestore_patch_stream_at(&chunk_document, produce_chunk_body, &producer, chunk_body_len(producer.end - producer.offset),
+                                     NULL, 0, token, FIRESTORE_DOC_OVERWRITE, NULL);
+}
+
+/**
+ * @brief Upload the chunks from `progress->chunks_done` on, one at a time
+ */
+static esp_err_t upload_chunks(const char *path_to_blob, const firestore_blob_source_t *source, uint32_t num_chunks,
+                               blob_progress_t *progress, char *token)
+{
+    while (progress->chunks_done < num_chunks)
+    {
+        esp_err_t result = upload_chunk(path_to_blob, source, progress->chunks_done, token);
+        if (result != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Chunk %" PRIu32 " failed", progress->chunks_done);
+            return result;
+        }
+        progress->chunks_done++;
+        save_progress(path_to_blob, progress);
+        ESP_LOGI(TAG, "%" PRIu32 " / %" PRIu32 " chunks uploaded", progress->chunks_done, num_chunks);
+    }
+    return ESP_OK;
+}
+#endif
+
+esp_err_t firestore_blob_upload(const char *path_to_blob, const firestore_blob_source_t *source, char *token, firestore_blob_info_t *info)
+{
+    firestore_path_t manifest;
+    esp_err_t result = firestore_document_path_init(&manifest, path_to_blob);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    uint32_t num_chunks = (source->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (num_chunks > FIRESTORE_BLOB_MAX_CHUNKS)
+    {
+        ESP_LOGE(TAG, "The blob (%" PRIu32 " bytes) has too many chunks", source->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    blob_progress_t progress = {source->size, CHUNK_SIZE, 0, 0};
+    result = compute_crc32(source, &progress.crc32);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    if (info != NULL)
+    {
+        *info = {progress.size, progress.chunk_size, num_chunks, progress.crc32};
+    }
+
+    blob_progress_t saved;
+    if (load_progress(path_to_blob, &saved) && saved.size == progress.size && saved.chunk_size == progress.chunk_size &&
+        saved.crc32 == progress.crc32 && saved.chunks_done <= num_chunks)
+    {
+        progress.chunks_done = saved.chunks_done;
+        ESP_LOGI(TAG, "Resuming the upload of %s from chunk %" PRIu32, path_to_blob, progress.chunks_done);
+    }
+    else
+    {
+        // the manifest is marked incomplete first, so the blob is not read while its chunks are replaced
+        result = write_manifest(&manifest, &progress, num_chunks, false, token);
+        if (result != ESP_OK)
+        {
+            return result;
+        }
+        save_progress(path_to_blob, &progress);
+    }
+
+    result = upload_chunks(path_to_blob, source, num_chunks, &progress, token);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    result = write_manifest(&manifest, &progress, num_chunks, true, token);
+    if (result == ESP_OK)
+    {
+        firestore_blob_clear_progress(path_to_blob);
+        ESP_LOGI(TAG, "Blob %s uploaded: %" PRIu32 " bytes in %" PRIu32 " chunks", path_to_blob, progress.size, num_chunks);
+    }
+    return result;
+}
+
+typedef enum
+{
+    DECODER_SEARCH_KEY,   // looking for CHUNK_DATA_KEY
+    DECODER_SEARCH_VALUE, // looking for the opening quote of the value
+    DECODER_VALUE,
+    DECODER_DONE,
+} decoder_state_t;
+
+typedef struct
+{
+    firestore_blob_sink_t sink;
+    void *sink_ctx;
+    decoder_state_t state;
+    int key_match;       // how much of CHUNK_DATA_KEY is matched
+    int escape_len;      // inside a JSON escape: 1 after the backslash, 2 to 5 for the hex digits of \uXXXX
+    uint32_t escape_value;
+    uint8_t quad[4];
+    int quad_len;
+    int padding;
+    char out[RAW_PIECE_SIZE];
+    int out_len;
+    uint32_t chunk_len;  // the bytes decoded from the current chunk
+    uint32_t crc32;      // of all the bytes decoded so far
+    esp_err_t error;
+} blob_decoder_t;
+
+static void decoder_flush(blob_decoder_t *decoder)
+{
+    if (decoder->out_len == 0 || decoder->error != ESP_OK)
+    {
+        return;
+    }
+    decoder->crc32 = esp_rom_crc32_le(decoder->crc32, (const uint8_t *)decoder->out, decoder->out_len);
+    decoder->error = decoder->sink(decoder->out, decoder->out_len, decoder->sink_ctx);
+    decoder->out_len = 0;
+}
+
+static void decoder_put_char(blob_decoder_t *decoder, char c)
+{
+    int value = 0;
+    if (c == '=')
+    {
+        decoder->padding++;
+    }
+    else if ((value = base64_value(c)) < 0 || decoder->padding > 0)
+    {
+        ESP_LOGE(TAG, "Invalid base64 in the chunk");
+        decoder->error = ESP_ERR_INVALID_RESPONSE;
+        return;
+    }
+    decoder->quad[decoder->quad_len++] = value;
+    if (decoder->quad_len < 4)
+    {
+        return;
+    }
+
+    uint32_t bits = (decoder->quad[0] << 18) | (decoder->quad[1] << 12) | (decoder->quad[2] << 6) | decoder->quad[3];
+    int num_bytes = 3 - decoder->padding;
+    for (int i = 0; i < num_bytes; i++)
+    {
+        decoder->out[decoder->out_len++] = (bits >> (16 - 8 * i)) & 0xff;
+    }
+    decoder->chunk_len += num_bytes;
+    decoder->quad_len = 0;
+    if (decoder->out_len > RAW_PIECE_SIZE - 3)
+    {
+        decoder_flush(decoder);
+    }
+}
+
+/**
+ * @brief The response consumer of a chunk document: find the bytesValue, and decode it into the sink
+ */
+static void decode_chunk_response(const char *data, int len, void *user_ctx)
+{
+    blob_decoder_t *decoder = (blob_decoder_t *)user_ctx;
+    for (int i = 0; i < len && decoder->error == ESP_OK && decoder->state != DECODER_DONE; i++)
+    {
+        char c = data[i];
+        switch (decoder->state)
+        {
+        case DECODER_SEARCH_KEY:
+            // only the leading quote of the key repeats in it, so a mismatch restarts from it
+            decoder->key_match = c == CHUNK_DATA_KEY[decoder->key_match] ? decoder->key_match + 1 : (c == '"' ? 1 : 0);
+            if (CHUNK_DATA_KEY[decoder->key_match] == '\0')
+            {
+                decoder->state = DECODER_SEARCH_VALUE;
+            }
+            break;
+        case DECODER_SEARCH_VALUE:
+            if (c == '"')
+            {
+                decoder->state = DECODER_VALUE;
+            }
+            break;
+        case DECODER_VALUE:
+            if (decoder->escape_len == 1)
+            {
+                // e.g. "\/" is an escaped '/', and a 'u' is followed by the 4 hex digits of the character
+                decoder->escape_len = c == 'u' ? 2 : 0;
+                decoder->escape_value = 0;
+                if (c != 'u')
+                {
+                    decoder_put_char(decoder, c);
+                }
+            }
+            else if (decoder->escape_len > 1)
+            {
+                decoder->escape_value = decoder->escape_value * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+                if (++decoder->escape_len == 6)
+                {
+                    decoder->escape_len = 0;
+                    decoder_put_char(decoder, (char)decoder->escape_value);
+                }
+            }
+            else if (c == '\\')
+            {
+                decoder->escape_len = 1;
+            }
+            else if (c == '"')
+            {
+                decoder->state = DECODER_DONE;
+            }
+            else
+            {
+                decoder_put_char(decoder, c);
+            }
+            break;
+        case DECODER_DONE:
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Get the value of an integerValue field of the manifest
+ */
+static uint32_t manifest_integer(cJSON *fields, const char *name)
+{
+    cJSON *value = cJSON_GetObjectItem(cJSON_GetObjectItem(fields, name), "integerValue");
+    return cJSON_IsString(value) ? strtoul(value->valuestring, NULL, 10) : 0;
+}
+
+static esp_err_t read_manifest(const firestore_path_t *manifest, firestore_blob_info_t *info, char *token)
+{
+    char *response = (char *)heap_caps_malloc(MANIFEST_RESPONSE_SIZE, MALLOC_CAP_SPIRAM);
+    if (response == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    firestore_request_options_t options = {};
+    options.projection = FIRESTORE_PROJECTION_FIELDS;
+    options.fields = MANIFEST_FIELDS;
+    options.num_fields = sizeof(MANIFEST_FIELDS) / sizeof(MANIFEST_FIELDS[0]);
+    options.response = response;
+    options.response_size = MANIFEST_RESPONSE_SIZE;
+    esp_err_t result = firestore_get_document_at(manifest, token, &options);
+    if (result != ESP_OK)
+    {
+        heap_caps_free(response);
+        return result;
+    }
+
+    cJSON *root = cJSON_Parse(response);
+    heap_caps_free(response);
+    cJSON *fields = cJSON_GetObjectItem(root, "fields");
+    info->size = manifest_integer(fields, "size");
+    info->chunk_size = manifest_integer(fields, "chunkSize");
+    info->num_chunks = manifest_integer(fields, "chunkCount");
+    info->crc32 = manifest_integer(fields, "crc32");
+    bool complete = cJSON_IsTrue(cJSON_GetObjectItem(cJSON_GetObjectItem(fields, "complete"), "booleanValue"));
+    cJSON_Delete(root);
+
+    if (fields == NULL || info->chunk_size == 0 ||
+        info->num_chunks != (info->size + info->chunk_size - 1) / info->chunk_size)
+    {
+        ESP_LOGE(TAG, "The manifest is not a blob manifest");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (!complete)
+    {
+        ESP_LOGW(TAG, "The upload of the blob is not complete");
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t firestore_blob_download(const char *path_to_blob, firestore_blob_sink_t sink, void *sink_ctx, char *token, firestore_blob_info_t *info)
+{
+    firestore_path_t manifest;
+    esp_err_t result = firestore_document_path_init(&manifest, path_to_blob);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    firestore_blob_info_t blob;
+    result = read_manifest(&manifest, &blob, token);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    if (info != NULL)
+    {
+        *info = blob;
+    }
+
+    firestore_request_options_t options = {};
+    options.projection = FIRESTORE_PROJECTION_FIELDS;
+    options.fields = CHUNK_FIELDS;
+    options.num_fields = 1;
+    blob_decoder_t decoder = {};
+    decoder.sink = sink;
+    decoder.sink_ctx = sink_ctx;
+    char chunk_path[BLOB_PATH_MAX_LEN];
+    firestore_path_t chunk_document;
+    for (uint32_t index = 0; index < blob.num_chunks; index++)
+    {
+        result = chunk_path_of(chunk_path, path_to_blob, index);
+        if (result == ESP_OK)
+        {
+            result = firestore_document_path_init(&chunk_document, chunk_path);
+        }
+        if (result != ESP_OK)
+        {
+            return result;
+        }
+
+        decoder.state = DECODER_SEARCH_KEY;
+        decoder.key_match = 0;
+        decoder.escape_len = 0;
+        decoder.quad_len = 0;
+        decoder.padding = 0;
+        decoder.chunk_len = 0;
+        result = firestore_get_document_stream_at(&chunk_document, decode_chunk_response, &decoder, token, &options);
+        decoder_flush(&decoder);
+        if (result == ESP_ERR_FIRESTORE_NOT_FOUND)
+        {
+            ESP_LOGE(TAG, "Chunk %" PRIu32 " of the blob is missing", index);
+            return ESP_ERR_INVALID_CRC;
+        }
+        if (result != ESP_OK)
+        {
+            return result;
+        }
+        if (decoder.error != ESP_OK)
+        {
+            return decoder.error;
+        }
+        uint32_t expected_len = blob.size - index * blob.chunk_size < blob.chunk_size ? blob.size - index * blob.chunk_size : blob.chunk_size;
+        if (decoder.state != DECODER_DONE || decoder.quad_len != 0 || decoder.chunk_len != expected_len)
+        {
+            ESP_LOGE(TAG, "Chunk %" PRIu32 " has %" PRIu32 " bytes, %" PRIu32 " are expected", index, decoder.chunk_len, expected_len);
+            return ESP_ERR_INVALID_CRC;
+        }
+    }
+
+    if (decoder.crc32 != blob.crc32)
+    {
+        ESP_LOGE(TAG, "The CRC of the blob is %08" PRIx32 ", %08" PRIx32 " is expected", decoder.crc32, blob.crc32);
+        return ESP_ERR_INVALID_CRC;
+    }
+    ESP_LOGI(TAG, "Blob %s downloaded: %" PRIu32 " bytes", path_to_blob, blob.size);
+    return ESP_OK;
+}
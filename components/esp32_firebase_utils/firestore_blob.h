@@ -0,0 +1,124 @@
+#ifndef FIRESTORE_BLOB_H_
+#define FIRESTORE_BLOB_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_err.h"
+
+    /**
+     * A blob (e.g. a crash dump, a waveform capture or a log file) is stored in Firestore as
+     * - the chunk documents `<path_to_blob>/chunks/00000`, `.../00001`, ..., each with the field
+     *   `data` (bytesValue) holding CONFIG_FIRESTORE_BLOB_CHUNK_SIZE bytes of the blob (the last one holds the rest),
+     * - the manifest document `<path_to_blob>`, with the fields `size`, `chunkSize`, `chunkCount`, `crc32`
+     *   (CRC-32 of the whole blob, same as zlib's `crc32`) and `complete`.
+     *
+     * The manifest is written with `complete: false` before the first chunk, and with `complete: true`
+     * after the last one, so a reader never takes a half uploaded blob.
+     *
+     * Uploading a blob again to the same path overwrites the chunks and the manifest. If the new blob has fewer
+     * chunks, the chunk documents past its `chunkCount` are left as they were: they are never read (a download
+     * reads `chunkCount` chunks), but they are stored (and billed) until they are deleted, e.g. from the console
+     * or with a DELETE request for each of them. Upload to a new path to avoid this.
+     *
+     * The chunks are base64 encoded while they are streamed, so the memory used does not depend on the chunk size.
+     * With CONFIG_FIRESTORE_HTTP2_TRANSPORT, up to CONFIG_FIRESTORE_BLOB_PARALLEL_CHUNKS chunks are uploaded at once
+     * over one HTTP/2 connection (each of them is encoded into a SPIRAM buffer first), otherwise one at a time.
+     *
+     * The number of the uploaded chunks is saved in NVS (namespace "fs_blob") after each chunk, so an
+     * interrupted upload of the same blob (same path, size and CRC) resumes from there. `nvs_flash_init`
+     * has to be called before uploading.
+     */
+
+    /**
+     * @brief Read a part of the blob
+     *
+     * @param[out] buffer The buffer to read into.
+     * @param[in] size The number of bytes to read.
+     * @param[in] offset The offset in the blob to read from. Note that the parts can be read in any order (e.g. when resuming).
+     * @param[in] ctx The `ctx` of the source.
+     * @return The number of bytes read (`size` unless the end of the blob is reached), or a negative value on error.
+     */
+    typedef int (*firestore_blob_read_t)(char *buffer, int size, uint32_t offset, void *ctx);
+
+    typedef struct
+    {
+        firestore_blob_read_t read;
+        void *ctx;
+        uint32_t size; // the size of the blob in bytes
+    } firestore_blob_source_t;
+
+    /**
+     * @brief Consumer of a downloaded blob, it is called with the bytes of the blob in order
+     *
+     * @return ESP_OK to continue, anything else aborts the download (and is returned by it).
+     */
+    typedef esp_err_t (*firestore_blob_sink_t)(const char *data, int len, void *ctx);
+
+    typedef struct
+    {
+        uint32_t size;
+        uint32_t chunk_size;
+        uint32_t num_chunks;
+        uint32_t crc32;
+    } firestore_blob_info_t;
+
+    /**
+     * @brief Make a source that reads from a buffer
+     *
+     * @param[out] source The source to initialize.
+     * @param[in] data The blob, it has to stay valid during the upload.
+     * @param[in] size The size of the blob.
+     */
+    void firestore_blob_source_from_buffer(firestore_blob_source_t *source, const void *data, uint32_t size);
+
+    /**
+     * @brief Make a source that reads from a file (e.g. on SPIFFS, LittleFS or FAT)
+     *
+     * @param[out] source The source to initialize.
+     * @param[in] file The file opened with "rb", it has to stay open during the upload.
+     */
+    esp_err_t firestore_blob_source_from_file(firestore_blob_source_t *source, FILE *file);
+
+    /**
+     * @brief Upload a blob, or resume the interrupted upload of it
+     *
+     * @param[in] path_to_blob The path of the manifest document. e.g. "dev/develop/devices/test_dev/blobs/crash_2408"
+     * @param[in] source The source of the blob.
+     * @param[in] token The token to authenticate the requests, or NULL for the ID token the default client manages.
+     * @param[out] info The size, chunks and CRC of the uploaded blob (can be NULL).
+     * @return ESP_ERR_INVALID_SIZE if the blob has more than FIRESTORE_BLOB_MAX_CHUNKS chunks,
+     * or the error of the failed request (the upload can be resumed by calling this again).
+     */
+    esp_err_t firestore_blob_upload(const char *path_to_blob, const firestore_blob_source_t *source, char *token, firestore_blob_info_t *info);
+
+    /**
+     * @brief Forget the saved progress of an upload, so the next upload of the blob starts from the first chunk
+     */
+    esp_err_t firestore_blob_clear_progress(const char *path_to_blob);
+
+    /**
+     * @brief Download a blob, and give its bytes to `sink` in order
+     * The chunks are decoded while they are received, so the whole blob is never held in RAM.
+     *
+     * @param[in] path_to_blob The path of the manifest document.
+     * @param[in] sink The consumer of the blob.
+     * @param[in] sink_ctx Passed to `sink`.
+     * @param[in] token The token to authenticate the requests, or NULL for the ID token the default client manages.
+     * @param[out] info The size, chunks and CRC of the blob (can be NULL).
+     * @return ESP_ERR_FIRESTORE_NOT_FOUND if there is no such blob, ESP_ERR_INVALID_STATE if its upload is not complete,
+     * ESP_ERR_INVALID_CRC if a chunk is missing or the CRC doesn't match (note that the sink has received the bytes anyway).
+     */
+    esp_err_t firestore_blob_download(const char *path_to_blob, firestore_blob_sink_t sink, void *sink_ctx, char *token, firestore_blob_info_t *info);
+
+#define FIRESTORE_BLOB_MAX_CHUNKS 100000 // the chunk documents are named "00000" to "99999"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIRESTORE_BLOB_H_ */
@@ -0,0 +1,309 @@
+/**
+ * @file firestore_coalesce.cc
+ * @brief Same-document write coalescing in front of `firestore_patch`
+ * The pending writes of each document are merged into one "fields" object (cJSON), and are sent
+ * as one patch request when the per-document write interval has passed. The buffer is protected
+ * by a mutex, so writes can be put from several tasks while another task is flushing.
+ */
+
+#include "firestore_coalesce.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "cJSON.h"
+
+#define MAX_DOCUMENTS CONFIG_FIRESTORE_COALESCE_MAX_DOCUMENTS
+#define MIN_WRITE_INTERVAL_US ((int64_t)CONFIG_FIRESTORE_COALESCE_MIN_WRITE_INTERVAL_MS * 1000)
+
+static const char *TAG = "FS_COALESCE";
+
+typedef struct
+{
+    cJSON *fields;  // the merged "fields" object, NULL if there are no writes
+    bool overwrite; // the writes start with a FIRESTORE_DOC_OVERWRITE
+    uint32_t writes;
+    int64_t oldest_enqueue_us;
+    int64_t enqueue_time_sum_us; // so the added latency of all the writes is computed at once
+} coalesce_batch_t;
+
+typedef struct
+{
+    bool in_use;
+    firestore_path_t document;
+    coalesce_batch_t pending; // the writes put since the last flush of the document
+    coalesce_batch_t retry;   // the writes of a failed request that can't be merged with `pending`, they are sent first
+    int64_t last_write_us;    // when the document was last written, 0 if never
+    bool in_flight;           // a flush is sending the writes of the slot, it can't be given to another document
+} coalesce_slot_t;
+
+static coalesce_slot_t slots[MAX_DOCUMENTS];
+static SemaphoreHandle_t slots_mutex = NULL;
+
+static uint32_t writes_enqueued = 0;
+static uint32_t writes_flushed = 0;
+static uint32_t requests_sent = 0;
+static uint32_t requests_failed = 0;
+static int64_t total_added_latency_us = 0;
+static int64_t max_added_latency_us = 0;
+
+esp_err_t firestore_coalesce_init(void)
+{
+    if (slots_mutex == NULL)
+    {
+        slots_mutex = xSemaphoreCreateMutex();
+        if (slots_mutex == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create the mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+static bool may_write_now(const coalesce_slot_t *slot, int64_t now_us)
+{
+    return slot->last_write_us == 0 || now_us - slot->last_write_us >= MIN_WRITE_INTERVAL_US;
+}
+
+/**
+ * @brief Find the slot of the document, or a slot that can be (re)used for it
+ * A slot without pending writes is kept until its write interval passes, so the rate of its document is still governed,
+ * and while its request is in flight, so the result of the request is applied to its document.
+ */
+static coalesce_slot_t *find_slot(const firestore_path_t *document, int64_t now_us)
+{
+    coalesce_slot_t *free_slot = NULL;
+    for (int i = 0; i < MAX_DOCUMENTS; i++)
+    {
+        coalesce_slot_t *slot = &slots[i];
+        if (slot->in_use && strcmp(slot->document.rest_path, document->rest_path) == 0)
+        {
+            return slot;
+        }
+        if (free_slot == NULL && (!slot->in_use || (slot->pending.fields == NULL && slot->retry.fields == NULL && !slot->in_flight && may_write_now(slot, now_us))))
+        {
+            free_slot = slot;
+        }
+    }
+    if (free_slot != NULL)
+    {
+        free_slot->in_use = true;
+        free_slot->document = *document;
+        free_slot->pending.fields = NULL;
+        free_slot->pending.writes = 0;
+        free_slot->retry.fields = NULL;
+        free_slot->last_write_us = 0;
+    }
+    return free_slot;
+}
+
+static int count_fields_after_merge(const cJSON *pending_fields, const cJSON *fields)
+{
+    int num_fields = cJSON_GetArraySize(pending_fields);
+    const cJSON *field = NULL;
+    cJSON_ArrayForEach(field, fields)
+    {
+        if (!cJSON_HasObjectItem(pending_fields, field->string))
+        {
+            num_fields++;
+        }
+    }
+    return num_fields;
+}
+
+/**
+ * @brief Merge the fields into the pending fields, the fields given here win
+ */
+static void merge_fields(cJSON *pending_fields, const cJSON *fields)
+{
+    const cJSON *field = NULL;
+    cJSON_ArrayForEach(field, fields)
+    {
+        cJSON_DeleteItemFromObjectCaseSensitive(pending_fields, field->string);
+        cJSON_AddItemToObject(pending_fields, field->string, cJSON_Duplicate(field, true));
+    }
+}
+
+esp_err_t firestore_coalesce_write(const char *path_to_document, const char *data, firestore_patch_type_t patch_type)
+{
+    if (slots_mutex == NULL)
+    {
+        ESP_LOGE(TAG, "The coalescing buffer is not initialized, call firestore_coalesce_init first");
+        return ESP_ERR_INVALID_STATE;
+    }
+    firestore_path_t document;
+    if (firestore_document_path_init(&document, path_to_document) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    cJSON *root = cJSON_Parse(data);
+    cJSON *fields = cJSON_GetObjectItem(root, "fields");
+    if (fields == NULL || (patch_type == FIRESTORE_DOC_UPSERT && cJSON_GetArraySize(fields) == 0))
+    {
+        // note that an upsert without any field would be sent without update mask, and overwrite the document
+        ESP_LOGE(TAG, "The data to write to %s has no fields", path_to_document);
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    esp_err_t result = ESP_OK;
+    xSemaphoreTake(slots_mutex, portMAX_DELAY);
+
+    coalesce_slot_t *slot = find_slot(&document, now_us);
+    if (slot == NULL)
+    {
+        ESP_LOGW(TAG, "All %d documents have pending writes, flush first", MAX_DOCUMENTS);
+        result = ESP_ERR_NO_MEM;
+    }
+    else if (patch_type == FIRESTORE_DOC_OVERWRITE || slot->pending.fields == NULL)
+    {
+        // an overwrite replaces everything pending before it (a failed write waiting in `retry` is still sent before it)
+        cJSON_Delete(slot->pending.fields);
+        slot->pending.fields = cJSON_DetachItemFromObject(root, "fields");
+        slot->pending.overwrite = patch_type == FIRESTORE_DOC_OVERWRITE;
+    }
+    else if (!slot->pending.overwrite && count_fields_after_merge(slot->pending.fields, fields) > FIRESTORE_MAX_PATCH_UPSERT_FIELDS)
+    {
+        ESP_LOGW(TAG, "Merging the write to %s would exceed %d fields, flush first", path_to_document, FIRESTORE_MAX_PATCH_UPSERT_FIELDS);
+        result = ESP_ERR_INVALID_SIZE;
+    }
+    else
+    {
+        merge_fields(slot->pending.fields, fields);
+    }
+
+    if (result == ESP_OK)
+    {
+        if (slot->pending.writes == 0)
+        {
+            slot->pending.oldest_enqueue_us = now_us;
+            slot->pending.enqueue_time_sum_us = 0;
+        }
+        slot->pending.writes++;
+        slot->pending.enqueue_time_sum_us += now_us;
+        writes_enqueued++;
+    }
+
+    xSemaphoreGive(slots_mutex);
+    cJSON_Delete(root);
+    return result;
+}
+
+/**
+ * @brief Put the writes of a failed request back into the slot, under the writes that are pending since then
+ * If they can't be merged with those within FIRESTORE_MAX_PATCH_UPSERT_FIELDS, they are kept as the retry of the slot,
+ * which the next flush sends before the pending writes, so no field is lost.
+ */
+static void restore_failed_writes(coalesce_slot_t *slot, coalesce_batch_t *failed)
+{
+    coalesce_batch_t *pending = &slot->pending;
+    if (pending->fields == NULL)
+    {
+        *pending = *failed;
+    }
+    else if (pending->overwrite)
+    {
+        cJSON_Delete(failed->fields); // they are replaced by the newer overwrite anyway
+    }
+    else if (!failed->overwrite && count_fields_after_merge(failed->fields, pending->fields) > FIRESTORE_MAX_PATCH_UPSERT_FIELDS)
+    {
+        ESP_LOGW(TAG, "The failed write to %s can't be merged with the newer writes, it is retried before them", slot->document.rest_path);
+        slot->retry = *failed;
+    }
+    else
+    {
+        merge_fields(failed->fields, pending->fields);
+        cJSON_Delete(pending->fields);
+        pending->fields = failed->fields;
+        pending->overwrite = failed->overwrite;
+        pending->writes += failed->writes;
+        pending->oldest_enqueue_us = failed->oldest_enqueue_us;
+        pending->enqueue_time_sum_us += failed->enqueue_time_sum_us;
+    }
+}
+
+esp_err_t firestore_coalesce_flush(char *token, bool force)
+{
+    if (slots_mutex == NULL)
+    {
+        ESP_LOGE(TAG, "The coalescing buffer is not initialized, call firestore_coalesce_init first");
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t result = ESP_OK;
+    for (int i = 0; i < MAX_DOCUMENTS; i++)
+    {
+        coalesce_slot_t *slot = &slots[i];
+
+        // take the writes out of the slot (the retry of a failed request first), so the other tasks can keep writing during the request
+        xSemaphoreTake(slots_mutex, portMAX_DELAY);
+        if (!slot->in_use || slot->in_flight || (slot->pending.fields == NULL && slot->retry.fields == NULL) ||
+            (!force && !may_write_now(slot, esp_timer_get_time())))
+        {
+            xSemaphoreGive(slots_mutex);
+            continue;
+        }
+        firestore_path_t document = slot->document;
+        coalesce_batch_t *taken = slot->retry.fields != NULL ? &slot->retry : &slot->pending;
+        coalesce_batch_t batch = *taken;
+        taken->fields = NULL;
+        taken->writes = 0;
+        slot->in_flight = true;
+        xSemaphoreGive(slots_mutex);
+
+        cJSON *body = cJSON_CreateObject();
+        cJSON_AddItemToObject(body, "fields", batch.fields);
+        char *data = cJSON_PrintUnformatted(body);
+        ESP_LOGI(TAG, "Flushing %d writes to %s", (int)batch.writes, document.rest_path);
+        esp_err_t patch_result = firestore_patch_at(&document, data, token, batch.overwrite ? FIRESTORE_DOC_OVERWRITE : FIRESTORE_DOC_UPSERT, NULL);
+        cJSON_free(data);
+        int64_t now_us = esp_timer_get_time();
+
+        xSemaphoreTake(slots_mutex, portMAX_DELAY);
+        slot->in_flight = false;
+        slot->last_write_us = now_us; // a failed request counts as a write too, so it is not retried right away
+        requests_sent++;
+        if (patch_result == ESP_OK)
+        {
+            writes_flushed += batch.writes;
+            total_added_latency_us += now_us * batch.writes - batch.enqueue_time_sum_us;
+            if (now_us - batch.oldest_enqueue_us > max_added_latency_us)
+            {
+                max_added_latency_us = now_us - batch.oldest_enqueue_us;
+            }
+            cJSON_Delete(body);
+        }
+        else
+        {
+            requests_failed++;
+            batch.fields = cJSON_DetachItemFromObject(body, "fields");
+            restore_failed_writes(slot, &batch);
+            cJSON_Delete(body);
+            result = ESP_FAIL;
+        }
+        xSemaphoreGive(slots_mutex);
+    }
+    return result;
+}
+
+void firestore_coalesce_get_stats(firestore_coalesce_stats_t *stats)
+{
+    if (slots_mutex == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(slots_mutex, portMAX_DELAY);
+    stats->writes_enqueued = writes_enqueued;
+    stats->writes_flushed = writes_flushed;
+    stats->requests_sent = requests_sent;
+    stats->requests_failed = requests_failed;
+    uint32_t requests_succeeded = requests_sent - requests_failed;
+    stats->coalescing_ratio = requests_succeeded > 0 ? (float)writes_flushed / requests_succeeded : 0;
+    stats->avg_added_latency_ms = writes_flushed > 0 ? (float)total_added_latency_us / writes_flushed / 1000 : 0;
+    stats->max_added_latency_ms = max_added_latency_us / 1000;
+    xSemaphoreGive(slots_mutex);
+}
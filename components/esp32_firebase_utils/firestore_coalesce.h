@@ -0,0 +1,75 @@
+#ifndef FIRESTORE_COALESCE_H_
+#define FIRESTORE_COALESCE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "firestore_utils.h"
+
+    /**
+     * Firestore sustains about one write per second per document. The coalescing buffer holds the
+     * writes to a document, merges them, and sends them as one `firestore_patch` when the document
+     * may be written again (at most once per CONFIG_FIRESTORE_COALESCE_MIN_WRITE_INTERVAL_MS).
+     *
+     * - `FIRESTORE_DOC_UPSERT` writes are merged field by field, the last writer wins, and the update mask is the union of their fields.
+     * - A `FIRESTORE_DOC_OVERWRITE` write replaces everything that is pending before it (the later upserts are merged into it).
+     * - The writes of a failed request are merged back under the newer writes. If they can't be merged within
+     *   FIRESTORE_MAX_PATCH_UPSERT_FIELDS fields, they are kept apart and sent first by the next flush, so no field is lost.
+     */
+
+    typedef struct
+    {
+        uint32_t writes_enqueued;   // number of `firestore_coalesce_write` calls accepted
+        uint32_t writes_flushed;    // number of those writes that are sent (merged into a request)
+        uint32_t requests_sent;     // number of patch requests made
+        uint32_t requests_failed;   // number of patch requests failed (their writes are put back to be retried)
+        float coalescing_ratio;     // writes_flushed / successful requests
+        float avg_added_latency_ms; // average time a write waited in the buffer before it is sent
+        uint32_t max_added_latency_ms;
+    } firestore_coalesce_stats_t;
+
+    /**
+     * @brief Initialize the coalescing buffer, call this once before the other functions
+     */
+    esp_err_t firestore_coalesce_init(void);
+
+    /**
+     * @brief Put a write to a document in the coalescing buffer. It is sent by a later `firestore_coalesce_flush`.
+     *
+     * @param[in] path_to_document The path to the document in Firestore. e.g. "col1/doc1"
+     * @param[in] data The content to be written, same as `firestore_patch`.
+     * e.g. "{\"fields\": { \"Oct23\": {\"integerValue\": \"500\"}}}"
+     * @param[in] patch_type The type of patch to be done.
+     * @return ESP_ERR_INVALID_SIZE if merging the write would exceed FIRESTORE_MAX_PATCH_UPSERT_FIELDS fields,
+     * or ESP_ERR_NO_MEM if all CONFIG_FIRESTORE_COALESCE_MAX_DOCUMENTS documents have pending writes.
+     * In these cases, call `firestore_coalesce_flush` with `force` and try again.
+     * ESP_ERR_INVALID_STATE if `firestore_coalesce_init` is not called.
+     */
+    esp_err_t firestore_coalesce_write(const char *path_to_document, const char *data, firestore_patch_type_t patch_type);
+
+    /**
+     * @brief Send the pending writes of the documents that are allowed to be written again
+     * Call this periodically, e.g. every 100 ms from a task.
+     *
+     * @param[in] token The token to authenticate the requests.
+     * @param[in] force Send all the pending writes, ignoring the per-document write interval.
+     * @return ESP_FAIL if any of the requests failed (the failed writes stay in the buffer, and are sent before the newer writes if they can't be merged with them),
+     * ESP_ERR_INVALID_STATE if `firestore_coalesce_init` is not called.
+     */
+    esp_err_t firestore_coalesce_flush(char *token, bool force);
+
+    /**
+     * @brief Get the statistics of the coalescing buffer (since `firestore_coalesce_init`)
+     */
+    void firestore_coalesce_get_stats(firestore_coalesce_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIRESTORE_COALESCE_H_ */
@@ -0,0 +1,671 @@
+/**
+ * @file firestore_http2.cc
+ * @brief HTTP/2 transport for the Firestore REST API, based on sh2lib (nghttp2)
+ * Several requests are multiplexed as streams over one TLS connection, so the TLS handshake is
+ * only done once per connection, and a request doesn't wait for the response of the one before it.
+ *
+ * sh2lib calls the data callback without telling which stream it belongs to, so every
+ * stream slot gets its own callback (instantiated from a template), see `STREAM_CALLBACKS`.
+ * sh2lib doesn't expose the response headers either, so the nghttp2 session it creates is
+ * replaced by one with the same callbacks plus a header callback, see `install_session`.
+ */
+
+#include "firestore_http2.h"
+#include <string.h>
+#include <array>
+#include <utility>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_tls.h"
+#include "nghttp2/nghttp2.h"
+#include "sh2lib.h"
+#include "firestore_utils.h"
+
+#define MAX_CONCURRENT_STREAMS CONFIG_FIRESTORE_HTTP2_MAX_CONCURRENT_STREAMS
+#define STREAM_PATH_BUFFER_SIZE 512
+#define AUTH_HEADER_BUFFER_SIZE (1024 + 8) // "Bearer " + token (about 758 characters) + null terminator
+
+static const char *TAG = "FS_H2";
+
+static const int RECEIVE_BUF_SIZE = 4096; // per stream
+static const int EXECUTE_INTERVAL_MS = 2;
+static const int TRANSPORT_DEFAULT_TIMEOUT_MS = 5000; // same as esp_http_client
+
+typedef struct
+{
+    bool in_use;
+    bool complete;   // the last frame (END_STREAM) is received
+    int32_t stream_id;
+    int status_code; // of the `:status` response header, 0 until it is received
+    char *receive_body;
+    int receive_body_len;
+    const char *send_body;
+    size_t send_body_len;
+    size_t send_offset;
+    firestore_body_producer_t body_producer; // if not NULL, the body is produced by it instead of `send_body`
+    void *body_producer_ctx;
+    char *send_stage; // the piece the producer made last, FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE bytes
+    int send_stage_len;
+    int send_stage_pos; // how much of the piece is sent
+    const firebase_transport_handler_t *handler; // if not NULL, the response body is given to it instead of being buffered
+    firestore_h2_response_cb_t on_response;
+    void *user_ctx;
+} h2_stream_slot_t;
+
+typedef struct
+{
+    const char *method;
+    const char *path;          // the full path, with the query
+    const char *authorization; // the Authorization header, can be NULL
+    const char *content_type;  // NULL if there is no body
+    const char *body;          // the body, NULL if there is none or it is produced
+    size_t body_len;
+    firestore_body_producer_t body_producer;
+    void *body_producer_ctx;
+    const firebase_transport_handler_t *handler;
+    firestore_h2_response_cb_t on_response;
+    void *user_ctx;
+} h2_stream_request_t;
+
+struct firestore_h2_client
+{
+    struct sh2lib_handle hd; // this has to be the first member, see `client_from_handle`
+    h2_stream_slot_t slots[MAX_CONCURRENT_STREAMS];
+    int in_flight;
+    char path[STREAM_PATH_BUFFER_SIZE];
+    char auth_header[AUTH_HEADER_BUFFER_SIZE];
+    char uri[FIRESTORE_HOST_MAX_LEN + 8];    // "https://<host>" of the Firestore client
+    char base_path[FIRESTORE_PATH_MAX_LEN]; // the REST path of the documents of the Firestore client
+};
+
+static firestore_h2_client *client_from_handle(struct sh2lib_handle *handle)
+{
+    return reinterpret_cast<firestore_h2_client *>(handle);
+}
+
+static void finish_stream(firestore_h2_client *client, h2_stream_slot_t *slot, bool reset)
+{
+    slot->receive_body[slot->receive_body_len] = '\0';
+    int status_code = reset || slot->status_code == 0 ? -1 : slot->status_code;
+    if (status_code != 200)
+    {
+        ESP_LOGE(TAG, "HTTP/2 stream failed with code: %d, body: %s", status_code, slot->receive_body);
+    }
+    if (slot->on_response)
+    {
+        slot->on_response(status_code, slot->receive_body, slot->receive_body_len, slot->user_ctx);
+    }
+    slot->in_use = false;
+    client->in_flight--;
+}
+
+template <size_t SLOT>
+static int on_stream_data(struct sh2lib_handle *handle, const char *data, size_t len, int flags)
+{
+    firestore_h2_client *client = client_from_handle(handle);
+    h2_stream_slot_t *slot = &client->slots[SLOT];
+    if (!slot->in_use)
+    {
+        return 0;
+    }
+
+    if (len > 0 && slot->handler != NULL)
+    {
+        slot->handler->on_chunk(data, len, slot->handler->user_ctx);
+    }
+    else if (len > 0)
+    {
+        size_t room = RECEIVE_BUF_SIZE - 1 - slot->receive_body_len;
+        if (len > room)
+        {
+            ESP_LOGW(TAG, "Response of stream %d is truncated to %d bytes", (int)SLOT, RECEIVE_BUF_SIZE - 1);
+            len = room;
+        }
+        memcpy(slot->receive_body + slot->receive_body_len, data, len);
+        slot->receive_body_len += len;
+    }
+
+    if (flags == DATA_RECV_FRAME_COMPLETE)
+    {
+        slot->complete = true;
+    }
+    else if (flags == DATA_RECV_RST_STREAM) // sh2lib reports every stream close like this
+    {
+        finish_stream(client, slot, !slot->complete);
+    }
+    return 0;
+}
+
+/**
+ * `length` is what the flow control window allows, it can be a few bytes. The producer is given a buffer of
+ * FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE bytes like with the other transports, and its piece is sent over as many calls as it takes.
+ */
+template <size_t SLOT>
+static int on_stream_send(struct sh2lib_handle *handle, char *buf, size_t length, uint32_t *data_flags)
+{
+    h2_stream_slot_t *slot = &client_from_handle(handle)->slots[SLOT];
+    if (slot->body_producer != NULL)
+    {
+        if (slot->send_stage_pos == slot->send_stage_len)
+        {
+            int piece_len = slot->body_producer(slot->send_stage, FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE, slot->body_producer_ctx);
+            if (piece_len < 0 || piece_len > FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE)
+            {
+                return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE; // resets the stream
+            }
+            if (piece_len == 0)
+            {
+                *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+                return 0;
+            }
+            slot->send_stage_len = piece_len;
+            slot->send_stage_pos = 0;
+        }
+        size_t staged = slot->send_stage_len - slot->send_stage_pos;
+        size_t copy_len = staged < length ? staged : length;
+        memcpy(buf, slot->send_stage + slot->send_stage_pos, copy_len);
+        slot->send_stage_pos += copy_len;
+        return copy_len;
+    }
+    size_t remaining = slot->send_body_len - slot->send_offset;
+    size_t copy_len = remaining < length ? remaining : length;
+    memcpy(buf, slot->send_body + slot->send_offset, copy_len);
+    slot->send_offset += copy_len;
+    if (slot->send_offset == slot->send_body_len)
+    {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return copy_len;
+}
+
+typedef struct
+{
+    sh2lib_frame_data_recv_cb_t recv;
+    sh2lib_putpost_data_cb_t send;
+} h2_stream_callbacks_t;
+
+template <size_t... SLOTS>
+static constexpr std::array<h2_stream_callbacks_t, sizeof...(SLOTS)> make_stream_callbacks(std::index_sequence<SLOTS...>)
+{
+    return {{{on_stream_data<SLOTS>, on_stream_send<SLOTS>}...}};
+}
+
+static constexpr auto STREAM_CALLBACKS = make_stream_callbacks(std::make_index_sequence<MAX_CONCURRENT_STREAMS>{});
+
+/* The nghttp2 session callbacks, the same as the ones of sh2lib, plus `on_header` */
+
+static ssize_t on_session_send(nghttp2_session *session, const uint8_t *data, size_t length, int flags, void *user_data)
+{
+    int result = esp_tls_conn_write(client_from_handle((struct sh2lib_handle *)user_data)->hd.http2_tls, data, length);
+    if (result <= 0)
+    {
+        return result == ESP_TLS_ERR_SSL_WANT_READ || result == ESP_TLS_ERR_SSL_WANT_WRITE ? NGHTTP2_ERR_WOULDBLOCK : NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    return result;
+}
+
+static ssize_t on_session_recv(nghttp2_session *session, uint8_t *buf, size_t length, int flags, void *user_data)
+{
+    int result = esp_tls_conn_read(client_from_handle((struct sh2lib_handle *)user_data)->hd.http2_tls, (char *)buf, (int)length);
+    if (result < 0)
+    {
+        return result == ESP_TLS_ERR_SSL_WANT_READ || result == ESP_TLS_ERR_SSL_WANT_WRITE ? NGHTTP2_ERR_WOULDBLOCK : NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    return result == 0 ? NGHTTP2_ERR_EOF : result;
+}
+
+static void notify_stream(nghttp2_session *session, int32_t stream_id, void *user_data, const char *data, size_t len, int flags)
+{
+    sh2lib_frame_data_recv_cb_t on_data = (sh2lib_frame_data_recv_cb_t)nghttp2_session_get_stream_user_data(session, stream_id);
+    if (on_data != NULL)
+    {
+        on_data((struct sh2lib_handle *)user_data, data, len, flags);
+    }
+}
+
+static int on_data_chunk_recv(nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data, size_t len, void *user_data)
+{
+    notify_stream(session, stream_id, user_data, (const char *)data, len, 0);
+    return 0;
+}
+
+static int on_frame_recv(nghttp2_session *session, const nghttp2_frame *frame, void *user_data)
+{
+    // a response without a body ends with its HEADERS frame
+    if ((frame->hd.type == NGHTTP2_DATA || frame->hd.type == NGHTTP2_HEADERS) && (frame->hd.flags & NGHTTP2_FLAG_END_STREAM))
+    {
+        notify_stream(session, frame->hd.stream_id, user_data, NULL, 0, DATA_RECV_FRAME_COMPLETE);
+    }
+    return 0;
+}
+
+static int on_stream_close(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data)
+{
+    notify_stream(session, stream_id, user_data, NULL, 0, DATA_RECV_RST_STREAM);
+    return 0;
+}
+
+static int on_header(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
+                     const uint8_t *value, size_t valuelen, uint8_t flags, void *user_data)
+{
+    static const char STATUS_HEADER[] = ":status";
+    if (frame->hd.type != NGHTTP2_HEADERS || namelen != strlen(STATUS_HEADER) || memcmp(name, STATUS_HEADER, namelen) != 0)
+    {
+        return 0;
+    }
+    firestore_h2_client *client = client_from_handle((struct sh2lib_handle *)user_data);
+    for (int i = 0; i < MAX_CONCURRENT_STREAMS; i++)
+    {
+        h2_stream_slot_t *slot = &client->slots[i];
+        if (slot->in_use && slot->stream_id == frame->hd.stream_id)
+        {
+            slot->status_code = 0;
+            for (size_t j = 0; j < valuelen; j++)
+            {
+                slot->status_code = slot->status_code * 10 + (value[j] - '0');
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Replace the session sh2lib created in `sh2lib_connect` (nothing is sent on it yet) by one that also reports the headers
+ */
+static esp_err_t install_session(firestore_h2_client *client)
+{
+    nghttp2_session_callbacks *callbacks;
+    if (nghttp2_session_callbacks_new(&callbacks) != 0)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    nghttp2_session_callbacks_set_send_callback(callbacks, on_session_send);
+    nghttp2_session_callbacks_set_recv_callback(callbacks, on_session_recv);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, on_data_chunk_recv);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header);
+
+    nghttp2_session *session = NULL;
+    int result = nghttp2_session_client_new(&session, callbacks, &client->hd);
+    nghttp2_session_callbacks_del(callbacks);
+    if (result != 0)
+    {
+        ESP_LOGE(TAG, "Failed to create the HTTP/2 session: %d", result);
+        return ESP_FAIL;
+    }
+    result = nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, NULL, 0);
+    if (result != 0)
+    {
+        ESP_LOGE(TAG, "Failed to submit the HTTP/2 settings: %d", result);
+        nghttp2_session_del(session);
+        return ESP_FAIL;
+    }
+    nghttp2_session_del(client->hd.http2_sess);
+    client->hd.http2_sess = session;
+    return ESP_OK;
+}
+
+static const char *method_name(esp_http_client_method_t http_method)
+{
+    switch (http_method)
+    {
+    case HTTP_METHOD_GET:
+        return "GET";
+    case HTTP_METHOD_POST:
+        return "POST";
+    case HTTP_METHOD_PATCH:
+        return "PATCH";
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Only rebuild the "Bearer <token>" header value when the token changes
+ */
+static void set_auth_header(firestore_h2_client *client, const char *auth_token)
+{
+    if (strcmp(client->auth_header + strlen("Bearer "), auth_token) != 0)
+    {
+        snprintf(client->auth_header, AUTH_HEADER_BUFFER_SIZE, "Bearer %s", auth_token);
+    }
+}
+
+esp_err_t firestore_h2_connect_client(firestore_client_handle_t firestore_client, firestore_h2_client_handle_t *client)
+{
+    firestore_h2_client *new_client = (firestore_h2_client *)heap_caps_calloc(1, sizeof(firestore_h2_client), MALLOC_CAP_SPIRAM);
+    if (new_client == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate the HTTP/2 client");
+        return ESP_ERR_NO_MEM;
+    }
+    strcpy(new_client->auth_header, "Bearer ");
+    snprintf(new_client->uri, sizeof(new_client->uri), "https://%s", firestore_client_get_host(firestore_client));
+    snprintf(new_client->base_path, FIRESTORE_PATH_MAX_LEN, "%s", firestore_client_get_base_path(firestore_client));
+
+    for (int i = 0; i < MAX_CONCURRENT_STREAMS; i++)
+    {
+        new_client->slots[i].receive_body = (char *)heap_caps_malloc(RECEIVE_BUF_SIZE, MALLOC_CAP_SPIRAM);
+        new_client->slots[i].send_stage = (char *)heap_caps_malloc(FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE, MALLOC_CAP_SPIRAM);
+        if (new_client->slots[i].receive_body == NULL || new_client->slots[i].send_stage == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to allocate the buffers of stream %d", i);
+            firestore_h2_disconnect(new_client);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    struct sh2lib_config_t h2_config = {};
+    h2_config.uri = new_client->uri;
+    if (sh2lib_connect(&h2_config, &new_client->hd) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to connect to %s", new_client->uri);
+        firestore_h2_disconnect(new_client);
+        return ESP_FAIL;
+    }
+    if (install_session(new_client) != ESP_OK)
+    {
+        firestore_h2_disconnect(new_client);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "HTTP/2 connection to %s established", new_client->uri);
+    *client = new_client;
+    return ESP_OK;
+}
+
+esp_err_t firestore_h2_connect(firestore_h2_client_handle_t *client)
+{
+    return firestore_h2_connect_client(NULL, client);
+}
+
+/**
+ * @brief Submit a request on a free stream slot, the path and header buffers of the client can be reused afterwards
+ *
+ * @param[out] slot_index The slot of the request.
+ */
+static esp_err_t submit_stream(firestore_h2_client *client, const h2_stream_request_t *request, int *slot_index)
+{
+    int index = 0;
+    while (index < MAX_CONCURRENT_STREAMS && client->slots[index].in_use)
+    {
+        index++;
+    }
+    if (index == MAX_CONCURRENT_STREAMS)
+    {
+        ESP_LOGW(TAG, "All %d streams are in flight", MAX_CONCURRENT_STREAMS);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // nghttp2 copies the header name/value pairs, so the buffers can be reused by the next request
+    nghttp2_nv headers[6] = {
+        SH2LIB_MAKE_NV(":method", request->method),
+        SH2LIB_MAKE_NV(":scheme", "https"),
+        SH2LIB_MAKE_NV(":authority", client->hd.hostname),
+        SH2LIB_MAKE_NV(":path", request->path),
+    };
+    size_t num_headers = 4;
+    if (request->authorization != NULL)
+    {
+        headers[num_headers++] = SH2LIB_MAKE_NV("authorization", request->authorization);
+    }
+
+    h2_stream_slot_t *slot = &client->slots[index];
+    slot->in_use = true;
+    slot->complete = false;
+    slot->status_code = 0;
+    slot->receive_body_len = 0;
+    slot->send_body = request->body;
+    slot->send_body_len = request->body_len;
+    slot->send_offset = 0;
+    slot->body_producer = request->body_producer;
+    slot->body_producer_ctx = request->body_producer_ctx;
+    slot->send_stage_len = 0;
+    slot->send_stage_pos = 0;
+    slot->handler = request->handler;
+    slot->on_response = request->on_response;
+    slot->user_ctx = request->user_ctx;
+    client->in_flight++;
+
+    int result;
+    if (request->body == NULL && request->body_producer == NULL)
+    {
+        result = sh2lib_do_get_with_nv(&client->hd, headers, num_headers, STREAM_CALLBACKS[index].recv);
+    }
+    else
+    {
+        headers[num_headers++] = SH2LIB_MAKE_NV("content-type", request->content_type);
+        result = sh2lib_do_putpost_with_nv(
+            &client->hd, headers, num_headers, STREAM_CALLBACKS[index].send, STREAM_CALLBACKS[index].recv);
+    }
+
+    if (result < 0)
+    {
+        ESP_LOGE(TAG, "Failed to submit the HTTP/2 request: %d", result);
+        slot->in_use = false;
+        client->in_flight--;
+        return ESP_FAIL;
+    }
+    slot->stream_id = result;
+    *slot_index = index;
+    return ESP_OK;
+}
+
+esp_err_t firestore_h2_submit(
+    firestore_h2_client_handle_t client,
+    esp_http_client_method_t http_method,
+    const firestore_path_t *path,
+    const char *queries,
+    const char *http_body,
+    const char *auth_token,
+    firestore_h2_response_cb_t on_response,
+    void *user_ctx)
+{
+    const char *method = method_name(http_method);
+    if (method == NULL)
+    {
+        ESP_LOGE(TAG, "HTTP method %d is not supported over HTTP/2", http_method);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (http_method != HTTP_METHOD_GET && http_body == NULL)
+    {
+        ESP_LOGE(TAG, "HTTP method %s requires `http_body`", method);
+        return ESP_FAIL;
+    }
+
+    if (strcmp(firestore_client_get_host(path->client), client->hd.hostname) != 0 ||
+        strncmp(path->rest_path, client->base_path, strlen(client->base_path)) != 0)
+    {
+        ESP_LOGE(TAG, "The path %s is not of the database of the HTTP/2 connection to %s", path->rest_path, client->hd.hostname);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // the path is already validated and URL-escaped by its handle, its precomputed query goes before `queries`
+    bool has_prefix = path->query_prefix[0] != '\0';
+    bool has_queries = queries != NULL && queries[0] != '\0';
+    if (snprintf(client->path, STREAM_PATH_BUFFER_SIZE, "%s%s%s%s%s", path->rest_path,
+                 has_prefix || has_queries ? "?" : "", path->query_prefix,
+                 has_prefix && has_queries ? "&" : "", has_queries ? queries : "") >= STREAM_PATH_BUFFER_SIZE)
+    {
+        ESP_LOGE(TAG, "The request path %s is too long", path->rest_path);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (auth_token != NULL)
+    {
+        set_auth_header(client, auth_token);
+    }
+
+    h2_stream_request_t request = {};
+    request.method = method;
+    request.path = client->path;
+    request.authorization = auth_token != NULL ? client->auth_header : NULL;
+    request.content_type = "application/json";
+    request.body = http_body;
+    request.body_len = http_body != NULL ? strlen(http_body) : 0;
+    request.on_response = on_response;
+    request.user_ctx = user_ctx;
+    int slot_index;
+    esp_err_t result = submit_stream(client, &request, &slot_index);
+    if (result == ESP_OK)
+    {
+        ESP_LOGI(TAG, "%s %s submitted on stream slot %d", method, path->rest_path, slot_index);
+    }
+    return result;
+}
+
+/**
+ * @brief Drive the connection until `*done` is set, or until no request is in flight if `done` is NULL
+ */
+static esp_err_t execute_until(firestore_h2_client *client, const bool *done, int timeout_ms)
+{
+    int64_t deadline_us = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    while (done != NULL ? !*done : client->in_flight > 0)
+    {
+        if (sh2lib_execute(&client->hd) != 0)
+        {
+            ESP_LOGE(TAG, "HTTP/2 connection is broken, %d requests are dropped", client->in_flight);
+            for (int i = 0; i < MAX_CONCURRENT_STREAMS; i++)
+            {
+                if (client->slots[i].in_use)
+                {
+                    finish_stream(client, &client->slots[i], true);
+                }
+            }
+            return ESP_FAIL;
+        }
+        if (done != NULL ? *done : client->in_flight == 0)
+        {
+            break;
+        }
+        if (esp_timer_get_time() > deadline_us)
+        {
+            ESP_LOGW(TAG, "Timeout with %d requests still in flight", client->in_flight);
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(pdMS_TO_TICKS(EXECUTE_INTERVAL_MS));
+    }
+    return ESP_OK;
+}
+
+esp_err_t firestore_h2_wait_all(firestore_h2_client_handle_t client, int timeout_ms)
+{
+    return execute_until(client, NULL, timeout_ms);
+}
+
+typedef struct
+{
+    bool done;
+    int status_code;
+} h2_transport_result_t;
+
+static void on_transport_response(int status_code, const char *body, int body_len, void *user_ctx)
+{
+    h2_transport_result_t *result = (h2_transport_result_t *)user_ctx;
+    result->status_code = status_code;
+    result->done = true;
+}
+
+static esp_err_t h2_transport_request(const firebase_transport_t *transport,
+                                      const firebase_transport_request_t *request,
+                                      const firebase_transport_handler_t *handler,
+                                      int *status_code)
+{
+    firestore_h2_client *client = (firestore_h2_client *)transport->ctx;
+    const char *method = method_name(request->method);
+    esp_err_t result = ESP_OK;
+    if (method == NULL || strcmp(request->host, client->hd.hostname) != 0)
+    {
+        ESP_LOGE(TAG, "HTTP/2 connection to %s can't send HTTP method %d to %s", client->hd.hostname, request->method, request->host);
+        result = ESP_ERR_NOT_SUPPORTED;
+    }
+    else if (snprintf(client->path, STREAM_PATH_BUFFER_SIZE, "%s%s%s", request->path,
+                      request->query != NULL ? "?" : "", request->query != NULL ? request->query : "") >= STREAM_PATH_BUFFER_SIZE)
+    {
+        ESP_LOGE(TAG, "The request path %s is too long", request->path);
+        result = ESP_ERR_INVALID_SIZE;
+    }
+    if (result != ESP_OK)
+    {
+        handler->on_error(result, handler->user_ctx);
+        return result;
+    }
+
+    h2_transport_result_t response = {false, -1};
+    h2_stream_request_t stream_request = {};
+    stream_request.method = method;
+    stream_request.path = client->path;
+    stream_request.authorization = request->authorization;
+    stream_request.content_type = request->content_type;
+    stream_request.body = request->body;
+    stream_request.body_len = request->body_len;
+    stream_request.body_producer = request->body_producer;
+    stream_request.body_producer_ctx = request->body_producer_ctx;
+    stream_request.handler = handler;
+    stream_request.on_response = on_transport_response;
+    stream_request.user_ctx = &response;
+    int slot_index;
+    result = submit_stream(client, &stream_request, &slot_index);
+    if (result == ESP_OK)
+    {
+        result = execute_until(client, &response.done, request->timeout_ms > 0 ? request->timeout_ms : TRANSPORT_DEFAULT_TIMEOUT_MS);
+    }
+    if (result == ESP_ERR_TIMEOUT)
+    {
+        // the stream is reset, its callbacks must not touch the request and the response of this call anymore
+        h2_stream_slot_t *slot = &client->slots[slot_index];
+        slot->body_producer = NULL;
+        slot->send_body_len = slot->send_offset;
+        slot->handler = NULL;
+        slot->on_response = NULL;
+        nghttp2_submit_rst_stream(client->hd.http2_sess, NGHTTP2_FLAG_NONE, slot->stream_id, NGHTTP2_CANCEL);
+    }
+    else if (result == ESP_OK && response.status_code < 0)
+    {
+        result = ESP_FAIL; // reset before the response is complete
+    }
+    if (result != ESP_OK)
+    {
+        handler->on_error(result, handler->user_ctx);
+        return result;
+    }
+    *status_code = response.status_code;
+    return ESP_OK;
+}
+
+esp_err_t firestore_h2_transport_init(firebase_transport_t *transport, firestore_h2_client_handle_t client)
+{
+    if (transport == NULL || client == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    transport->request = h2_transport_request;
+    transport->ctx = client;
+    return ESP_OK;
+}
+
+int firestore_h2_in_flight(firestore_h2_client_handle_t client)
+{
+    return client->in_flight;
+}
+
+void firestore_h2_disconnect(firestore_h2_client_handle_t client)
+{
+    if (client == NULL)
+    {
+        return;
+    }
+    if (client->hd.http2_sess != NULL)
+    {
+        sh2lib_free(&client->hd);
+    }
+    for (int i = 0; i < MAX_CONCURRENT_STREAMS; i++)
+    {
+        heap_caps_free(client->slots[i].receive_body);
+        heap_caps_free(client->slots[i].send_stage);
+    }
+    heap_caps_free(client);
+    ESP_LOGI(TAG, "HTTP/2 connection closed");
+}
@@ -0,0 +1,113 @@
+#ifndef FIRESTORE_HTTP2_H_
+#define FIRESTORE_HTTP2_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "firestore_utils.h"
+
+    /**
+     * An HTTP/2 client keeps one TLS connection to Firestore open, and multiplexes several
+     * in-flight requests (streams) over it. The TLS handshake is done once for all the requests,
+     * and a request doesn't have to wait for the response of the one before it.
+     * It can also be used as the transport of a Firestore client, see `firestore_h2_transport_init`.
+     *
+     * This is only available if `CONFIG_FIRESTORE_HTTP2_TRANSPORT` is enabled in menuconfig,
+     * and the project depends on the `espressif/sh2lib` component.
+     */
+    typedef struct firestore_h2_client *firestore_h2_client_handle_t;
+
+    /**
+     * @brief Called once per request when its stream is finished.
+     *
+     * @param[in] status_code The HTTP status code of the response (its `:status` header), or -1 if the stream is reset
+     * before the response is complete.
+     * @param[in] body The (null terminated) response body. It is only valid during the callback.
+     * @param[in] body_len The length of the response body.
+     * @param[in] user_ctx The `user_ctx` that was given to `firestore_h2_submit`.
+     */
+    typedef void (*firestore_h2_response_cb_t)(int status_code, const char *body, int body_len, void *user_ctx);
+
+    /**
+     * @brief Open an HTTP/2 connection to Firestore
+     *
+     * @param[out] client The handle of the client. Release it with `firestore_h2_disconnect`.
+     */
+    esp_err_t firestore_h2_connect(firestore_h2_client_handle_t *client);
+
+    /**
+     * @brief Same as `firestore_h2_connect`, but to the host of a Firestore client, for the requests to its database
+     * (see `firestore_client_create`). Its host and path are copied, so the client can be destroyed while the connection is open.
+     *
+     * @param[in] firestore_client The Firestore client, NULL for the default client.
+     * @param[out] client The handle of the HTTP/2 client. Release it with `firestore_h2_disconnect`.
+     */
+    esp_err_t firestore_h2_connect_client(firestore_client_handle_t firestore_client, firestore_h2_client_handle_t *client);
+
+    /**
+     * @brief Queue a Firestore REST request on the connection. The request is sent in the next `firestore_h2_wait_all`.
+     *
+     * @param[in] client The client handle.
+     * @param[in] http_method HTTP_METHOD_GET, HTTP_METHOD_POST or HTTP_METHOD_PATCH
+     * @param[in] path The handle of the document or collection path (see `firestore_document_path_init`), of the database
+     * the connection is to. Its escaped REST path and its precomputed query (the update mask, or the document ID) are used.
+     * @param[in] queries More query parameters, e.g. "mask.fieldPaths=z", or NULL. They are sent as they are, so escape them.
+     * @param[in] http_body The body of the request, or NULL for GET. It has to stay valid until `on_response` is called.
+     * @param[in] auth_token The auth token, or NULL if the request does not require one.
+     * @param[in] on_response The callback to be called with the response (can be NULL).
+     * @param[in] user_ctx Passed to `on_response`.
+     * @return ESP_ERR_NO_MEM if there are already CONFIG_FIRESTORE_HTTP2_MAX_CONCURRENT_STREAMS requests in flight,
+     * ESP_ERR_INVALID_ARG if the path is of another database than the one of the connection.
+     */
+    esp_err_t firestore_h2_submit(
+        firestore_h2_client_handle_t client,
+        esp_http_client_method_t http_method,
+        const firestore_path_t *path,
+        const char *queries,
+        const char *http_body,
+        const char *auth_token,
+        firestore_h2_response_cb_t on_response,
+        void *user_ctx);
+
+    /**
+     * @brief Drive the connection until all the in-flight requests are finished
+     *
+     * @param[in] client The client handle.
+     * @param[in] timeout_ms Give up after this long (the unfinished streams stay in flight).
+     * @return ESP_OK if all the requests are finished (no matter their status code), ESP_ERR_TIMEOUT, or ESP_FAIL if the connection is broken.
+     */
+    esp_err_t firestore_h2_wait_all(firestore_h2_client_handle_t client, int timeout_ms);
+
+    /**
+     * @brief Make a transport (see firebase_transport.h) that sends the requests over the HTTP/2 connection,
+     * so the `firestore_*` functions of a client reuse it instead of opening a TLS connection per request, e.g.
+     * `firestore_set_transport` for the default client, or `transport` of `firestore_client_config_t`.
+     * Each request waits for its response, so use `firestore_h2_submit` to have several in flight.
+     * The `timeout_ms` of a request is for the whole request, after which its stream is reset.
+     * The token requests go to another host, so they can't use this transport.
+     * Like the client, the transport is used by one task at a time.
+     *
+     * @param[out] transport The transport to initialize.
+     * @param[in] client The connected HTTP/2 client, it has to stay connected as long as the transport is used.
+     */
+    esp_err_t firestore_h2_transport_init(firebase_transport_t *transport, firestore_h2_client_handle_t client);
+
+    /**
+     * @brief Get the number of the requests that are still in flight
+     */
+    int firestore_h2_in_flight(firestore_h2_client_handle_t client);
+
+    /**
+     * @brief Close the connection and release the client
+     */
+    void firestore_h2_disconnect(firestore_h2_client_handle_t client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIRESTORE_HTTP2_H_ */
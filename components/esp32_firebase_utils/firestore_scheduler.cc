@@ -0,0 +1,278 @@
+/**
+ * @file firestore_scheduler.cc
+ * @brief Priority and deadline aware scheduler of the Firestore requests
+ * Each priority lane is a FreeRTOS queue, and a counting semaphore counts the requests of all the lanes.
+ * The scheduler task picks the next lane by weighted round robin: in every round, a lane can send
+ * up to LANE_WEIGHTS[lane] requests, and lanes with higher priority are checked first.
+ */
+
+#include "firestore_scheduler.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#define LANE_LENGTH CONFIG_FIRESTORE_SCHEDULER_LANE_LENGTH
+#define TOTAL_LENGTH (LANE_LENGTH * FIRESTORE_PRIORITY_COUNT)
+
+static const char *TAG = "FS_SCHED";
+
+static const int LANE_WEIGHTS[FIRESTORE_PRIORITY_COUNT] = {4, 2, 1};
+
+typedef struct
+{
+    firestore_sched_request_t request;
+    int64_t submit_us;
+    int64_t deadline_us; // 0 means no deadline
+} queued_request_t;
+
+typedef struct
+{
+    uint32_t submitted;
+    uint32_t succeeded;
+    uint32_t failed;
+    uint32_t expired;
+    int64_t total_queue_latency_us;
+    int64_t max_queue_latency_us;
+    uint32_t dequeued;
+} lane_counters_t;
+
+static QueueHandle_t lanes[FIRESTORE_PRIORITY_COUNT];
+static SemaphoreHandle_t pending_requests = NULL; // counts the requests in all the lanes
+static SemaphoreHandle_t stats_mutex = NULL;
+static lane_counters_t lane_counters[FIRESTORE_PRIORITY_COUNT];
+static int lane_credits[FIRESTORE_PRIORITY_COUNT];
+
+/**
+ * @brief Take the next request, by weighted round robin over the lanes that are not empty
+ */
+static bool take_next_request(queued_request_t *queued, firestore_priority_t *lane)
+{
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < FIRESTORE_PRIORITY_COUNT; i++)
+        {
+            if (lane_credits[i] > 0 && xQueueReceive(lanes[i], queued, 0) == pdTRUE)
+            {
+                lane_credits[i]--;
+                *lane = (firestore_priority_t)i;
+                return true;
+            }
+        }
+        // the lanes with requests have used up their credits (or the others are empty), start a new round
+        for (int i = 0; i < FIRESTORE_PRIORITY_COUNT; i++)
+        {
+            lane_credits[i] = LANE_WEIGHTS[i];
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Run the request with the options of it, with `timeout_ms` as the timeout (if not 0, and shorter than the one of the options)
+ */
+static esp_err_t run_request(const firestore_sched_request_t *request, int timeout_ms)
+{
+    firestore_request_options_t options = {};
+    if (request->options != NULL)
+    {
+        options = *request->options;
+    }
+    if (timeout_ms != 0 && (options.timeout_ms == 0 || timeout_ms < options.timeout_ms))
+    {
+        options.timeout_ms = timeout_ms;
+    }
+    switch (request->op)
+    {
+    case FIRESTORE_OP_CREATE:
+        return firestore_createDocument_at(request->path, request->data, request->token, &options);
+    case FIRESTORE_OP_PATCH:
+        return firestore_patch_at(request->path, request->data, request->token, request->patch_type, &options);
+    case FIRESTORE_OP_GET_FIELD_VALUE:
+        return firestore_get_a_field_value_at(request->path, request->field, request->token, request->value, &options);
+    default:
+        ESP_LOGE(TAG, "Unknown operation %d", request->op);
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+static void scheduler_task(void *arg)
+{
+    queued_request_t queued;
+    firestore_priority_t lane;
+    while (true)
+    {
+        xSemaphoreTake(pending_requests, portMAX_DELAY);
+        if (!take_next_request(&queued, &lane))
+        {
+            continue;
+        }
+
+        int64_t now_us = esp_timer_get_time();
+        int64_t queue_latency_us = now_us - queued.submit_us;
+        bool expired = queued.deadline_us != 0 && now_us >= queued.deadline_us;
+
+        xSemaphoreTake(stats_mutex, portMAX_DELAY);
+        lane_counters_t *counters = &lane_counters[lane];
+        counters->dequeued++;
+        counters->total_queue_latency_us += queue_latency_us;
+        if (queue_latency_us > counters->max_queue_latency_us)
+        {
+            counters->max_queue_latency_us = queue_latency_us;
+        }
+        xSemaphoreGive(stats_mutex);
+
+        esp_err_t result = ESP_ERR_TIMEOUT;
+        if (expired)
+        {
+            ESP_LOGW(TAG, "Request of lane %d is cancelled, its deadline passed %d ms ago",
+                     lane, (int)((now_us - queued.deadline_us) / 1000));
+        }
+        else
+        {
+            // the time left until the deadline is the timeout of the request (of each socket operation of it, see the header)
+            result = run_request(&queued.request, queued.deadline_us != 0 ? (int)((queued.deadline_us - now_us + 999) / 1000) : 0);
+        }
+
+        xSemaphoreTake(stats_mutex, portMAX_DELAY);
+        if (expired)
+        {
+            counters->expired++;
+        }
+        else if (result == ESP_OK)
+        {
+            counters->succeeded++;
+        }
+        else
+        {
+            counters->failed++;
+        }
+        xSemaphoreGive(stats_mutex);
+
+        if (queued.request.on_done)
+        {
+            queued.request.on_done(result, queued.request.user_ctx);
+        }
+    }
+}
+
+/**
+ * @brief Delete the lanes and semaphores that are created, so `firestore_scheduler_start` can be called again
+ */
+static void delete_scheduler_objects(void)
+{
+    for (int i = 0; i < FIRESTORE_PRIORITY_COUNT; i++)
+    {
+        if (lanes[i] != NULL)
+        {
+            vQueueDelete(lanes[i]);
+            lanes[i] = NULL;
+        }
+    }
+    if (stats_mutex != NULL)
+    {
+        vSemaphoreDelete(stats_mutex);
+        stats_mutex = NULL;
+    }
+    if (pending_requests != NULL)
+    {
+        vSemaphoreDelete(pending_requests);
+        pending_requests = NULL;
+    }
+}
+
+esp_err_t firestore_scheduler_start(void)
+{
+    if (pending_requests != NULL)
+    {
+        ESP_LOGW(TAG, "The scheduler is already started");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    bool created = true;
+    for (int i = 0; i < FIRESTORE_PRIORITY_COUNT; i++)
+    {
+        lanes[i] = xQueueCreate(LANE_LENGTH, sizeof(queued_request_t));
+        created = created && lanes[i] != NULL;
+        lane_credits[i] = LANE_WEIGHTS[i];
+    }
+    memset(lane_counters, 0, sizeof(lane_counters));
+    stats_mutex = xSemaphoreCreateMutex();
+    pending_requests = xSemaphoreCreateCounting(TOTAL_LENGTH, 0);
+    if (!created || stats_mutex == NULL || pending_requests == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create the lanes of the scheduler");
+        delete_scheduler_objects();
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(scheduler_task,
+                    "fs_scheduler",
+                    CONFIG_FIRESTORE_SCHEDULER_TASK_STACK_SIZE,
+                    NULL,
+                    CONFIG_FIRESTORE_SCHEDULER_TASK_PRIORITY,
+                    NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create the scheduler task");
+        delete_scheduler_objects();
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Scheduler started");
+    return ESP_OK;
+}
+
+esp_err_t firestore_scheduler_submit(const firestore_sched_request_t *request)
+{
+    if (request->priority < 0 || request->priority >= FIRESTORE_PRIORITY_COUNT || request->path == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (pending_requests == NULL)
+    {
+        ESP_LOGE(TAG, "The scheduler is not started");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    queued_request_t queued = {};
+    queued.request = *request;
+    queued.submit_us = esp_timer_get_time();
+    queued.deadline_us = request->deadline_ms > 0 ? queued.submit_us + (int64_t)request->deadline_ms * 1000 : 0;
+
+    if (xQueueSend(lanes[request->priority], &queued, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Lane %d is full", request->priority);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(stats_mutex, portMAX_DELAY);
+    lane_counters[request->priority].submitted++;
+    xSemaphoreGive(stats_mutex);
+    xSemaphoreGive(pending_requests);
+    return ESP_OK;
+}
+
+esp_err_t firestore_scheduler_get_lane_stats(firestore_priority_t priority, firestore_sched_lane_stats_t *stats)
+{
+    if (priority < 0 || priority >= FIRESTORE_PRIORITY_COUNT || stats == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (pending_requests == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(stats_mutex, portMAX_DELAY);
+    const lane_counters_t *counters = &lane_counters[priority];
+    stats->submitted = counters->submitted;
+    stats->succeeded = counters->succeeded;
+    stats->failed = counters->failed;
+    stats->expired = counters->expired;
+    stats->queued = uxQueueMessagesWaiting(lanes[priority]);
+    stats->avg_queue_latency_ms = counters->dequeued > 0 ? (float)counters->total_queue_latency_us / counters->dequeued / 1000 : 0;
+    stats->max_queue_latency_ms = counters->max_queue_latency_us / 1000;
+    xSemaphoreGive(stats_mutex);
+    return ESP_OK;
+}
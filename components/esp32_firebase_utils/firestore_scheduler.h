@@ -0,0 +1,106 @@
+#ifndef FIRESTORE_SCHEDULER_H_
+#define FIRESTORE_SCHEDULER_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "firestore_utils.h"
+
+    /**
+     * The scheduler runs the Firestore requests in a task, from three priority lanes.
+     * The lanes are served by weighted round robin (4 : 2 : 1), so a time-critical request waits for at most
+     * a few requests of the other lanes, and a bulk backlog still gets its share.
+     * A request can have a deadline: it is cancelled if the deadline passed before it is sent,
+     * and otherwise the rest of the time until the deadline is used as its timeout (`timeout_ms` of its options).
+     * Note that the timeout of esp_http_client is for each socket operation (connecting, sending, receiving),
+     * so a request that keeps making progress can still finish after its deadline.
+     * The clients of the paths of the scheduled requests must only be used by the scheduler task,
+     * since a client is used by one task at a time.
+     */
+    typedef enum
+    {
+        FIRESTORE_PRIORITY_HIGH,   // e.g. alarms
+        FIRESTORE_PRIORITY_NORMAL, // e.g. state updates
+        FIRESTORE_PRIORITY_BULK,   // e.g. telemetry backlog
+        FIRESTORE_PRIORITY_COUNT
+    } firestore_priority_t;
+
+    typedef enum
+    {
+        FIRESTORE_OP_CREATE,         // firestore_createDocument_at
+        FIRESTORE_OP_PATCH,          // firestore_patch_at
+        FIRESTORE_OP_GET_FIELD_VALUE // firestore_get_a_field_value_at
+    } firestore_op_t;
+
+    /**
+     * @brief Called in the scheduler task when a request is done
+     *
+     * @param[in] result The result of the request, or ESP_ERR_TIMEOUT if it is cancelled because of its deadline.
+     * @param[in] user_ctx The `user_ctx` of the request.
+     */
+    typedef void (*firestore_sched_done_cb_t)(esp_err_t result, void *user_ctx);
+
+    /**
+     * A request to be scheduled. The request itself is copied by `firestore_scheduler_submit`,
+     * but everything it points to has to stay valid until `on_done` is called.
+     */
+    typedef struct
+    {
+        firestore_op_t op;
+        const firestore_path_t *path;      // collection handle for FIRESTORE_OP_CREATE, document handle otherwise
+        char *data;                        // the body, for FIRESTORE_OP_CREATE and FIRESTORE_OP_PATCH
+        firestore_patch_type_t patch_type; // for FIRESTORE_OP_PATCH
+        char *field;                       // the field to get, for FIRESTORE_OP_GET_FIELD_VALUE
+        char *value;                       // [out] the buffer of the field value, for FIRESTORE_OP_GET_FIELD_VALUE
+        char *token;                       // the token buffer, read when the request is sent (so it can be refreshed meanwhile)
+        const firestore_request_options_t *options; // the per-call options, can be NULL
+        firestore_priority_t priority;
+        uint32_t deadline_ms;              // the request has to be done within this time after it is submitted, 0 means no deadline
+        firestore_sched_done_cb_t on_done; // can be NULL
+        void *user_ctx;
+    } firestore_sched_request_t;
+
+    typedef struct
+    {
+        uint32_t submitted;         // accepted by firestore_scheduler_submit
+        uint32_t succeeded;
+        uint32_t failed;
+        uint32_t expired;           // cancelled before being sent, because the deadline passed
+        uint32_t queued;            // currently waiting in the lane
+        float avg_queue_latency_ms; // from submission until the request is taken from the lane
+        uint32_t max_queue_latency_ms;
+    } firestore_sched_lane_stats_t;
+
+    /**
+     * @brief Start the scheduler task
+     *
+     * @return ESP_ERR_NO_MEM if the lanes can't be created, ESP_FAIL if the task can't be created
+     * (in both cases nothing is left allocated, and it can be called again), ESP_ERR_INVALID_STATE if it is already started.
+     */
+    esp_err_t firestore_scheduler_start(void);
+
+    /**
+     * @brief Put a request in the lane of its priority
+     *
+     * @return ESP_ERR_NO_MEM if the lane is full (CONFIG_FIRESTORE_SCHEDULER_LANE_LENGTH requests),
+     * ESP_ERR_INVALID_STATE if `firestore_scheduler_start` is not called.
+     */
+    esp_err_t firestore_scheduler_submit(const firestore_sched_request_t *request);
+
+    /**
+     * @brief Get the statistics of a lane (since `firestore_scheduler_start`)
+     *
+     * @return ESP_ERR_INVALID_ARG if `priority` is not a lane,
+     * ESP_ERR_INVALID_STATE (and zeroed statistics) if `firestore_scheduler_start` is not called.
+     */
+    esp_err_t firestore_scheduler_get_lane_stats(firestore_priority_t priority, firestore_sched_lane_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIRESTORE_SCHEDULER_H_ */
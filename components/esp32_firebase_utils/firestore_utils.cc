@@ -11,54 +11,418 @@
 
 #include "firestore_utils.h"
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "cJSON.h"
 #include "esp_http_client.h"
+#include "firebase_auth.h"
+#include "firebase_transport.h"
 
-#define FIRESTORE_HOSTNAME "firestore.googleapis.com"
-#define FIRESTORE_BASE_PATH_FORMAT "/v1/projects/" FIREBASE_PROJECT_ID "/" FIRESTORE_DB_ROOT "/%s"
-#define FIRESTORE_DUMMY_RETURN_MASK "mask.fieldPaths=z" // this is used to prevent the whole document from being returned when using patch request
+#define FIRESTORE_DUMMY_MASK_FIELD "z" // masking the response to a field the documents don't have leaves only the metadata of the document
 
-#define PATCH_UPDATE_MASK_BUFFER_SIZE 256 // this buffer will hold string like "updateMask.fieldPaths=Oct21&updateMask.fieldPaths=Oct22"
-#define MAX_PATCH_UPSERT_FIELDS 5
-#define PATH_BUFFER_SIZE 256
+#define QUERY_BUFFER_SIZE 256 // this buffer will hold string like "updateMask.fieldPaths=Oct21&updateMask.fieldPaths=Oct22"
+#define AUTH_HEADER_BUFFER_SIZE (1024 + 8) // "Bearer " + token (about 758 characters) + null terminator
+#define MAX_SEGMENT_LEN 1500               // Firestore limit of a collection ID or document ID
+#define TOKEN_REFRESH_MARGIN_US (5 * 60 * 1000000LL) // the managed ID token is refreshed this long before it expires
 
 static const char *TAG = "FB_FS";
-static const char *TAG_EVENT_HANDLER = "FS_EVENT";
 
-static const int BASE_PATH_FORMAT_SIZE = strlen(FIRESTORE_BASE_PATH_FORMAT) + 1;
-
-static const int SEND_BUF_SIZE = 4096; // this is also called transmit (tx) buffer size
 static const int RECEIVE_BUF_SIZE = 4096;
 
-static char *RECEIVE_BODY = NULL;
-static int receive_body_len = 0;
+struct firestore_client
+{
+    char host[FIRESTORE_HOST_MAX_LEN];
+    char base_path[FIRESTORE_PATH_MAX_LEN]; // e.g. "/v1/projects/<id>/databases/(default)/documents/"
+    const firebase_transport_t *transport;  // NULL for the default transport
+    int request_timeout_ms;                 // 0 means the default timeout of esp_http_client
+    int last_response_code;
+
+    char *receive_body;
+    int receive_body_len;
+    bool receive_body_truncated; // the response was longer than RECEIVE_BUF_SIZE - 1, the rest is dropped
+    char *query_buffer;
+    char *auth_header; // "Bearer <token>", it is kept between the requests, and only rebuilt when the token changes
 
-static char *PATCH_UPSERT_QUERY_BUFFER = NULL;
-static char *PATH_BUFFER = NULL;
+    // the managed ID token, if the client has a refresh token
+    firebase_auth_endpoint_t auth_endpoint;
+    char *refresh_token;
+    char *id_token;
+    int64_t id_token_expires_us; // esp_timer time
+};
 
-void firestore_utils_init()
+// the client of the menuconfig options, its host, path and buffers are set up by its first use
+static firestore_client default_client = {};
+// guards that setup, as the first use can be from several tasks at once (it is initialized statically, so it needs no setup itself)
+static pthread_mutex_t default_client_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Allocate the buffers of the client that are not allocated yet (over SPIRAM), they are kept until it is destroyed
+ */
+static esp_err_t alloc_client_buffers(firestore_client *client)
 {
-    RECEIVE_BODY = (char *)heap_caps_malloc(RECEIVE_BUF_SIZE, MALLOC_CAP_SPIRAM);
-    PATCH_UPSERT_QUERY_BUFFER = (char *)heap_caps_malloc(PATCH_UPDATE_MASK_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
-    PATH_BUFFER = (char *)heap_caps_malloc(PATH_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+    if (client->receive_body == NULL)
+    {
+        client->receive_body = (char *)heap_caps_malloc(RECEIVE_BUF_SIZE, MALLOC_CAP_SPIRAM);
+    }
+    if (client->query_buffer == NULL)
+    {
+        client->query_buffer = (char *)heap_caps_malloc(QUERY_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+    }
+    if (client->auth_header == NULL && (client->auth_header = (char *)heap_caps_malloc(AUTH_HEADER_BUFFER_SIZE, MALLOC_CAP_SPIRAM)) != NULL)
+    {
+        strcpy(client->auth_header, "Bearer ");
+    }
+    if (client->receive_body == NULL || client->query_buffer == NULL || client->auth_header == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate the buffers of the client");
+        return ESP_ERR_NO_MEM;
+    }
+    client->receive_body[0] = '\0';
+    return ESP_OK;
 }
 
-void firestore_utils_cleanup()
+/**
+ * @brief Get the client behind a handle, NULL is the default client
+ */
+static firestore_client *client_of(firestore_client_handle_t client)
 {
-    heap_caps_free(RECEIVE_BODY);
-    RECEIVE_BODY = NULL;
-    heap_caps_free(PATCH_UPSERT_QUERY_BUFFER);
-    PATCH_UPSERT_QUERY_BUFFER = NULL;
-    heap_caps_free(PATH_BUFFER);
-    PATH_BUFFER = NULL;
+    if (client != NULL)
+    {
+        return client;
+    }
+    pthread_mutex_lock(&default_client_mutex);
+    if (default_client.base_path[0] == '\0')
+    {
+        snprintf(default_client.host, FIRESTORE_HOST_MAX_LEN, "%s", FIRESTORE_HOSTNAME);
+        snprintf(default_client.base_path, FIRESTORE_PATH_MAX_LEN, FIRESTORE_BASE_PATH_FORMAT, "");
+    }
+    pthread_mutex_unlock(&default_client_mutex);
+    return &default_client;
 }
 
-static esp_err_t firestore_http_event_handler(esp_http_client_event_t *client_event);
+/**
+ * @brief Get the client of a request on the path, with its buffers
+ *
+ * @return NULL if the buffers can't be allocated
+ */
+static firestore_client *request_client_of(const firestore_path_t *path)
+{
+    firestore_client *client = client_of(path->client);
+    if (client != &default_client)
+    {
+        return alloc_client_buffers(client) == ESP_OK ? client : NULL;
+    }
+    pthread_mutex_lock(&default_client_mutex);
+    esp_err_t result = alloc_client_buffers(client);
+    pthread_mutex_unlock(&default_client_mutex);
+    return result == ESP_OK ? client : NULL;
+}
+
+esp_err_t firestore_client_create(const firestore_client_config_t *config, firestore_client_handle_t *client)
+{
+    if (config == NULL || client == NULL || config->project_id == NULL || config->project_id[0] == '\0')
+    {
+        ESP_LOGE(TAG, "A client needs a project ID");
+        return ESP_ERR_INVALID_ARG;
+    }
+    firestore_client *new_client = (firestore_client *)heap_caps_calloc(1, sizeof(firestore_client), MALLOC_CAP_SPIRAM);
+    if (new_client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // the prefix of every REST path of the client, e.g. "/v1/projects/<id>/databases/telemetry/documents/"
+    const char *database_id = config->database_id != NULL ? config->database_id : "(default)";
+    const char *host = config->host != NULL ? config->host : FIRESTORE_HOSTNAME;
+    esp_err_t result = ESP_OK;
+    if (snprintf(new_client->host, FIRESTORE_HOST_MAX_LEN, "%s", host) >= FIRESTORE_HOST_MAX_LEN ||
+        snprintf(new_client->base_path, FIRESTORE_PATH_MAX_LEN, "/v1/projects/%s/databases/%s/documents/",
+                 config->project_id, database_id) >= FIRESTORE_PATH_MAX_LEN)
+    {
+        ESP_LOGE(TAG, "The host or the project and database IDs are too long");
+        result = ESP_ERR_INVALID_SIZE;
+    }
+    if (result == ESP_OK)
+    {
+        result = firebase_auth_endpoint_init(&new_client->auth_endpoint, config->api_key, config->auth_transport);
+    }
+    if (result == ESP_OK)
+    {
+        result = alloc_client_buffers(new_client);
+    }
+    if (result == ESP_OK && config->refresh_token != NULL)
+    {
+        new_client->refresh_token = (char *)heap_caps_malloc(strlen(config->refresh_token) + 1, MALLOC_CAP_SPIRAM);
+        new_client->id_token = (char *)heap_caps_malloc(FIREBASE_ID_TOKEN_MAX_LEN, MALLOC_CAP_SPIRAM);
+        if (new_client->refresh_token == NULL || new_client->id_token == NULL)
+        {
+            result = ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            strcpy(new_client->refresh_token, config->refresh_token);
+            new_client->id_token[0] = '\0';
+        }
+    }
+    if (result != ESP_OK)
+    {
+        firestore_client_destroy(new_client);
+        return result;
+    }
+    new_client->transport = config->transport;
+    ESP_LOGI(TAG, "Client of %s%s created", new_client->host, new_client->base_path);
+    *client = new_client;
+    return ESP_OK;
+}
+
+void firestore_client_destroy(firestore_client_handle_t client)
+{
+    if (client == NULL)
+    {
+        return;
+    }
+    heap_caps_free(client->receive_body);
+    heap_caps_free(client->query_buffer);
+    heap_caps_free(client->auth_header);
+    heap_caps_free(client->refresh_token);
+    heap_caps_free(client->id_token);
+    heap_caps_free(client);
+}
+
+const char *firestore_client_get_host(firestore_client_handle_t client)
+{
+    return client_of(client)->host;
+}
+
+const char *firestore_client_get_base_path(firestore_client_handle_t client)
+{
+    return client_of(client)->base_path;
+}
+
+/**
+ * @brief Get the ID token the client manages, it is refreshed first if it expires in less than TOKEN_REFRESH_MARGIN_US
+ *
+ * @return NULL if the client has no refresh token, or the token can't be refreshed
+ */
+static const char *get_managed_token(firestore_client *client)
+{
+    if (client->refresh_token == NULL)
+    {
+        return NULL;
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (client->id_token[0] != '\0' && now_us < client->id_token_expires_us - TOKEN_REFRESH_MARGIN_US)
+    {
+        return client->id_token;
+    }
+    int expires_in_s = 0;
+    if (firebase_auth_refresh_id_token(&client->auth_endpoint, client->refresh_token, client->id_token, FIREBASE_ID_TOKEN_MAX_LEN, &expires_in_s) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to refresh the ID token of the client");
+        client->id_token[0] = '\0';
+        return NULL;
+    }
+    ESP_LOGI(TAG, "The ID token of the client is refreshed, it expires in %d s", expires_in_s);
+    client->id_token_expires_us = now_us + (int64_t)expires_in_s * 1000000;
+    return client->id_token;
+}
+
+esp_err_t firestore_client_get_token(firestore_client_handle_t client, char *token, int token_size)
+{
+    firestore_client *token_client = client_of(client);
+    if (token_client->refresh_token == NULL)
+    {
+        ESP_LOGE(TAG, "The client has no refresh token");
+        return ESP_ERR_INVALID_STATE;
+    }
+    const char *id_token = get_managed_token(token_client);
+    if (id_token == NULL)
+    {
+        return ESP_FAIL;
+    }
+    return snprintf(token, token_size, "%s", id_token) < token_size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+/**
+ * @brief Get the value of the Authorization header of the token
+ * The header is cached, so it is only formatted again when a different token is given.
+ *
+ * @return The header value "Bearer <token>", or NULL if the token is too long
+ */
+static const char *get_auth_header(firestore_client *client, const char *auth_token)
+{
+    static const int BEARER_PREFIX_LEN = strlen("Bearer ");
+    if (strcmp(client->auth_header + BEARER_PREFIX_LEN, auth_token) != 0)
+    {
+        if (snprintf(client->auth_header, AUTH_HEADER_BUFFER_SIZE, "Bearer %s", auth_token) >= AUTH_HEADER_BUFFER_SIZE)
+        {
+            ESP_LOGE(TAG, "The auth token is too long");
+            client->auth_header[BEARER_PREFIX_LEN] = '\0';
+            return NULL;
+        }
+    }
+    return client->auth_header;
+}
+
+void firestore_client_set_request_timeout_ms(firestore_client_handle_t client, int timeout_ms)
+{
+    client_of(client)->request_timeout_ms = timeout_ms;
+}
+
+void firestore_set_request_timeout_ms(int timeout_ms)
+{
+    firestore_client_set_request_timeout_ms(NULL, timeout_ms);
+}
+
+void firestore_set_transport(const firebase_transport_t *new_transport)
+{
+    client_of(NULL)->transport = new_transport;
+}
+
+int firestore_client_get_last_response_code(firestore_client_handle_t client)
+{
+    return client_of(client)->last_response_code;
+}
+
+int firestore_get_last_response_code(void)
+{
+    return firestore_client_get_last_response_code(NULL);
+}
+
+static esp_err_t error_from_response_code(int response_code)
+{
+    switch (response_code)
+    {
+    case 200:
+        return ESP_OK;
+    case 404:
+        return ESP_ERR_FIRESTORE_NOT_FOUND;
+    default:
+        return ESP_FAIL;
+    }
+}
+
+/**
+ * @brief Log the failed response, a missing document is only a warning (it is expected by e.g. `firestore_document_exists`)
+ */
+static void log_failed_response(const firestore_client *client, int response_code)
+{
+    if (response_code == 404)
+    {
+        ESP_LOGW(TAG, "Firestore REST API call failed with HTTP code: %d", response_code);
+        return;
+    }
+    ESP_LOGE(TAG, "Firestore REST API call failed with HTTP code: %d", response_code);
+    if (client->receive_body[0] != '\0')
+    {
+        ESP_LOGE(TAG, "Error message: %s", client->receive_body);
+    }
+}
+
+/**
+ * @brief Append a piece of the response body to the receive buffer of the client (user_ctx), the part that doesn't fit in it is dropped
+ */
+static void receive_body_on_chunk(const char *data, int len, void *user_ctx)
+{
+    firestore_client *client = (firestore_client *)user_ctx;
+    int copy_len = len;
+    if (client->receive_body_len + copy_len > RECEIVE_BUF_SIZE - 1)
+    {
+        copy_len = RECEIVE_BUF_SIZE - 1 - client->receive_body_len;
+        client->receive_body_truncated = true;
+    }
+    memcpy(client->receive_body + client->receive_body_len, data, copy_len);
+    client->receive_body_len += copy_len;
+    client->receive_body[client->receive_body_len] = '\0';
+}
+
+static void receive_body_on_error(esp_err_t error, void *user_ctx)
+{
+    ESP_LOGE(TAG, "The request failed: %s", esp_err_to_name(error));
+}
+
+typedef struct
+{
+    firestore_client *client;
+    firestore_response_consumer_t consumer;
+    void *consumer_ctx;
+} stream_consumer_t;
+
+/**
+ * @brief Give a piece of the response body to the consumer, and keep the beginning of it in the receive buffer (for the error message)
+ */
+static void stream_on_chunk(const char *data, int len, void *user_ctx)
+{
+    stream_consumer_t *stream = (stream_consumer_t *)user_ctx;
+    receive_body_on_chunk(data, len, stream->client);
+    stream->consumer(data, len, stream->consumer_ctx);
+}
+
+/**
+ * @brief Send the request over the transport of the client, with the response body into its receive buffer
+ *
+ * @param[in] auth_token The token, or NULL for the ID token the client manages (no Authorization header if it has none).
+ * @param[in] handler The handler of the response body, NULL to receive it into the receive buffer.
+ */
+static esp_err_t send_firestore_request(firestore_client *client, firebase_transport_request_t *request, const char *auth_token,
+                                        const firebase_transport_handler_t *handler = NULL)
+{
+    bool managed_token = false;
+    if (auth_token == NULL && client->refresh_token != NULL)
+    {
+        if ((auth_token = get_managed_token(client)) == NULL)
+        {
+            return ESP_FAIL;
+        }
+        managed_token = true;
+    }
+    if (auth_token != NULL && (request->authorization = get_auth_header(client, auth_token)) == NULL)
+    {
+        return ESP_FAIL;
+    }
+    request->host = client->host;
+    if (request->timeout_ms == 0)
+    {
+        request->timeout_ms = client->request_timeout_ms;
+    }
+
+    firebase_transport_handler_t receive_body_handler = {
+        .on_chunk = receive_body_on_chunk,
+        .on_error = receive_body_on_error,
+        .user_ctx = client,
+    };
+    const firebase_transport_t *transport = client->transport != NULL ? client->transport : firebase_transport_default();
+    client->receive_body[0] = '\0';
+    client->receive_body_len = 0;
+    client->receive_body_truncated = false;
+    client->last_response_code = 0;
+    int response_code = 0;
+    if (transport->request(transport, request, handler != NULL ? handler : &receive_body_handler, &response_code) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to perform HTTP request");
+        return ESP_FAIL;
+    }
+    client->last_response_code = response_code;
+    ESP_LOGI(TAG, "HTTP Response code: %d, received length: %d", response_code, client->receive_body_len);
+    if (response_code != 200)
+    {
+        if (response_code == 401 && managed_token)
+        {
+            client->id_token_expires_us = 0; // e.g. revoked, the next request gets a new one
+        }
+        log_failed_response(client, response_code);
+        return error_from_response_code(response_code);
+    }
+    return ESP_OK;
+}
 
 /**
  * @brief Make an abstract API request to API
  *
+ * @param[in] client The client the request is made with.
  * @param[in] full_path The path of your collection and documents.
  * e.g. "col1/doc1", "col1", "col1/doc1/subcol1", or "col1/subcol1/doc1"
  * @param[in] queries queries The query parameters to be used in the HTTP request.
@@ -67,28 +431,18 @@ static esp_err_t firestore_http_event_handler(esp_http_client_event_t *client_ev
  * @param[in] http_body The body of the HTTP request. e.g. "{\"fields\": {\"name\": {\"stringValue\": \"John\"}}}"
  * if the request does not require a body, pass NULL
  * @param[in] auth_token The auth token to be used in the HTTP request. If the request does not require an auth token, pass NULL
- * @param[out] receive_http_body The body of the HTTP response (could be an error message, or returned json data)
+ * @param[in] timeout_ms The timeout of the request, 0 for the one of the client.
+ * The body of the HTTP response (could be an error message, or returned json data) is in the receive buffer of the client.
  */
-esp_err_t make_abstract_firestore_api_request(
-    char *full_path,
-    char *queries,
+static esp_err_t make_abstract_firestore_api_request(
+    firestore_client *client,
+    const char *full_path,
+    const char *queries,
     esp_http_client_method_t http_method,
     char *http_body,
-    char *auth_token)
-{
-
-    esp_http_client_handle_t firestore_client_handle;
-    esp_http_client_config_t http_config = {
-        .host = FIRESTORE_HOSTNAME,
-        .path = full_path,
-        .query = queries,
-        .event_handler = firestore_http_event_handler,
-        .transport_type = HTTP_TRANSPORT_OVER_SSL,
-        .buffer_size = RECEIVE_BUF_SIZE,
-        .buffer_size_tx = SEND_BUF_SIZE,
-        .user_data = RECEIVE_BODY // note that this is the response body buffer
-    };
-
+    char *auth_token,
+    int timeout_ms = 0)
+{
     if (http_method == HTTP_METHOD_POST || http_method == HTTP_METHOD_PATCH)
     {
         if (http_body == NULL)
@@ -97,102 +451,476 @@ esp_err_t make_abstract_firestore_api_request(
             return ESP_FAIL;
         }
     }
-    ESP_LOGI(TAG, "HTTP path: %s", http_config.path);
-    ESP_LOGI(TAG, "HTTP query: %s", http_config.query);
-    firestore_client_handle = esp_http_client_init(&http_config);
-    ESP_LOGI(TAG, "http config initialized");
 
+    firebase_transport_request_t request = {};
+    request.path = full_path;
+    request.query = queries;
+    request.method = http_method;
+    request.timeout_ms = timeout_ms;
     if (http_body != NULL)
     {
-        esp_http_client_set_header(firestore_client_handle, "Content-Type", "application/json");
-        esp_http_client_set_post_field(firestore_client_handle, http_body, strlen(http_body));
+        request.content_type = "application/json";
+        request.body = http_body;
+        request.body_len = strlen(http_body);
+    }
+    return send_firestore_request(client, &request, auth_token);
+}
+
+/**
+ * @brief Same as `make_abstract_firestore_api_request`, but the body is streamed from `producer`,
+ * in pieces of FIREBASE_TRANSPORT_STREAM_CHUNK_SIZE bytes, so only one piece is held in RAM at a time.
+ *
+ * @param[in] client The client the request is made with.
+ * @param[in] full_path The path of your collection and documents.
+ * @param[in] queries The query parameters to be used in the HTTP request.
+ * @param[in] http_method HTTP_METHOD_POST or HTTP_METHOD_PATCH
+ * @param[in] producer The producer of the body.
+ * @param[in] producer_ctx Passed to `producer`.
+ * @param[in] content_length The total length of the body, or -1 to use chunked transfer encoding.
+ * @param[in] auth_token The auth token to be used in the HTTP request. If the request does not require an auth token, pass NULL
+ * @param[in] timeout_ms The timeout of the request, 0 for the one of the client.
+ */
+static esp_err_t make_streaming_firestore_api_request(
+    firestore_client *client,
+    const char *full_path,
+    const char *queries,
+    esp_http_client_method_t http_method,
+    firestore_body_producer_t producer,
+    void *producer_ctx,
+    int content_length,
+    char *auth_token,
+    int timeout_ms)
+{
+    firebase_transport_request_t request = {};
+    request.path = full_path;
+    request.query = queries;
+    request.method = http_method;
+    request.timeout_ms = timeout_ms;
+    request.content_type = "application/json";
+    request.body_producer = producer;
+    request.body_producer_ctx = producer_ctx;
+    request.content_length = content_length;
+    return send_firestore_request(client, &request, auth_token);
+}
+
+/**
+ * @brief Check if the path is a collection path
+ */
+bool is_collection_path(const char *firebase_path)
+{
+    int num_slashes = 0;
+    for (const char *c = firebase_path; *c != '\0'; c++)
+    {
+        if (*c == '/')
+        {
+            num_slashes++;
+        }
     }
-    esp_http_client_set_method(firestore_client_handle, http_method);
+    return num_slashes % 2 == 0;
+}
 
-    if (auth_token != NULL)
+static bool is_unreserved_url_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+/**
+ * @brief Append `src` to `dest` (at `*offset`), with every character except the unreserved ones (and '/' if `keep_slash`) percent-encoded
+ *
+ * @return ESP_ERR_INVALID_SIZE if it doesn't fit in `dest_size`
+ */
+static esp_err_t append_url_escaped(char *dest, int dest_size, int *offset, const char *src, bool keep_slash)
+{
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    int n = *offset;
+    for (const char *c = src; *c != '\0'; c++)
+    {
+        if (is_unreserved_url_char(*c) || (keep_slash && *c == '/'))
+        {
+            if (n + 1 >= dest_size)
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            dest[n++] = *c;
+        }
+        else
+        {
+            if (n + 3 >= dest_size)
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            dest[n++] = '%';
+            dest[n++] = HEX_DIGITS[(unsigned char)*c >> 4];
+            dest[n++] = HEX_DIGITS[(unsigned char)*c & 0x0F];
+        }
+    }
+    dest[n] = '\0';
+    *offset = n;
+    return ESP_OK;
+}
+
+/**
+ * @brief Check that a collection ID or document ID is valid
+ * https://firebase.google.com/docs/firestore/quotas#collections_documents_and_fields
+ */
+static bool is_valid_segment(const char *segment, int segment_len)
+{
+    if (segment_len == 0 || segment_len > MAX_SEGMENT_LEN)
     {
-        char auth_token_with_bearer[strlen(auth_token) + 8];
-        snprintf(auth_token_with_bearer, strlen(auth_token) + 8, "Bearer %s", auth_token);
-        esp_http_client_set_header(firestore_client_handle, "Authorization", auth_token_with_bearer);
+        return false;
     }
-    ESP_LOGI(TAG, "http headers set up! Making request...");
-    if (esp_http_client_perform(firestore_client_handle) != ESP_OK)
+    if ((segment_len == 1 && segment[0] == '.') || (segment_len == 2 && segment[0] == '.' && segment[1] == '.'))
     {
-        ESP_LOGE(TAG, "Failed to perform HTTP request");
-        esp_http_client_cleanup(firestore_client_handle);
-        receive_body_len = 0; // reset the receive body length
+        return false;
+    }
+    // IDs matching the regular expression __.*__ are reserved
+    if (segment_len >= 4 && segment[0] == '_' && segment[1] == '_' && segment[segment_len - 2] == '_' && segment[segment_len - 1] == '_')
+    {
+        return false;
+    }
+    return true;
+}
 
-        return ESP_FAIL;
+/**
+ * @brief Validate the path (in one pass), and format the REST path of it into the handle
+ *
+ * @param[in] client The client of the path, NULL for the default client.
+ * @param[out] handle The handle whose `rest_path`, `is_collection` and `client` are set.
+ * @param[in] firebase_path e.g. "col1/doc1"
+ */
+static esp_err_t init_path_handle(firestore_client_handle_t client, firestore_path_t *handle, const char *firebase_path)
+{
+    if (firebase_path == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
     }
-    ESP_LOGI(TAG, "HTTP request performed");
-    int response_code = esp_http_client_get_status_code(firestore_client_handle);
-    ESP_LOGI(TAG,
-             "HTTP Response code: %d, content_length: %d",
-             response_code,
-             (int)esp_http_client_get_content_length(firestore_client_handle));
 
-    // get the response body
-    int receive_http_body_size = strlen(RECEIVE_BODY);
+    int num_segments = 0;
+    const char *segment = firebase_path;
+    for (const char *c = firebase_path;; c++)
+    {
+        if (*c == '/' || *c == '\0')
+        {
+            if (!is_valid_segment(segment, c - segment))
+            {
+                ESP_LOGE(TAG, "Invalid path %s: segment %d is empty, too long, or reserved", firebase_path, num_segments);
+                return ESP_ERR_INVALID_ARG;
+            }
+            num_segments++;
+            segment = c + 1;
+        }
+        if (*c == '\0')
+        {
+            break;
+        }
+    }
+    handle->is_collection = num_segments % 2 == 1;
 
-    if (response_code != 200)
+    // the base path of the client, e.g. "/v1/projects/<id>/databases/(default)/documents/"
+    int offset = snprintf(handle->rest_path, FIRESTORE_PATH_MAX_LEN, "%s", client_of(client)->base_path);
+    if (offset >= FIRESTORE_PATH_MAX_LEN ||
+        append_url_escaped(handle->rest_path, FIRESTORE_PATH_MAX_LEN, &offset, firebase_path, true) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "The path %s is too long", firebase_path);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    handle->query_prefix[0] = '\0';
+    handle->client = client;
+    return ESP_OK;
+}
+
+esp_err_t firestore_client_document_path_init(firestore_client_handle_t client, firestore_path_t *handle, const char *path_to_document)
+{
+    esp_err_t result = init_path_handle(client, handle, path_to_document);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    if (handle->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", path_to_document);
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t firestore_document_path_init(firestore_path_t *handle, const char *path_to_document)
+{
+    return firestore_client_document_path_init(NULL, handle, path_to_document);
+}
+
+esp_err_t firestore_document_path_set_update_mask(firestore_path_t *handle, const char **fields, int num_fields)
+{
+    if (handle->is_collection)
+    {
+        ESP_LOGE(TAG, "The update mask is for a document path, %s is a collection path", handle->rest_path);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (num_fields > FIRESTORE_MAX_PATCH_UPSERT_FIELDS)
+    {
+        ESP_LOGE(TAG, "The update mask has more than %d fields", FIRESTORE_MAX_PATCH_UPSERT_FIELDS);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // the query is "updateMask.fieldPaths=field1&updateMask.fieldPaths=field2..."
+    int offset = 0;
+    handle->query_prefix[0] = '\0';
+    for (int i = 0; fields != NULL && i < num_fields; i++)
     {
-        ESP_LOGE(TAG, "Firestore REST API call failed with HTTP code: %d", response_code);
-        if (receive_http_body_size > 0)
+        offset += snprintf(handle->query_prefix + offset, FIRESTORE_PATH_QUERY_MAX_LEN - offset, "%supdateMask.fieldPaths=", i > 0 ? "&" : "");
+        if (offset >= FIRESTORE_PATH_QUERY_MAX_LEN ||
+            append_url_escaped(handle->query_prefix, FIRESTORE_PATH_QUERY_MAX_LEN, &offset, fields[i], false) != ESP_OK)
         {
-            ESP_LOGE(TAG, "Error message: %s", RECEIVE_BODY);
+            ESP_LOGE(TAG, "The update mask is too long");
+            handle->query_prefix[0] = '\0';
+            return ESP_ERR_INVALID_SIZE;
         }
-        esp_http_client_cleanup(firestore_client_handle);
-        receive_body_len = 0; // reset the receive body length
+    }
+    return ESP_OK;
+}
 
-        return ESP_FAIL;
+esp_err_t firestore_client_collection_path_init(
+    firestore_client_handle_t client,
+    firestore_path_t *handle,
+    const char *path_to_collection,
+    const char *document_name)
+{
+    esp_err_t result = init_path_handle(client, handle, path_to_collection);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    if (!handle->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to collection. The path %s is a document path", path_to_collection);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (document_name == NULL || !is_valid_segment(document_name, strlen(document_name)) || strchr(document_name, '/') != NULL)
+    {
+        ESP_LOGE(TAG, "Invalid document name %s", document_name ? document_name : "(null)");
+        return ESP_ERR_INVALID_ARG;
     }
 
-    esp_http_client_cleanup(firestore_client_handle);
-    receive_body_len = 0; // reset the receive body length
-    ESP_LOGI(TAG, "HTTP request cleanup");
+    // the query is "documentId=document_name"
+    int offset = snprintf(handle->query_prefix, FIRESTORE_PATH_QUERY_MAX_LEN, "documentId=");
+    if (append_url_escaped(handle->query_prefix, FIRESTORE_PATH_QUERY_MAX_LEN, &offset, document_name, false) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "The document name %s is too long", document_name);
+        return ESP_ERR_INVALID_SIZE;
+    }
     return ESP_OK;
 }
 
+esp_err_t firestore_collection_path_init(firestore_path_t *handle, const char *path_to_collection, const char *document_name)
+{
+    return firestore_client_collection_path_init(NULL, handle, path_to_collection, document_name);
+}
+
 /**
- * @brief Check if the path is a collection path
+ * @brief Append "name=value" (the value URL-escaped) to the query in the query buffer of the client
+ *
+ * @param[in,out] offset The length of the query so far, it is updated.
+ * @return ESP_ERR_INVALID_SIZE if the query doesn't fit in the query buffer
  */
-bool is_collection_path(char *firebase_path)
+static esp_err_t append_query_param(firestore_client *client, int *offset, const char *name, const char *value)
 {
-    int num_slashes = 0;
-    for (int i = 0; i < strlen(firebase_path); i++)
+    int len = snprintf(client->query_buffer + *offset, QUERY_BUFFER_SIZE - *offset, "%s%s=", *offset > 0 ? "&" : "", name);
+    if (len >= QUERY_BUFFER_SIZE - *offset)
+    {
+        ESP_LOGE(TAG, "The query is too long");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *offset += len;
+    if (append_url_escaped(client->query_buffer, QUERY_BUFFER_SIZE, offset, value, false) != ESP_OK)
     {
-        if (firebase_path[i] == '/')
+        ESP_LOGE(TAG, "The query is too long");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Append the mask of the projection (of `options`, or `default_projection` if `options` is NULL) to the query of the client
+ */
+static esp_err_t append_projection_query(firestore_client *client, int *offset, const firestore_request_options_t *options, firestore_projection_t default_projection)
+{
+    firestore_projection_t projection = options != NULL ? options->projection : default_projection;
+    switch (projection)
+    {
+    case FIRESTORE_PROJECTION_NONE:
+    case FIRESTORE_PROJECTION_METADATA:
+        return append_query_param(client, offset, "mask.fieldPaths", FIRESTORE_DUMMY_MASK_FIELD);
+    case FIRESTORE_PROJECTION_FIELDS:
+        if (options->fields == NULL || options->num_fields <= 0)
         {
-            num_slashes++;
+            ESP_LOGE(TAG, "FIRESTORE_PROJECTION_FIELDS needs the fields");
+            return ESP_ERR_INVALID_ARG;
+        }
+        for (int i = 0; i < options->num_fields; i++)
+        {
+            esp_err_t result = append_query_param(client, offset, "mask.fieldPaths", options->fields[i]);
+            if (result != ESP_OK)
+            {
+                return result;
+            }
         }
+        return ESP_OK;
+    default: // FIRESTORE_PROJECTION_FULL
+        return ESP_OK;
     }
-    return num_slashes % 2 == 0;
 }
 
-esp_err_t firestore_createDocument(char *firebase_path_to_collection, char *document_name, char *data, char *token)
+/**
+ * @brief Append the precondition of `options` (if any) to the query of the client
+ */
+static esp_err_t append_precondition_query(firestore_client *client, int *offset, const firestore_request_options_t *options)
 {
+    if (options == NULL)
+    {
+        return ESP_OK;
+    }
+    switch (options->precondition)
+    {
+    case FIRESTORE_PRECONDITION_EXISTS:
+        return append_query_param(client, offset, "currentDocument.exists", "true");
+    case FIRESTORE_PRECONDITION_NOT_EXISTS:
+        return append_query_param(client, offset, "currentDocument.exists", "false");
+    case FIRESTORE_PRECONDITION_UPDATE_TIME:
+        if (options->precondition_update_time == NULL || options->precondition_update_time[0] == '\0')
+        {
+            ESP_LOGE(TAG, "FIRESTORE_PRECONDITION_UPDATE_TIME needs the update time");
+            return ESP_ERR_INVALID_ARG;
+        }
+        return append_query_param(client, offset, "currentDocument.updateTime", options->precondition_update_time);
+    default: // FIRESTORE_PRECONDITION_NONE
+        return ESP_OK;
+    }
+}
 
-    if (!is_collection_path(firebase_path_to_collection))
+/**
+ * @brief Tell a failed precondition of a write apart from the other failures
+ * Depending on the precondition, Firestore answers 404 NOT_FOUND (exists=true), 409 ALREADY_EXISTS (exists=false, or create)
+ * or 400 FAILED_PRECONDITION (updateTime). The error body is still in the receive buffer of the client.
+ */
+static esp_err_t check_precondition_failure(const firestore_client *client, esp_err_t result, firestore_precondition_t precondition)
+{
+    if (result == ESP_OK || precondition == FIRESTORE_PRECONDITION_NONE)
     {
-        ESP_LOGE(TAG, "Invalid path to collection. The path %s is a document path", firebase_path_to_collection);
-        return ESP_FAIL;
+        return result;
     }
+    int response_code = client->last_response_code;
+    if ((response_code == 409 && strstr(client->receive_body, "ALREADY_EXISTS") != NULL) || // not ABORTED, which is contention
+        (response_code == 404 && precondition == FIRESTORE_PRECONDITION_EXISTS) ||
+        (response_code == 400 && strstr(client->receive_body, "FAILED_PRECONDITION") != NULL))
+    {
+        ESP_LOGW(TAG, "The precondition of the write is not met");
+        return ESP_ERR_FIRESTORE_PRECONDITION_FAILED;
+    }
+    return result;
+}
 
-    firestore_utils_init();
-    esp_err_t result = ESP_OK;
-    // the query is "documentID=document_name"
-    int query_size = strlen("documentId=") + strlen(document_name) + 1;
-    char query[query_size];
-    snprintf(query, query_size, "documentId=%s", document_name);
+static firestore_precondition_t precondition_of(const firestore_request_options_t *options)
+{
+    return options != NULL ? options->precondition : FIRESTORE_PRECONDITION_NONE;
+}
 
-    snprintf(PATH_BUFFER, PATH_BUFFER_SIZE, FIRESTORE_BASE_PATH_FORMAT, firebase_path_to_collection);
+static int timeout_of(const firestore_request_options_t *options)
+{
+    return options != NULL ? options->timeout_ms : 0;
+}
 
-    result = make_abstract_firestore_api_request(PATH_BUFFER, query, HTTP_METHOD_POST, data, token);
-    ESP_LOGI(TAG, "Firestore patch request done");
-    firestore_utils_cleanup();
+/**
+ * @brief Give the response in the receive buffer of the client back to the caller, as asked by `options`
+ *
+ * @return ESP_ERR_INVALID_SIZE if the response was truncated or doesn't fit in `options->response`
+ */
+static esp_err_t give_back_response(const firestore_client *client, const firestore_request_options_t *options)
+{
+    bool give_response = options != NULL && options->response != NULL && options->projection != FIRESTORE_PROJECTION_NONE;
+    if (!give_response && (options == NULL || options->update_time == NULL))
+    {
+        return ESP_OK;
+    }
+    if (client->receive_body_truncated)
+    {
+        ESP_LOGE(TAG, "The response is longer than the receive buffer (%d bytes), use a smaller projection", RECEIVE_BUF_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (give_response &&
+        snprintf(options->response, options->response_size, "%s", client->receive_body) >= options->response_size)
+    {
+        ESP_LOGE(TAG, "The response (%d bytes) doesn't fit in the response buffer", (int)strlen(client->receive_body));
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (options->update_time != NULL)
+    {
+        cJSON *root = cJSON_Parse(client->receive_body);
+        cJSON *update_time = cJSON_GetObjectItem(root, "updateTime");
+        if (!cJSON_IsString(update_time))
+        {
+            ESP_LOGE(TAG, "The response has no updateTime");
+            cJSON_Delete(root);
+            return ESP_FAIL;
+        }
+        snprintf(options->update_time, FIRESTORE_TIMESTAMP_MAX_LEN, "%s", update_time->valuestring);
+        cJSON_Delete(root);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Write the query of a create request to the query buffer of the client: the document ID and the projection
+ */
+static esp_err_t set_query_for_create(firestore_client *client, const firestore_path_t *collection, const firestore_request_options_t *options)
+{
+    firestore_precondition_t precondition = precondition_of(options);
+    if (precondition != FIRESTORE_PRECONDITION_NONE && precondition != FIRESTORE_PRECONDITION_NOT_EXISTS)
+    {
+        ESP_LOGE(TAG, "A create can only have FIRESTORE_PRECONDITION_NOT_EXISTS");
+        return ESP_ERR_INVALID_ARG;
+    }
+    int offset = snprintf(client->query_buffer, QUERY_BUFFER_SIZE, "%s", collection->query_prefix);
+    return append_projection_query(client, &offset, options, FIRESTORE_PROJECTION_NONE);
+}
+
+esp_err_t firestore_createDocument_at(const firestore_path_t *collection, char *data, char *token, const firestore_request_options_t *options)
+{
+    if (!collection->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to collection. The path %s is a document path", collection->rest_path);
+        return ESP_FAIL;
+    }
+
+    firestore_client *client = request_client_of(collection);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t result = set_query_for_create(client, collection, options);
+    if (result == ESP_OK)
+    {
+        result = make_abstract_firestore_api_request(client, collection->rest_path, client->query_buffer, HTTP_METHOD_POST, data, token, timeout_of(options));
+        result = check_precondition_failure(client, result, FIRESTORE_PRECONDITION_NOT_EXISTS);
+    }
+    if (result == ESP_OK)
+    {
+        result = give_back_response(client, options);
+    }
+    ESP_LOGI(TAG, "Firestore create request done");
     return result;
 }
 
+esp_err_t firestore_createDocument(char *firebase_path_to_collection, char *document_name, char *data, char *token)
+{
+    firestore_path_t collection;
+    if (firestore_collection_path_init(&collection, firebase_path_to_collection, document_name) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return firestore_createDocument_at(&collection, data, token, NULL);
+}
+
 /**
  * @brief Extracts the keys from a json string that contains "fields" key
  *
@@ -211,7 +939,7 @@ void extract_keys_from_fields(cJSON *json_object, char **keys, int *num_keys)
     int i = 0;
     cJSON_ArrayForEach(field, fields)
     {
-        if (i >= MAX_PATCH_UPSERT_FIELDS)
+        if (i >= FIRESTORE_MAX_PATCH_UPSERT_FIELDS)
         {
             ESP_LOGW(TAG, "The number of fields in the json string exceeds the maximum number of fields allowed");
             break;
@@ -223,67 +951,234 @@ void extract_keys_from_fields(cJSON *json_object, char **keys, int *num_keys)
 }
 
 /**
- * @brief get the mask and update mask string for patch request url query, for upsert method
- * It will update the PATCH_UPSERT_QUERY_BUFFER static variable
+ * @brief Write the query of a patch request to the query buffer of the client: the projection, the update mask of the fields, and the precondition
+ *
+ * @param[in] keys The fields to be updated. e.g. keys[0] = "Oct21", keys[1] = "Oct22"
+ * @param[in] num_keys The number of keys, at most FIRESTORE_MAX_PATCH_UPSERT_FIELDS are used. 0 for no update mask (overwrite).
+ * @param[in] options The options of the request, or NULL.
+ * @param[in] update_mask The precomputed update mask query (instead of `keys`), or NULL.
+ */
+static esp_err_t set_query_for_patch(firestore_client *client, char **keys, int num_keys, const firestore_request_options_t *options,
+                                     const char *update_mask = NULL)
+{
+    if (num_keys > FIRESTORE_MAX_PATCH_UPSERT_FIELDS)
+    {
+        ESP_LOGW(TAG, "The number of fields exceeds the maximum number of fields allowed");
+        num_keys = FIRESTORE_MAX_PATCH_UPSERT_FIELDS;
+    }
+
+    int offset = 0;
+    client->query_buffer[0] = '\0';
+    esp_err_t result = append_projection_query(client, &offset, options, FIRESTORE_PROJECTION_NONE);
+    if (result == ESP_OK && update_mask != NULL)
+    {
+        int len = snprintf(client->query_buffer + offset, QUERY_BUFFER_SIZE - offset, "&%s", update_mask);
+        if (len >= QUERY_BUFFER_SIZE - offset)
+        {
+            ESP_LOGE(TAG, "The query is too long");
+            return ESP_ERR_INVALID_SIZE;
+        }
+        offset += len;
+    }
+    for (int i = 0; i < num_keys && result == ESP_OK; i++)
+    {
+        result = append_query_param(client, &offset, "updateMask.fieldPaths", keys[i]);
+    }
+    if (result == ESP_OK)
+    {
+        result = append_precondition_query(client, &offset, options);
+    }
+    return result;
+}
+
+/**
+ * @brief get the query of a patch request, for upsert method
+ * It will update the query buffer of the client
  *
  * @param[in] json_data the json string that contains the fields to be updated
  * e.g. "{\"fields\": { \"Oct21\": {\"integerValue\": \"100\"}, \"Oct22\": {\"integerValue\": \"100\"}}"
- * @return void* the update mask string to be used in the patch request url
- * e.g. "updateMask.fieldPaths=Oct21&updateMask.fieldPaths=Oct22"
+ * @param[in] options The options of the request, or NULL.
+ * e.g. the query "mask.fieldPaths=z&updateMask.fieldPaths=Oct21&updateMask.fieldPaths=Oct22"
  */
-void get_query_for_upsert(char *json_data)
+static esp_err_t get_query_for_upsert(firestore_client *client, char *json_data, const firestore_request_options_t *options)
 {
-    char *keys[MAX_PATCH_UPSERT_FIELDS];
+    char *keys[FIRESTORE_MAX_PATCH_UPSERT_FIELDS];
     int num_keys = 0;
 
     cJSON *json_object = cJSON_Parse(json_data);
     extract_keys_from_fields(json_object, keys, &num_keys);
+    esp_err_t result = set_query_for_patch(client, keys, num_keys, options);
+    cJSON_Delete(json_object);
+    return result;
+}
 
-    // put FIRESTORE_DUMMY_RETURN_MASK  in the beginning of the PATCH_UPSERT_QUERY_BUFFER
-    strcpy(PATCH_UPSERT_QUERY_BUFFER, FIRESTORE_DUMMY_RETURN_MASK);
+esp_err_t firestore_patch_at(
+    const firestore_path_t *document,
+    char *data,
+    char *token,
+    firestore_patch_type_t patch_type,
+    const firestore_request_options_t *options)
+{
+    if (document->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", document->rest_path);
+        return ESP_FAIL;
+    }
 
-    int offset = strlen(FIRESTORE_DUMMY_RETURN_MASK);
-    for (int i = 0; i < num_keys; i++)
+    firestore_client *client = request_client_of(document);
+    if (client == NULL)
     {
-        offset += snprintf(PATCH_UPSERT_QUERY_BUFFER + offset, PATCH_UPDATE_MASK_BUFFER_SIZE - offset, "&updateMask.fieldPaths=%s", keys[i]);
+        return ESP_ERR_NO_MEM;
     }
-    PATCH_UPSERT_QUERY_BUFFER[offset] = '\0'; // add null terminator
-    cJSON_Delete(json_object);
+
+    // the projection keeps the whole document from being returned
+    esp_err_t result;
+    if (patch_type != FIRESTORE_DOC_UPSERT)
+    {
+        result = set_query_for_patch(client, NULL, 0, options);
+    }
+    else if (document->query_prefix[0] != '\0')
+    {
+        result = set_query_for_patch(client, NULL, 0, options, document->query_prefix); // the update mask set on the handle
+    }
+    else
+    {
+        result = get_query_for_upsert(client, data, options); // This will update the query buffer of the client
+    }
+    if (result == ESP_OK)
+    {
+        result = make_abstract_firestore_api_request(client, document->rest_path, client->query_buffer, HTTP_METHOD_PATCH, data, token, timeout_of(options));
+        result = check_precondition_failure(client, result, precondition_of(options));
+    }
+    if (result == ESP_OK)
+    {
+        result = give_back_response(client, options);
+    }
+
+    ESP_LOGI(TAG, "Firestore patch request done");
+    return result;
 }
 
 esp_err_t firestore_patch(char *path_to_document, char *data, char *token, firestore_patch_type_t patch_type)
 {
-    if (is_collection_path(path_to_document))
+    firestore_path_t document;
+    if (firestore_document_path_init(&document, path_to_document) != ESP_OK)
     {
-        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", path_to_document);
+        return ESP_FAIL;
+    }
+    return firestore_patch_at(&document, data, token, patch_type, NULL);
+}
 
+esp_err_t firestore_createDocument_stream_at(
+    const firestore_path_t *collection,
+    firestore_body_producer_t producer,
+    void *producer_ctx,
+    int content_length,
+    char *token,
+    const firestore_request_options_t *options)
+{
+    if (!collection->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to collection. The path %s is a document path", collection->rest_path);
         return ESP_FAIL;
     }
 
-    firestore_utils_init();
+    firestore_client *client = request_client_of(collection);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t result = set_query_for_create(client, collection, options);
+    if (result == ESP_OK)
+    {
+        result = make_streaming_firestore_api_request(
+            client, collection->rest_path, client->query_buffer, HTTP_METHOD_POST, producer, producer_ctx, content_length, token, timeout_of(options));
+        result = check_precondition_failure(client, result, FIRESTORE_PRECONDITION_NOT_EXISTS);
+    }
+    if (result == ESP_OK)
+    {
+        result = give_back_response(client, options);
+    }
+    ESP_LOGI(TAG, "Firestore streamed create request done");
+    return result;
+}
 
-    esp_err_t result = ESP_OK;
+esp_err_t firestore_createDocument_stream(
+    char *firebase_path_to_collection,
+    char *document_name,
+    firestore_body_producer_t producer,
+    void *producer_ctx,
+    int content_length,
+    char *token)
+{
+    firestore_path_t collection;
+    if (firestore_collection_path_init(&collection, firebase_path_to_collection, document_name) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return firestore_createDocument_stream_at(&collection, producer, producer_ctx, content_length, token, NULL);
+}
 
-    snprintf(PATH_BUFFER, PATH_BUFFER_SIZE, FIRESTORE_BASE_PATH_FORMAT, path_to_document);
+esp_err_t firestore_patch_stream_at(
+    const firestore_path_t *document,
+    firestore_body_producer_t producer,
+    void *producer_ctx,
+    int content_length,
+    char **update_fields,
+    int num_update_fields,
+    char *token,
+    firestore_patch_type_t patch_type,
+    const firestore_request_options_t *options)
+{
+    if (document->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", document->rest_path);
+        return ESP_FAIL;
+    }
 
-    // the following query parameters prevent whole document from being returned
+    firestore_client *client = request_client_of(document);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
 
-    int update_mask_string_size = 0;
-    if (patch_type == FIRESTORE_DOC_UPSERT)
+    esp_err_t result = patch_type == FIRESTORE_DOC_UPSERT
+                           ? set_query_for_patch(client, update_fields, num_update_fields, options)
+                           : set_query_for_patch(client, NULL, 0, options);
+    if (result == ESP_OK)
     {
-        get_query_for_upsert(data); // This will update the PATCH_UPSERT_QUERY_BUFFER static variable
-        result = make_abstract_firestore_api_request(PATH_BUFFER, PATCH_UPSERT_QUERY_BUFFER, HTTP_METHOD_PATCH, data, token);
+        result = make_streaming_firestore_api_request(
+            client, document->rest_path, client->query_buffer, HTTP_METHOD_PATCH, producer, producer_ctx, content_length, token, timeout_of(options));
+        result = check_precondition_failure(client, result, precondition_of(options));
     }
-    else // patch_type == OVERWRITE
+    if (result == ESP_OK)
     {
-        result = make_abstract_firestore_api_request(PATH_BUFFER, FIRESTORE_DUMMY_RETURN_MASK, HTTP_METHOD_PATCH, data, token);
+        result = give_back_response(client, options);
     }
 
-    ESP_LOGI(TAG, "Firestore patch request done");
-    firestore_utils_cleanup();
+    ESP_LOGI(TAG, "Firestore streamed patch request done");
     return result;
 }
 
+esp_err_t firestore_patch_stream(
+    char *path_to_document,
+    firestore_body_producer_t producer,
+    void *producer_ctx,
+    int content_length,
+    char **update_fields,
+    int num_update_fields,
+    char *token,
+    firestore_patch_type_t patch_type)
+{
+    firestore_path_t document;
+    if (firestore_document_path_init(&document, path_to_document) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return firestore_patch_stream_at(
+        &document, producer, producer_ctx, content_length, update_fields, num_update_fields, token, patch_type, NULL);
+}
+
 /**
  * @brief Extracts a field value from a json string that returned from Firestore API
  * For example "{\"fields\": { \"YOUR_FAVORITE_KEY\": {\"integerValue\": \"1000\"}}}";
@@ -336,29 +1231,39 @@ esp_err_t extract_a_field_value_from_firestore_response(char *json, char *field,
     return ESP_OK;
 }
 
-esp_err_t firestore_get_a_field_value(char *path_to_document, char *field, char *token, char *value)
+esp_err_t firestore_get_a_field_value_at(
+    const firestore_path_t *document,
+    char *field,
+    char *token,
+    char *value,
+    const firestore_request_options_t *options)
 {
 
     esp_err_t result = ESP_OK;
 
     // ensure that the path is a document path
-    if (is_collection_path(path_to_document))
+    if (document->is_collection)
     {
-        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", path_to_document);
+        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", document->rest_path);
         return ESP_FAIL;
     }
 
-    firestore_utils_init();
-
-    snprintf(PATH_BUFFER, PATH_BUFFER_SIZE, FIRESTORE_BASE_PATH_FORMAT, path_to_document);
+    firestore_client *client = request_client_of(document);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
 
     // use mask.fieldPaths=field to get only the field value
-    int query_size = strlen("mask.fieldPaths=") + strlen(field) + 2;
-    char query[query_size];
-    snprintf(query, query_size, "mask.fieldPaths=%s", field);
-    ESP_LOGI(TAG, "query: %s", query);
+    int query_len = 0;
+    if (append_query_param(client, &query_len, "mask.fieldPaths", field) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "The field name %s is too long", field);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "query: %s", client->query_buffer);
 
-    result = make_abstract_firestore_api_request(PATH_BUFFER, query, HTTP_METHOD_GET, NULL, token); // the response body will be stored in RECEIVE_BODY until firestore_utils_cleanup is called
+    result = make_abstract_firestore_api_request(client, document->rest_path, client->query_buffer, HTTP_METHOD_GET, NULL, token, timeout_of(options)); // the response body will be in the receive buffer of the client until its next request
     /**
      * A typical receive_http_body, for example, could be
      * "{\"fields\": { \"Sep30\": {\"integerValue\": \"1000\"}}}";
@@ -366,70 +1271,433 @@ esp_err_t firestore_get_a_field_value(char *path_to_document, char *field, char
     if (result != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to get the response from Firestore API about field %s", field);
-        ESP_LOGE(TAG, "The response body: %s", RECEIVE_BODY);
+        ESP_LOGE(TAG, "The response body: %s", client->receive_body);
+        return result;
+    }
+
+    ESP_LOGD(TAG, "the response body: %s", client->receive_body);
+    ESP_LOGD(TAG, "total received body length: %d", strlen(client->receive_body));
+    result = extract_a_field_value_from_firestore_response(client->receive_body, field, value);
+    if (result == ESP_OK)
+    {
+        result = give_back_response(client, options);
+    }
+    return result;
+}
+
+esp_err_t firestore_get_a_field_value(char *path_to_document, char *field, char *token, char *value)
+{
+    firestore_path_t document;
+    if (firestore_document_path_init(&document, path_to_document) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return firestore_get_a_field_value_at(&document, field, token, value, NULL);
+}
+
+esp_err_t firestore_get_document_at(const firestore_path_t *document, char *token, const firestore_request_options_t *options)
+{
+    if (document->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", document->rest_path);
+        return ESP_FAIL;
+    }
+
+    firestore_client *client = request_client_of(document);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    int query_len = 0;
+    client->query_buffer[0] = '\0';
+    esp_err_t result = append_projection_query(client, &query_len, options, FIRESTORE_PROJECTION_FULL);
+    if (result == ESP_OK)
+    {
+        result = make_abstract_firestore_api_request(client, document->rest_path, client->query_buffer, HTTP_METHOD_GET, NULL, token, timeout_of(options));
+    }
+    if (result == ESP_OK)
+    {
+        result = give_back_response(client, options);
+    }
+    ESP_LOGI(TAG, "Firestore get request done");
+    return result;
+}
+
+esp_err_t firestore_get_document_stream_at(
+    const firestore_path_t *document,
+    firestore_response_consumer_t consumer,
+    void *consumer_ctx,
+    char *token,
+    const firestore_request_options_t *options)
+{
+    if (document->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", document->rest_path);
+        return ESP_FAIL;
+    }
+
+    firestore_client *client = request_client_of(document);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    int query_len = 0;
+    client->query_buffer[0] = '\0';
+    esp_err_t result = append_projection_query(client, &query_len, options, FIRESTORE_PROJECTION_FULL);
+    if (result == ESP_OK)
+    {
+        stream_consumer_t stream = {client, consumer, consumer_ctx};
+        firebase_transport_handler_t handler = {
+            .on_chunk = stream_on_chunk,
+            .on_error = receive_body_on_error,
+            .user_ctx = &stream,
+        };
+        firebase_transport_request_t request = {};
+        request.path = document->rest_path;
+        request.query = client->query_buffer;
+        request.method = HTTP_METHOD_GET;
+        request.timeout_ms = timeout_of(options);
+        result = send_firestore_request(client, &request, token, &handler);
+    }
+    ESP_LOGI(TAG, "Firestore streaming get request done");
+    return result;
+}
+
+esp_err_t firestore_get_document(char *path_to_document, char *token, const firestore_request_options_t *options)
+{
+    firestore_path_t document;
+    if (firestore_document_path_init(&document, path_to_document) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return firestore_get_document_at(&document, token, options);
+}
 
-        firestore_utils_cleanup();
+/**
+ * @brief Get the updateTime of the document, with the smallest response
+ * No field is read (the dummy mask), and the `fields` system parameter of Google APIs (partial response)
+ * leaves only the updateTime in the response, e.g. {"updateTime": "2024-08-05T12:34:56.789012Z"}
+ *
+ * @param[out] update_time The buffer of the updateTime, or NULL to only check the document exists.
+ */
+static esp_err_t request_update_time(const firestore_path_t *document, char *token, char *update_time)
+{
+    if (document->is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to document. The path %s is a collection path", document->rest_path);
         return ESP_FAIL;
     }
 
-    ESP_LOGD(TAG, "the response body: %s", RECEIVE_BODY);
-    ESP_LOGD(TAG, "total received body length: %d", strlen(RECEIVE_BODY));
-    result = extract_a_field_value_from_firestore_response(RECEIVE_BODY, field, value);
+    firestore_client *client = request_client_of(document);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    int query_len = 0;
+    esp_err_t result = append_query_param(client, &query_len, "mask.fieldPaths", FIRESTORE_DUMMY_MASK_FIELD);
+    if (result == ESP_OK)
+    {
+        result = append_query_param(client, &query_len, "fields", "updateTime");
+    }
+    if (result == ESP_OK)
+    {
+        result = make_abstract_firestore_api_request(client, document->rest_path, client->query_buffer, HTTP_METHOD_GET, NULL, token);
+    }
+    if (result == ESP_OK && update_time != NULL)
+    {
+        firestore_request_options_t options = {};
+        options.projection = FIRESTORE_PROJECTION_METADATA;
+        options.update_time = update_time;
+        result = give_back_response(client, &options);
+    }
+    return result;
+}
 
-    firestore_utils_cleanup();
+esp_err_t firestore_document_exists_at(const firestore_path_t *document, char *token, bool *exists)
+{
+    esp_err_t result = request_update_time(document, token, NULL);
+    if (result == ESP_OK || result == ESP_ERR_FIRESTORE_NOT_FOUND)
+    {
+        *exists = result == ESP_OK;
+        return ESP_OK;
+    }
     return result;
 }
 
+esp_err_t firestore_document_exists(char *path_to_document, char *token, bool *exists)
+{
+    firestore_path_t document;
+    if (firestore_document_path_init(&document, path_to_document) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return firestore_document_exists_at(&document, token, exists);
+}
+
+esp_err_t firestore_get_update_time_at(const firestore_path_t *document, char *token, char *update_time)
+{
+    return request_update_time(document, token, update_time);
+}
+
+esp_err_t firestore_get_update_time(char *path_to_document, char *token, char *update_time)
+{
+    firestore_path_t document;
+    if (firestore_document_path_init(&document, path_to_document) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return firestore_get_update_time_at(&document, token, update_time);
+}
+
+/**
+ * @brief Check the aggregations before anything is built for them
+ */
+static esp_err_t check_aggregations(const firestore_aggregation_t *aggregations, int num_aggregations)
+{
+    if (aggregations == NULL || num_aggregations <= 0 || num_aggregations > FIRESTORE_MAX_AGGREGATIONS)
+    {
+        ESP_LOGE(TAG, "A query has 1 to %d aggregations", FIRESTORE_MAX_AGGREGATIONS);
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < num_aggregations; i++)
+    {
+        firestore_aggregation_type_t type = aggregations[i].type;
+        if (type != FIRESTORE_AGGREGATION_COUNT && type != FIRESTORE_AGGREGATION_SUM && type != FIRESTORE_AGGREGATION_AVG)
+        {
+            ESP_LOGE(TAG, "Aggregation %d has an unknown type %d", i, type);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (type != FIRESTORE_AGGREGATION_COUNT && (aggregations[i].field == NULL || aggregations[i].field[0] == '\0'))
+        {
+            ESP_LOGE(TAG, "Aggregation %d (sum or avg) needs the field", i);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+static const char *aggregation_operator_name(firestore_aggregation_type_t type)
+{
+    switch (type)
+    {
+    case FIRESTORE_AGGREGATION_SUM:
+        return "sum";
+    case FIRESTORE_AGGREGATION_AVG:
+        return "avg";
+    default: // FIRESTORE_AGGREGATION_COUNT
+        return "count";
+    }
+}
+
 /**
- * @brief HTTP event handler for Firestore API
+ * @brief Make the body of a runAggregationQuery request, e.g.
+ * {"structuredAggregationQuery": {"structuredQuery": {"from": [{"collectionId": "log"}], "where": {...}},
+ *                                 "aggregations": [{"alias": "a0", "sum": {"field": {"fieldPath": "kwh"}}}]}}
+ * The alias of an aggregation is "a<its index>", so the results are matched back by it.
  *
- * TODO: this is exactly copy-pasted from firebase_auth.cc, I can't find a way to make this a shared function
- * (because there is a static variable `receive_body_len` that is used in the function)
+ * @return The body (free it with cJSON_free), or NULL if `where` is not valid json
  */
-static esp_err_t firestore_http_event_handler(esp_http_client_event_t *client_event)
-{
-
-    switch (client_event->event_id)
-    {
-    case HTTP_EVENT_ERROR:
-        ESP_LOGI(TAG_EVENT_HANDLER, "HTTP error");
-        receive_body_len = 0; // reset the receive body length
-        break;
-    case HTTP_EVENT_ON_CONNECTED:
-        ESP_LOGI(TAG_EVENT_HANDLER, "HTTP connected to server");
-        receive_body_len = 0; // reset the receive body length
-        break;
-    case HTTP_EVENT_HEADERS_SENT:
-        ESP_LOGI(TAG_EVENT_HANDLER, "All HTTP headers are sent to server");
-        break;
-    case HTTP_EVENT_ON_HEADER:
-        ESP_LOGI(TAG_EVENT_HANDLER, "HTTP header received");
-        break;
-    case HTTP_EVENT_ON_DATA: // note that this might be called multiple times because the data might be chunked
-        ESP_LOGI(TAG_EVENT_HANDLER, "HTTP data received, with length: %d", client_event->data_len);
-
-        if (client_event->user_data)
+static char *make_aggregation_query_body(const char *collection_id, const char *where, const firestore_aggregation_t *aggregations, int num_aggregations)
+{
+    cJSON *filter = NULL;
+    if (where != NULL && (filter = cJSON_Parse(where)) == NULL)
+    {
+        ESP_LOGE(TAG, "The filter is not valid json: %s", where);
+        return NULL;
+    }
+
+    cJSON *selector = cJSON_CreateObject();
+    cJSON_AddItemToObject(selector, "collectionId", cJSON_CreateString(collection_id));
+    cJSON *from = cJSON_CreateArray();
+    cJSON_AddItemToArray(from, selector);
+    cJSON *structured_query = cJSON_CreateObject();
+    cJSON_AddItemToObject(structured_query, "from", from);
+    if (filter != NULL)
+    {
+        cJSON_AddItemToObject(structured_query, "where", filter);
+    }
+
+    cJSON *aggregation_list = cJSON_CreateArray();
+    for (int i = 0; i < num_aggregations; i++)
+    {
+        const firestore_aggregation_t *aggregation = &aggregations[i];
+        cJSON *op = cJSON_CreateObject(); // e.g. {"field": {"fieldPath": "kwh"}}, or {"upTo": "1000"} for count
+        if (aggregation->type == FIRESTORE_AGGREGATION_COUNT)
+        {
+            if (aggregation->up_to > 0)
+            {
+                char up_to[24]; // an int64 is sent as a string
+                snprintf(up_to, sizeof(up_to), "%lld", (long long)aggregation->up_to);
+                cJSON_AddItemToObject(op, "upTo", cJSON_CreateString(up_to));
+            }
+        }
+        else
         {
-            strncpy((char *)client_event->user_data + receive_body_len, // destination buffer
-                    (char *)client_event->data,                         // source buffer
-                    client_event->data_len);
-            receive_body_len += client_event->data_len;
+            cJSON *field = cJSON_CreateObject();
+            cJSON_AddItemToObject(field, "fieldPath", cJSON_CreateString(aggregation->field));
+            cJSON_AddItemToObject(op, "field", field);
         }
 
-        break;
-    case HTTP_EVENT_ON_FINISH:
-        ESP_LOGI(TAG_EVENT_HANDLER, "HTTP session is finished");
-        *((char *)client_event->user_data + receive_body_len) = '\0'; // write the null terminator to the buffer
-        receive_body_len = 0;                                         // reset the receive body length
-        break;
-    case HTTP_EVENT_DISCONNECTED:
-        ESP_LOGI(TAG_EVENT_HANDLER, "HTTP connection is closed");
-        receive_body_len = 0; // reset the receive body length
-        break;
-    case HTTP_EVENT_REDIRECT:
-        ESP_LOGI(TAG_EVENT_HANDLER, "HTTP redirect");
-        receive_body_len = 0; // reset the receive body length
-        break;
+        char alias[12];
+        snprintf(alias, sizeof(alias), "a%d", i);
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToObject(item, "alias", cJSON_CreateString(alias));
+        cJSON_AddItemToObject(item, aggregation_operator_name(aggregation->type), op);
+        cJSON_AddItemToArray(aggregation_list, item);
+    }
+
+    cJSON *aggregation_query = cJSON_CreateObject();
+    cJSON_AddItemToObject(aggregation_query, "structuredQuery", structured_query);
+    cJSON_AddItemToObject(aggregation_query, "aggregations", aggregation_list);
+    cJSON *body = cJSON_CreateObject();
+    cJSON_AddItemToObject(body, "structuredAggregationQuery", aggregation_query);
+    char *printed = cJSON_PrintUnformatted(body);
+    cJSON_Delete(body);
+    return printed;
+}
+
+/**
+ * @brief Decode a Firestore value into a number, e.g. {"integerValue": "1234"}, {"doubleValue": 12.5} or {"nullValue": null}
+ */
+static esp_err_t decode_number(const cJSON *value, firestore_number_t *number)
+{
+    cJSON *integer_value = cJSON_GetObjectItem(value, "integerValue");
+    cJSON *double_value = cJSON_GetObjectItem(value, "doubleValue");
+    number->type = FIRESTORE_NUMBER_NULL;
+    number->integer_value = 0;
+    number->double_value = 0;
+    if (cJSON_IsString(integer_value))
+    {
+        // parsed from the string, as a double can't hold every int64
+        char *end = NULL;
+        errno = 0;
+        number->integer_value = strtoll(integer_value->valuestring, &end, 10);
+        if (errno != 0 || end == integer_value->valuestring || *end != '\0')
+        {
+            ESP_LOGE(TAG, "The integer %s is not valid", integer_value->valuestring);
+            return ESP_FAIL;
+        }
+        number->type = FIRESTORE_NUMBER_INTEGER;
+    }
+    else if (cJSON_IsNumber(double_value))
+    {
+        number->double_value = double_value->valuedouble;
+        number->type = FIRESTORE_NUMBER_DOUBLE;
+    }
+    else if (cJSON_IsString(double_value)) // "NaN", "Infinity" or "-Infinity"
+    {
+        number->double_value = strtod(double_value->valuestring, NULL);
+        number->type = FIRESTORE_NUMBER_DOUBLE;
+    }
+    else if (cJSON_GetObjectItem(value, "nullValue") == NULL)
+    {
+        ESP_LOGE(TAG, "The aggregation result is not a number");
+        return ESP_FAIL;
     }
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Get the results of the aggregations from the response in the receive buffer of the client, e.g.
+ * [{"result": {"aggregateFields": {"a0": {"integerValue": "31"}, "a1": {"doubleValue": 12.5}}}, "readTime": "..."}]
+ */
+static esp_err_t parse_aggregation_response(const firestore_client *client, int num_aggregations, firestore_number_t *results)
+{
+    if (client->receive_body_truncated)
+    {
+        ESP_LOGE(TAG, "The response is longer than the receive buffer (%d bytes)", RECEIVE_BUF_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    cJSON *root = cJSON_Parse(client->receive_body);
+    cJSON *aggregate_fields = NULL;
+    cJSON *element = NULL;
+    cJSON_ArrayForEach(element, root) // the response is a stream of messages, one of them has the result
+    {
+        cJSON *result = cJSON_GetObjectItem(element, "result");
+        if (result != NULL)
+        {
+            aggregate_fields = cJSON_GetObjectItem(result, "aggregateFields");
+            break;
+        }
+    }
+    if (aggregate_fields == NULL)
+    {
+        ESP_LOGE(TAG, "The response has no aggregation result: %s", client->receive_body);
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    esp_err_t result = ESP_OK;
+    for (int i = 0; i < num_aggregations && result == ESP_OK; i++)
+    {
+        char alias[12];
+        snprintf(alias, sizeof(alias), "a%d", i);
+        result = decode_number(cJSON_GetObjectItem(aggregate_fields, alias), &results[i]);
+    }
+    cJSON_Delete(root);
+    return result;
+}
+
+esp_err_t firestore_client_run_aggregation_query(
+    firestore_client_handle_t client,
+    const char *path_to_collection,
+    const char *where,
+    const firestore_aggregation_t *aggregations,
+    int num_aggregations,
+    char *token,
+    firestore_number_t *results)
+{
+    esp_err_t result = check_aggregations(aggregations, num_aggregations);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    firestore_path_t collection;
+    if (init_path_handle(client, &collection, path_to_collection) != ESP_OK || !collection.is_collection)
+    {
+        ESP_LOGE(TAG, "Invalid path to collection %s", path_to_collection ? path_to_collection : "(null)");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // the query is run in the parent of the collection (a document, or the root): ".../documents/col1/doc1:runAggregationQuery"
+    static const char QUERY_METHOD[] = ":runAggregationQuery";
+    char *collection_id_start = strrchr(collection.rest_path, '/');
+    if ((collection_id_start - collection.rest_path) + (int)sizeof(QUERY_METHOD) > FIRESTORE_PATH_MAX_LEN)
+    {
+        ESP_LOGE(TAG, "The path %s is too long", path_to_collection);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const char *collection_id = strrchr(path_to_collection, '/');
+    collection_id = collection_id != NULL ? collection_id + 1 : path_to_collection;
+    firestore_client *request_client = request_client_of(&collection);
+    if (request_client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    char *body = make_aggregation_query_body(collection_id, where, aggregations, num_aggregations);
+    if (body == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(collection_id_start, QUERY_METHOD);
+
+    result = make_abstract_firestore_api_request(request_client, collection.rest_path, NULL, HTTP_METHOD_POST, body, token);
+    if (result == ESP_OK)
+    {
+        result = parse_aggregation_response(request_client, num_aggregations, results);
+    }
+    ESP_LOGI(TAG, "Firestore aggregation query done");
+    cJSON_free(body);
+    return result;
+}
+
+esp_err_t firestore_run_aggregation_query(
+    const char *path_to_collection,
+    const char *where,
+    const firestore_aggregation_t *aggregations,
+    int num_aggregations,
+    char *token,
+    firestore_number_t *results)
+{
+    return firestore_client_run_aggregation_query(NULL, path_to_collection, where, aggregations, num_aggregations, token, results);
+}
@@ -9,10 +9,24 @@ extern "C"
 #include <stdint.h>
 #include "esp_err.h"
 #include <stdbool.h>
+#include "firebase_transport.h"
 
 #define FIRESTORE_DB_ROOT CONFIG_FIRESTORE_DB_ROOT
 #define FIREBASE_PROJECT_ID CONFIG_FIREBASE_PROJECT_ID
 
+#define FIRESTORE_HOSTNAME "firestore.googleapis.com"
+#define FIRESTORE_BASE_PATH_FORMAT "/v1/projects/" FIREBASE_PROJECT_ID "/" FIRESTORE_DB_ROOT "/%s"
+
+#define FIRESTORE_MAX_PATCH_UPSERT_FIELDS 5  // the max number of fields a FIRESTORE_DOC_UPSERT patch can update (to keep the query short)
+#define FIRESTORE_PATH_MAX_LEN 256           // the max length of the (formatted and URL-escaped) REST path of a `firestore_path_t`
+#define FIRESTORE_PATH_QUERY_MAX_LEN 192     // the max length of the precomputed query of a `firestore_path_t`
+#define FIRESTORE_TIMESTAMP_MAX_LEN 40       // the size of a buffer that holds a timestamp, e.g. "2024-08-05T12:34:56.789012Z"
+#define FIRESTORE_HOST_MAX_LEN 128           // the max length of the host of a client
+
+#define ESP_ERR_FIRESTORE_BASE 0xF000
+#define ESP_ERR_FIRESTORE_NOT_FOUND (ESP_ERR_FIRESTORE_BASE + 1)              // the document (or its parent, for create) does not exist (HTTP 404)
+#define ESP_ERR_FIRESTORE_PRECONDITION_FAILED (ESP_ERR_FIRESTORE_BASE + 2)    // the precondition of the write is not met, nothing is written
+
     // create an enum for patch type: OVERWRITE_ENTIRE_DOCUMENT, UPSET_DOCUMENT
     typedef enum
     {
@@ -20,6 +34,199 @@ extern "C"
         FIRESTORE_DOC_UPSERT     // this will update the keys if they exist, and insert them if they do not exist (the use of `updateMask`)
     } firestore_patch_type_t;
 
+    /**
+     * What a request asks Firestore to send back.
+     * Note that Firestore always sends the metadata (name, createTime and updateTime) of the document.
+     */
+    typedef enum
+    {
+        FIRESTORE_PROJECTION_NONE,     // no fields (mask.fieldPaths=z), and the response is not given back to the caller (only the updateTime, if asked)
+        FIRESTORE_PROJECTION_METADATA, // no fields (mask.fieldPaths=z), the metadata is given back
+        FIRESTORE_PROJECTION_FIELDS,   // only the fields in `fields` (mask.fieldPaths=<field>...)
+        FIRESTORE_PROJECTION_FULL      // the whole document
+    } firestore_projection_t;
+
+    /**
+     * The condition on the current document a write is done under (`currentDocument` of the REST API).
+     * If it is not met, the write fails with ESP_ERR_FIRESTORE_PRECONDITION_FAILED and nothing is written,
+     * so e.g. a read-modify-write is done in one request: write with the updateTime that was read.
+     */
+    typedef enum
+    {
+        FIRESTORE_PRECONDITION_NONE,
+        FIRESTORE_PRECONDITION_EXISTS,     // the document has to exist (currentDocument.exists=true)
+        FIRESTORE_PRECONDITION_NOT_EXISTS, // the document must not exist (currentDocument.exists=false)
+        FIRESTORE_PRECONDITION_UPDATE_TIME // the document has to be last updated at `precondition_update_time` (currentDocument.updateTime)
+    } firestore_precondition_t;
+
+    /**
+     * Per-call options of the `_at` functions, NULL means the defaults:
+     * FIRESTORE_PROJECTION_NONE for create and patch, FIRESTORE_PROJECTION_FULL for `firestore_get_document_at`.
+     * The response has to fit in the receive buffer (4 KB), use a projection to keep it small.
+     */
+    typedef struct
+    {
+        firestore_projection_t projection;
+        const char **fields;  // the field paths for FIRESTORE_PROJECTION_FIELDS, e.g. {"Aug05", "status.battery"}
+        int num_fields;
+        char *response;       // [out] if not NULL, the response (the projected document json) is copied here
+        int response_size;    // the size of `response`
+        char *update_time;    // [out] if not NULL, the updateTime of the document is copied here (FIRESTORE_TIMESTAMP_MAX_LEN bytes)
+        firestore_precondition_t precondition;  // for patch (create always has FIRESTORE_PRECONDITION_NOT_EXISTS)
+        const char *precondition_update_time;   // for FIRESTORE_PRECONDITION_UPDATE_TIME, e.g. the `update_time` of the last read or write
+        int timeout_ms;                         // if not 0, the timeout of this request instead of the one of the client
+                                                // (with esp_http_client, of each socket operation, not of the whole request)
+    } firestore_request_options_t;
+
+    /**
+     * A Firestore client: the project, database and host the requests go to, formatted once when it is created,
+     * with its own transport, request timeout, last response code and buffers, and optionally its own ID token.
+     * The clients share nothing, so e.g. one task can write to a project while another reads a named database of another one.
+     * A client is used by one task at a time.
+     * NULL is the default client, of the menuconfig options (CONFIG_FIREBASE_PROJECT_ID and CONFIG_FIRESTORE_DB_ROOT),
+     * which the functions without a client use. It is set up by its first use (from any task), and after that,
+     * like the other clients, it is used by one task at a time.
+     */
+    typedef struct firestore_client *firestore_client_handle_t;
+
+    typedef struct
+    {
+        const char *project_id;  // e.g. "my-project"
+        const char *database_id; // e.g. "telemetry" for a named database, NULL for "(default)"
+        const char *host;        // NULL for FIRESTORE_HOSTNAME, e.g. the host of a regional endpoint
+        const char *api_key;     // the Web API key of the project, for the token requests. NULL for CONFIG_FIREBASE_API_KEY
+        const char *refresh_token; // if not NULL, the client manages its ID token: the requests given a NULL token use it,
+                                   // and it is refreshed (with this refresh token) shortly before it expires
+        const firebase_transport_t *transport;      // NULL for the default (TLS to `host`)
+        const firebase_transport_t *auth_transport; // the transport of the token requests, NULL for the one of `firebase_auth_set_transport`
+    } firestore_client_config_t;
+
+    /**
+     * A Firestore path that is validated, URL-escaped and formatted into the REST path once,
+     * so it can be used by many requests without paying for it every time.
+     * Create it with `firestore_document_path_init` or `firestore_collection_path_init`,
+     * or with the `firestore_client_` ones for the requests of a client.
+     */
+    typedef struct
+    {
+        char rest_path[FIRESTORE_PATH_MAX_LEN];          // e.g. "/v1/projects/<id>/databases/(default)/documents/col1/doc1"
+        char query_prefix[FIRESTORE_PATH_QUERY_MAX_LEN]; // the precomputed query, e.g. "documentId=doc2" for a collection path,
+                                                         // or the update mask of a document path (see `firestore_document_path_set_update_mask`)
+        bool is_collection;
+        firestore_client_handle_t client; // the client the requests of the path are made with, NULL for the default client
+    } firestore_path_t;
+
+    /**
+     * @brief Make a handle of a document path, that can be used by `firestore_patch_at` and `firestore_get_a_field_value_at`
+     *
+     * @param[out] handle The handle to initialize.
+     * @param[in] path_to_document The path to the document in Firestore. e.g. "col1/doc1" or "col1/doc1/subcol2/doc2"
+     * @return ESP_ERR_INVALID_ARG if the path is not a valid document path, ESP_ERR_INVALID_SIZE if it is too long.
+     */
+    esp_err_t firestore_document_path_init(firestore_path_t *handle, const char *path_to_document);
+
+    /**
+     * @brief Set the fields the FIRESTORE_DOC_UPSERT patches of a document handle update, so `firestore_patch_at`
+     * uses this precomputed update mask instead of parsing the data of every call to find its fields.
+     * The data of the patches must have these fields (the fields of the data that are not in the mask are not written,
+     * and the fields of the mask that are not in the data are deleted).
+     *
+     * e.g.
+     * const char *fields[] = {"Aug05", "Aug06"};
+     * firestore_document_path_set_update_mask(&log_doc, fields, 2);
+     *
+     * @param[in,out] handle The document handle.
+     * @param[in] fields The field paths, e.g. {"Aug05", "status.battery"}. NULL to clear the mask (the fields are taken from the data again).
+     * @param[in] num_fields The number of `fields`, at most FIRESTORE_MAX_PATCH_UPSERT_FIELDS.
+     * @return ESP_ERR_INVALID_ARG if the handle is a collection handle, ESP_ERR_INVALID_SIZE if there are too many fields,
+     * or the mask is longer than FIRESTORE_PATH_QUERY_MAX_LEN (then the mask is cleared).
+     */
+    esp_err_t firestore_document_path_set_update_mask(firestore_path_t *handle, const char **fields, int num_fields);
+
+    /**
+     * @brief Make a handle of a collection path and the name of a document to create in it, that can be used by `firestore_createDocument_at`
+     *
+     * @param[out] handle The handle to initialize.
+     * @param[in] path_to_collection The path to the collection in Firestore. e.g. "col1", or "col1/doc1/subcol1"
+     * @param[in] document_name The name of the document to create.
+     * @return ESP_ERR_INVALID_ARG if the path is not a valid collection path, ESP_ERR_INVALID_SIZE if it is too long.
+     */
+    esp_err_t firestore_collection_path_init(firestore_path_t *handle, const char *path_to_collection, const char *document_name);
+
+    /**
+     * @brief Set the timeout of the following requests of the default client (for connecting, sending and receiving)
+     *
+     * @param[in] timeout_ms The timeout in ms, or 0 to use the default timeout of esp_http_client.
+     */
+    void firestore_set_request_timeout_ms(int timeout_ms);
+
+    /**
+     * @brief Set the transport of the following requests of the default client, e.g. a plain HTTP one to the Firestore emulator,
+     * or a loopback one (see firebase_transport.h)
+     *
+     * @param[in] transport The transport, it has to stay valid as long as it is used. NULL for the default (TLS to Firestore).
+     */
+    void firestore_set_transport(const firebase_transport_t *transport);
+
+    /**
+     * @brief Create a client (see `firestore_client_handle_t`)
+     * e.g. a named database of another project, that manages its own ID token:
+     * firestore_client_config_t config = {};
+     * config.project_id = "other-project";
+     * config.database_id = "telemetry";
+     * config.api_key = OTHER_PROJECT_API_KEY;
+     * config.refresh_token = other_refresh_token;
+     * firestore_client_create(&config, &client);
+     *
+     * @param[in] config The config, the strings are copied.
+     * @param[out] client The client, destroy it with `firestore_client_destroy`.
+     * @return ESP_ERR_INVALID_ARG if there is no project ID, ESP_ERR_INVALID_SIZE if a string is too long, ESP_ERR_NO_MEM.
+     */
+    esp_err_t firestore_client_create(const firestore_client_config_t *config, firestore_client_handle_t *client);
+
+    /**
+     * @brief Destroy a client, the paths made for it can't be used anymore
+     */
+    void firestore_client_destroy(firestore_client_handle_t client);
+
+    /**
+     * @brief Same as `firestore_document_path_init` and `firestore_collection_path_init`, but the requests of the path
+     * are made with `client` (NULL for the default client)
+     */
+    esp_err_t firestore_client_document_path_init(firestore_client_handle_t client, firestore_path_t *handle, const char *path_to_document);
+
+    esp_err_t firestore_client_collection_path_init(
+        firestore_client_handle_t client,
+        firestore_path_t *handle,
+        const char *path_to_collection,
+        const char *document_name);
+
+    /**
+     * @brief Same as `firestore_set_request_timeout_ms`, for the requests of `client` (NULL for the default client)
+     */
+    void firestore_client_set_request_timeout_ms(firestore_client_handle_t client, int timeout_ms);
+
+    /**
+     * @brief Get the ID token the client manages, refreshed if it is about to expire, e.g. for the requests of the
+     * functions without a client, or of the Realtime Database
+     *
+     * @param[in] client A client with a refresh token.
+     * @param[out] token The ID token.
+     * @param[in] token_size The size of `token`, usually 1024.
+     * @return ESP_ERR_INVALID_STATE if the client has no refresh token, ESP_ERR_INVALID_SIZE if the token doesn't fit.
+     */
+    esp_err_t firestore_client_get_token(firestore_client_handle_t client, char *token, int token_size);
+
+    /**
+     * @brief Get the host of the client, e.g. "firestore.googleapis.com"
+     */
+    const char *firestore_client_get_host(firestore_client_handle_t client);
+
+    /**
+     * @brief Get the REST path of the documents of the client, e.g. "/v1/projects/<id>/databases/(default)/documents/"
+     */
+    const char *firestore_client_get_base_path(firestore_client_handle_t client);
+
     /**
      * @brief Create a document in Firestore
      * https://firebase.google.com/docs/firestore/reference/rest/v1beta1/projects.databases.documents/createDocument#query-parameters
@@ -53,6 +260,49 @@ extern "C"
      */
     esp_err_t firestore_patch(char *path_to_document, char *data, char *token, firestore_patch_type_t patch_type);
 
+    /**
+     * @brief Same as `firestore_createDocument`, but the body is streamed from `producer` piece by piece,
+     * so the document never has to be held in RAM as a whole.
+     *
+     * @param[in] path_to_collection The path to the collection in Firestore. e.g. "col1", or "col1/doc1/subcol1"
+     * @param[in] document_name The name of the document to create.
+     * @param[in] producer The producer of the body (a Firestore Document json).
+     * @param[in] producer_ctx Passed to `producer`.
+     * @param[in] content_length The total length of the body, or -1 if it is unknown (then chunked transfer encoding is used).
+     * @param[in] token The token to authenticate the request.
+     */
+    esp_err_t firestore_createDocument_stream(
+        char *path_to_collection,
+        char *document_name,
+        firestore_body_producer_t producer,
+        void *producer_ctx,
+        int content_length,
+        char *token);
+
+    /**
+     * @brief Same as `firestore_patch`, but the body is streamed from `producer` piece by piece,
+     * so the document never has to be held in RAM as a whole.
+     *
+     * @param[in] path_to_document The path to the document in Firestore. e.g. "col1/doc1" or "col1/doc1/subcol2/doc2"
+     * @param[in] producer The producer of the body (a Firestore Document json).
+     * @param[in] producer_ctx Passed to `producer`.
+     * @param[in] content_length The total length of the body, or -1 if it is unknown (then chunked transfer encoding is used).
+     * @param[in] update_fields The fields to be updated, only used by FIRESTORE_DOC_UPSERT.
+     * Since the body is not parsed, this has to be given. e.g. {"Oct21", "Oct22"}
+     * @param[in] num_update_fields The number of `update_fields`.
+     * @param[in] token The token to authenticate the request.
+     * @param[in] patch_type The type of patch to be done.
+     */
+    esp_err_t firestore_patch_stream(
+        char *path_to_document,
+        firestore_body_producer_t producer,
+        void *producer_ctx,
+        int content_length,
+        char **update_fields,
+        int num_update_fields,
+        char *token,
+        firestore_patch_type_t patch_type);
+
     /**
      * @brief Get a field value from a document in Firestore
      * https://firebase.google.com/docs/firestore/reference/rest/v1beta1/projects.databases.documents/get
@@ -70,6 +320,197 @@ extern "C"
      */
     esp_err_t firestore_get_a_field_value(char *path_to_document, char *field, char *token, char *value);
 
+    /**
+     * @brief Get a document (or the projection of it) from Firestore
+     * https://firebase.google.com/docs/firestore/reference/rest/v1/projects.databases.documents/get
+     *
+     * @param[in] path_to_document The path to the document in Firestore. e.g. "col1/doc1"
+     * @param[in] token The token to authenticate the request.
+     * @param[in] options The projection, and the buffers the response and updateTime are copied to.
+     * @return ESP_ERR_FIRESTORE_NOT_FOUND if the document does not exist,
+     * ESP_ERR_INVALID_SIZE if the response does not fit in `options->response`.
+     */
+    esp_err_t firestore_get_document(char *path_to_document, char *token, const firestore_request_options_t *options);
+
+    /**
+     * @brief Consumer of a streamed response body, it is called with the pieces of the body in order
+     */
+    typedef void (*firestore_response_consumer_t)(const char *data, int len, void *user_ctx);
+
+    /**
+     * @brief Same as `firestore_get_document_at`, but the response body is given to `consumer` piece by piece,
+     * so the document doesn't have to fit in the receive buffer. Only the projection of `options` is used.
+     * Note that the body of a failed request (e.g. the error of a 404) is given to the consumer too.
+     *
+     * @param[in] document The document path handle.
+     * @param[in] consumer The consumer of the response body.
+     * @param[in] consumer_ctx Passed to `consumer`.
+     * @param[in] token The token to authenticate the request.
+     * @param[in] options The projection, NULL for the whole document.
+     * @return ESP_ERR_FIRESTORE_NOT_FOUND if the document does not exist.
+     */
+    esp_err_t firestore_get_document_stream_at(
+        const firestore_path_t *document,
+        firestore_response_consumer_t consumer,
+        void *consumer_ctx,
+        char *token,
+        const firestore_request_options_t *options);
+
+    /**
+     * @brief Check if a document exists. Only the updateTime of the document is downloaded.
+     *
+     * @param[in] path_to_document The path to the document in Firestore. e.g. "col1/doc1"
+     * @param[in] token The token to authenticate the request.
+     * @param[out] exists Whether the document exists.
+     * @return ESP_OK if `exists` is set.
+     */
+    esp_err_t firestore_document_exists(char *path_to_document, char *token, bool *exists);
+
+    /**
+     * @brief Get the updateTime of a document. Only the updateTime is downloaded.
+     *
+     * @param[in] path_to_document The path to the document in Firestore. e.g. "col1/doc1"
+     * @param[in] token The token to authenticate the request.
+     * @param[out] update_time The buffer of the timestamp (FIRESTORE_TIMESTAMP_MAX_LEN bytes). e.g. "2024-08-05T12:34:56.789012Z"
+     * @return ESP_ERR_FIRESTORE_NOT_FOUND if the document does not exist.
+     */
+    esp_err_t firestore_get_update_time(char *path_to_document, char *token, char *update_time);
+
+    typedef enum
+    {
+        FIRESTORE_AGGREGATION_COUNT, // the number of documents (an integer)
+        FIRESTORE_AGGREGATION_SUM,   // the sum of the numbers in `field`: an integer if all of them are integers and it doesn't overflow, otherwise a double
+        FIRESTORE_AGGREGATION_AVG    // the average of the numbers in `field` (a double), or null if there is none
+    } firestore_aggregation_type_t;
+
+    typedef struct
+    {
+        firestore_aggregation_type_t type;
+        const char *field; // the field path of sum and avg, e.g. "kwh" or "usage.kwh". Documents without a number there are skipped.
+        int64_t up_to;     // for count, stop counting at this many documents (0 for no limit), to bound the cost of the query
+    } firestore_aggregation_t;
+
+    typedef enum
+    {
+        FIRESTORE_NUMBER_NULL,
+        FIRESTORE_NUMBER_INTEGER,
+        FIRESTORE_NUMBER_DOUBLE
+    } firestore_number_type_t;
+
+    /**
+     * A number decoded without loss from a Firestore value:
+     * integerValue (an int64 sent as a string) into `integer_value`, doubleValue into `double_value`.
+     */
+    typedef struct
+    {
+        firestore_number_type_t type;
+        int64_t integer_value;
+        double double_value;
+    } firestore_number_t;
+
+    /**
+     * @brief Count, sum or average the documents of a collection on the server, without downloading them
+     * https://firebase.google.com/docs/firestore/reference/rest/v1/projects.databases.documents/runAggregationQuery
+     * e.g. the usage of this month, summed over the daily documents of "dev/develop/devices/dev1/log":
+     * firestore_aggregation_t sum = {FIRESTORE_AGGREGATION_SUM, "kwh", 0};
+     * firestore_number_t total;
+     * firestore_run_aggregation_query("dev/develop/devices/dev1/log", NULL, &sum, 1, token, &total);
+     * Note that Firestore bills one read per (up to) 1000 documents aggregated.
+     *
+     * @param[in] path_to_collection The path to the collection in Firestore. e.g. "col1", or "col1/doc1/subcol1"
+     * @param[in] where The filter of the documents, the `where` (a Filter json) of the structured query, or NULL for all of them.
+     * e.g. "{\"fieldFilter\": {\"field\": {\"fieldPath\": \"month\"}, \"op\": \"EQUAL\", \"value\": {\"stringValue\": \"2024-08\"}}}"
+     * See https://firebase.google.com/docs/firestore/reference/rest/v1/StructuredQuery#Filter
+     * @param[in] aggregations The aggregations, at most FIRESTORE_MAX_AGGREGATIONS.
+     * @param[in] num_aggregations The number of `aggregations`.
+     * @param[in] token The token to authenticate the request.
+     * @param[out] results The result of each aggregation, in the same order (`num_aggregations` of them).
+     * @return ESP_ERR_INVALID_ARG if the path, the filter or an aggregation is not valid.
+     */
+    esp_err_t firestore_run_aggregation_query(
+        const char *path_to_collection,
+        const char *where,
+        const firestore_aggregation_t *aggregations,
+        int num_aggregations,
+        char *token,
+        firestore_number_t *results);
+
+    /**
+     * @brief Same as `firestore_run_aggregation_query`, in the database of `client` (NULL for the default client)
+     */
+    esp_err_t firestore_client_run_aggregation_query(
+        firestore_client_handle_t client,
+        const char *path_to_collection,
+        const char *where,
+        const firestore_aggregation_t *aggregations,
+        int num_aggregations,
+        char *token,
+        firestore_number_t *results);
+
+#define FIRESTORE_MAX_AGGREGATIONS 5 // the max number of aggregations in one query (a Firestore limit)
+
+    /**
+     * @brief Get the HTTP status code of the last Firestore request (of the default client), or 0 if it got no response
+     */
+    int firestore_get_last_response_code(void);
+
+    /**
+     * @brief Get the HTTP status code of the last request of `client` (NULL for the default client), or 0 if it got no response
+     */
+    int firestore_client_get_last_response_code(firestore_client_handle_t client);
+
+    /**
+     * The following functions are the same as the ones above, but take a path handle (see `firestore_path_t`)
+     * instead of a path string, so the path is not validated and formatted again on each call,
+     * and the per-call `options` (can be NULL). The request is made with the client of the handle.
+     * For `firestore_get_a_field_value_at`, the projection of `options` is ignored (only `field` is requested).
+     * A write whose precondition is not met returns ESP_ERR_FIRESTORE_PRECONDITION_FAILED,
+     * and so does `firestore_createDocument_at` if the document already exists.
+     */
+    esp_err_t firestore_createDocument_at(
+        const firestore_path_t *collection,
+        char *data,
+        char *token,
+        const firestore_request_options_t *options);
+
+    esp_err_t firestore_createDocument_stream_at(
+        const firestore_path_t *collection,
+        firestore_body_producer_t producer,
+        void *producer_ctx,
+        int content_length,
+        char *token,
+        const firestore_request_options_t *options);
+
+    esp_err_t firestore_patch_at(
+        const firestore_path_t *document,
+        char *data,
+        char *token,
+        firestore_patch_type_t patch_type,
+        const firestore_request_options_t *options);
+
+    esp_err_t firestore_patch_stream_at(
+        const firestore_path_t *document,
+        firestore_body_producer_t producer,
+        void *producer_ctx,
+        int content_length,
+        char **update_fields,
+        int num_update_fields,
+        char *token,
+        firestore_patch_type_t patch_type,
+        const firestore_request_options_t *options);
+
+    esp_err_t firestore_get_a_field_value_at(
+        const firestore_path_t *document,
+        char *field,
+        char *token,
+        char *value,
+        const firestore_request_options_t *options);
+
+    esp_err_t firestore_get_document_at(const firestore_path_t *document, char *token, const firestore_request_options_t *options);
+
+    esp_err_t firestore_document_exists_at(const firestore_path_t *document, char *token, bool *exists);
+
+    esp_err_t firestore_get_update_time_at(const firestore_path_t *document, char *token, char *update_time);
 
 #ifdef __cplusplus
 }
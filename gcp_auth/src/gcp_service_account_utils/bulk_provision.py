@@ -0,0 +1,272 @@
+"""
+Bulk provisioning of per-device refresh tokens
+
+For every device ID in a CSV, a custom token is minted (locally, signed with the service account key)
+and exchanged for a refresh token by the Identity Toolkit API. The devices are provisioned by a bounded
+pool of workers, the exchange requests are rate limited and sent over pooled connections, and every
+finished device is appended to a checkpoint file, so an interrupted run resumes where it stopped.
+
+The HTTP layer is injectable (anything with `post_json(url, payload) -> (status, dict)`), so the
+provisioning can be run offline against a local stub, or against the Firebase Auth emulator with `endpoint`.
+"""
+import csv
+import json
+import os
+import re
+import subprocess
+import sys
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor, as_completed
+from dataclasses import dataclass, field
+from typing import Callable, Dict, List, Optional, Tuple
+
+import urllib3
+
+SIGN_IN_WITH_CUSTOM_TOKEN_ENDPOINT = 'https://identitytoolkit.googleapis.com/v1/accounts:signInWithCustomToken'
+
+# the NVS entries read by the firmware, see README.md
+NVS_NAMESPACE = 'firebase'
+NVS_REFRESH_TOKEN_KEY = 'refresh_token'
+NVS_DEVICE_ID_KEY = 'device_id'
+DEFAULT_NVS_PARTITION_SIZE = '0x6000'
+
+# responses that are worth retrying
+RETRYABLE_STATUS = {429, 500, 502, 503, 504}
+
+# a device ID names the files of its NVS image, so it is limited to characters that are safe in a file name
+DEVICE_ID_PATTERN = re.compile(r'[A-Za-z0-9_-]+')
+
+
+class Urllib3Transport:
+    """
+    The default HTTP layer: one urllib3 pool, with a connection per worker, shared by all the workers.
+    """
+
+    def __init__(self, max_connections: int):
+        self.http = urllib3.PoolManager(maxsize=max_connections, block=True, retries=False)
+
+    def post_json(self, url: str, payload: dict) -> Tuple[int, dict]:
+        data = json.dumps(payload)
+        response = self.http.request(
+            method='POST',
+            url=url,
+            body=data,
+            headers={'Content-Type': 'application/json', 'Content-Length': str(len(data))},
+        )
+        try:
+            return response.status, json.loads(response.data)
+        except ValueError:
+            return response.status, {}
+
+
+class RateLimiter:
+    """
+    Spaces the calls to `wait` at least 1 / rate_per_s apart, across all the threads.
+    """
+
+    def __init__(self, rate_per_s: float):
+        self.interval = 1.0 / rate_per_s if rate_per_s > 0 else 0
+        self.next_time = time.monotonic()
+        self.lock = threading.Lock()
+
+    def wait(self):
+        if self.interval == 0:
+            return
+        with self.lock:
+            now = time.monotonic()
+            slot = max(self.next_time, now)
+            self.next_time = slot + self.interval
+        time.sleep(max(0.0, slot - now))
+
+
+@dataclass
+class ProvisionReport:
+    provisioned: int = 0
+    skipped: int = 0  # already in the checkpoint
+    failed: Dict[str, str] = field(default_factory=dict)  # device ID -> error
+    exchange_requests: int = 0
+    elapsed_s: float = 0.0
+    latencies_s: List[float] = field(default_factory=list)
+
+    def summary(self) -> str:
+        throughput = self.provisioned / self.elapsed_s if self.elapsed_s > 0 else 0
+        latencies = sorted(self.latencies_s)
+        p50 = latencies[len(latencies) // 2] if latencies else 0
+        p95 = latencies[min(len(latencies) - 1, int(len(latencies) * 0.95))] if latencies else 0
+        return (
+            f'provisioned: {self.provisioned}, skipped (checkpoint): {self.skipped}, failed: {len(self.failed)}\n'
+            f'elapsed: {self.elapsed_s:.1f} s, throughput: {throughput:.1f} devices/s, '
+            f'exchange requests: {self.exchange_requests}\n'
+            f'per-device latency: p50 {p50 * 1000:.0f} ms, p95 {p95 * 1000:.0f} ms'
+        )
+
+
+def check_device_ids(device_ids: List[str]):
+    """
+    Raise ValueError if any of the device IDs is not made of letters, digits, `_` and `-` only.
+    """
+    invalid = [device_id for device_id in device_ids if not DEVICE_ID_PATTERN.fullmatch(device_id)]
+    if invalid:
+        raise ValueError(f'invalid device IDs (only A-Z, a-z, 0-9, _ and - are allowed): {invalid[:10]}')
+
+
+def read_device_ids(device_csv: str) -> List[str]:
+    """
+    Read the device IDs from the first column of a CSV. A header row named `device_id` is skipped.
+    Raise ValueError if an ID is duplicated or not valid (see `check_device_ids`).
+    """
+    device_ids = []
+    with open(device_csv, newline='') as f:
+        for row in csv.reader(f):
+            if not row or not row[0].strip() or row[0].strip().startswith('#'):
+                continue
+            device_id = row[0].strip()
+            if not device_ids and device_id == 'device_id':
+                continue
+            device_ids.append(device_id)
+    if len(set(device_ids)) != len(device_ids):
+        raise ValueError(f'{device_csv} has duplicated device IDs')
+    check_device_ids(device_ids)
+    return device_ids
+
+
+def load_checkpoint(checkpoint_path: str) -> Dict[str, str]:
+    """
+    Read the devices that are already provisioned: device ID -> refresh token.
+    A line cut by an interruption is ignored, that device is provisioned again.
+    """
+    done = {}
+    if not os.path.exists(checkpoint_path):
+        return done
+    with open(checkpoint_path) as f:
+        for line in f:
+            try:
+                record = json.loads(line)
+                done[record['device_id']] = record['refresh_token']
+            except (ValueError, KeyError):
+                continue
+    return done
+
+
+def exchange_custom_token(transport, endpoint: str, api_key: str, custom_token: str,
+                          rate_limiter: RateLimiter, max_retries: int, report: ProvisionReport,
+                          report_lock: threading.Lock) -> str:
+    """
+    Exchange a custom token for a refresh token, retrying the throttled and failed requests with exponential backoff.
+    """
+    url = f'{endpoint}?key={api_key}'
+    payload = {'token': custom_token, 'returnSecureToken': True}
+    for attempt in range(max_retries + 1):
+        rate_limiter.wait()
+        with report_lock:
+            report.exchange_requests += 1
+        try:
+            status, response = transport.post_json(url, payload)
+        except urllib3.exceptions.HTTPError as e:
+            status, response = None, {'error': str(e)}
+        if status == 200 and 'refreshToken' in response:
+            return response['refreshToken']
+        if (status is not None and status not in RETRYABLE_STATUS) or attempt == max_retries:
+            break
+        time.sleep(min(30.0, 0.5 * 2 ** attempt))
+    raise RuntimeError(f'exchange failed with status {status}: {response.get("error", response)}')
+
+
+def bulk_provision(device_ids: List[str],
+                   mint_custom_token: Callable[[str], str],
+                   api_key: str,
+                   checkpoint_path: str,
+                   transport=None,
+                   endpoint: str = SIGN_IN_WITH_CUSTOM_TOKEN_ENDPOINT,
+                   workers: int = 16,
+                   rate_per_s: float = 20.0,
+                   max_retries: int = 4,
+                   progress: Optional[Callable[[int, int], None]] = None) -> Tuple[Dict[str, str], ProvisionReport]:
+    """
+    Provision the refresh tokens of the devices that are not in the checkpoint yet.
+
+    mint_custom_token: device ID -> custom token
+    transport: the HTTP layer, a `Urllib3Transport` with a connection per worker if None
+    rate_per_s: the maximum rate of the exchange requests
+    progress: called with (finished, total) after each device
+
+    Returns all the provisioned devices (including the ones from the checkpoint) and the report of this run.
+    """
+    check_device_ids(device_ids)
+    transport = transport or Urllib3Transport(workers)
+    report = ProvisionReport()
+    report_lock = threading.Lock()
+    rate_limiter = RateLimiter(rate_per_s)
+
+    provisioned = load_checkpoint(checkpoint_path)
+    pending = [device_id for device_id in device_ids if device_id not in provisioned]
+    report.skipped = len(device_ids) - len(pending)
+
+    def provision(device_id: str) -> Tuple[str, str, float]:
+        start = time.monotonic()
+        custom_token = mint_custom_token(device_id)
+        refresh_token = exchange_custom_token(transport, endpoint, api_key, custom_token,
+                                              rate_limiter, max_retries, report, report_lock)
+        return device_id, refresh_token, time.monotonic() - start
+
+    start = time.monotonic()
+    with open(checkpoint_path, 'a') as checkpoint, ThreadPoolExecutor(max_workers=workers) as executor:
+        futures = {executor.submit(provision, device_id): device_id for device_id in pending}
+        for finished, future in enumerate(as_completed(futures), start=1):
+            device_id = futures[future]
+            try:
+                _, refresh_token, latency_s = future.result()
+            except Exception as e:  # a failed device is reported, and retried by the next run
+                report.failed[device_id] = str(e)
+            else:
+                checkpoint.write(json.dumps({'device_id': device_id, 'refresh_token': refresh_token}) + '\n')
+                checkpoint.flush()
+                provisioned[device_id] = refresh_token
+                report.provisioned += 1
+                report.latencies_s.append(latency_s)
+            if progress:
+                progress(finished, len(pending))
+    report.elapsed_s = time.monotonic() - start
+    return provisioned, report
+
+
+def write_manifest(manifest_path: str, device_ids: List[str], provisioned: Dict[str, str]):
+    """
+    Write `device_id,refresh_token` of the provisioned devices, in the order of the device CSV.
+    """
+    with open(manifest_path, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['device_id', 'refresh_token'])
+        for device_id in device_ids:
+            if device_id in provisioned:
+                writer.writerow([device_id, provisioned[device_id]])
+
+
+def write_nvs_images(nvs_dir: str, device_ids: List[str], provisioned: Dict[str, str],
+                     partition_size: str = DEFAULT_NVS_PARTITION_SIZE, generate_bin: bool = True,
+                     workers: int = 4):
+    """
+    Write an NVS CSV of every provisioned device, in the format of ESP-IDF's nvs_partition_gen,
+    and (if generate_bin) the NVS partition image of it, `<device_id>.bin`, ready to be flashed at the nvs partition.
+    The images are generated by the `esp-idf-nvs-partition-gen` package.
+    """
+    check_device_ids(device_ids)
+    os.makedirs(nvs_dir, exist_ok=True)
+
+    def write_device(device_id: str):
+        csv_path = os.path.join(nvs_dir, f'{device_id}.csv')
+        with open(csv_path, 'w', newline='') as f:
+            writer = csv.writer(f)
+            writer.writerow(['key', 'type', 'encoding', 'value'])
+            writer.writerow([NVS_NAMESPACE, 'namespace', '', ''])
+            writer.writerow([NVS_DEVICE_ID_KEY, 'data', 'string', device_id])
+            writer.writerow([NVS_REFRESH_TOKEN_KEY, 'data', 'string', provisioned[device_id]])
+        if generate_bin:
+            subprocess.run(
+                [sys.executable, '-m', 'esp_idf_nvs_partition_gen', 'generate',
+                 csv_path, os.path.join(nvs_dir, f'{device_id}.bin'), partition_size],
+                check=True, capture_output=True)
+
+    with ThreadPoolExecutor(max_workers=workers) as executor:
+        list(executor.map(write_device, [d for d in device_ids if d in provisioned]))
@@ -10,6 +10,9 @@ from firebase_admin import credentials, auth
 import click
 import urllib3
 import json
+import time
+
+from . import bulk_provision as bulk
 
 
 @click.group()
@@ -53,9 +56,9 @@ def get_private_key_id(private_key_json: str) -> str:
         private_key_json = json.load(f)
     return private_key_json['private_key_id']
 
-def get_custom_token_from_private_key_json(private_key_json: str, device_id: str) -> str:
+def initialize_firebase_app(private_key_json: str):
     """
-    This function gets the custom token from the private key json file.
+    This function (re)initializes the default firebase app with the private key json file.
     """
     cred = credentials.Certificate(private_key_json)
 
@@ -63,13 +66,25 @@ def get_custom_token_from_private_key_json(private_key_json: str, device_id: str
         default_app = firebase_admin._apps['[DEFAULT]']
         firebase_admin.delete_app(default_app)
 
-    firebase_admin.initialize_app(credential=cred)  
+    firebase_admin.initialize_app(credential=cred)
+
+def create_custom_token(device_id: str) -> str:
+    """
+    This function mints the custom token of the device, with the default firebase app.
+    """
     custom_token = auth.create_custom_token(device_id)
     # check if this succeeds
     if not custom_token:
         raise ValueError("Error:Custom token creation failed")
     return custom_token.decode('utf-8')
 
+def get_custom_token_from_private_key_json(private_key_json: str, device_id: str) -> str:
+    """
+    This function gets the custom token from the private key json file.
+    """
+    initialize_firebase_app(private_key_json)
+    return create_custom_token(device_id)
+
 def get_refresh_token_from_custom_token(custom_token: str, api_key: str) -> str:
     """ 
     This function gets the refresh token from the custom token. To do this in curl:
@@ -100,3 +115,100 @@ def get_refresh_token_from_custom_token(custom_token: str, api_key: str) -> str:
 
     return dict_response['refreshToken']
 
+@cli.command()
+@click.option(
+    "--private-key-json", "-j",
+    type=click.Path(exists=True, resolve_path=True),
+    required=True,
+    help="The path to the service account public key json file",
+)
+@click.option(
+    "--device-csv", "-c",
+    type=click.Path(exists=True, resolve_path=True),
+    required=True,
+    help="CSV with a device ID in the first column of each row (a `device_id` header row is skipped)",
+)
+@click.option(
+    "--api-key", "-k",
+    type=str,
+    required=True,
+    help="The api key for the firebase project",
+)
+@click.option(
+    "--manifest", "-m",
+    type=click.Path(resolve_path=True),
+    default=None,
+    help="Write `device_id,refresh_token` of the provisioned devices to this CSV",
+)
+@click.option(
+    "--nvs-dir",
+    type=click.Path(file_okay=False, resolve_path=True),
+    default=None,
+    help="Write the NVS CSV and partition image (<device_id>.bin) of every device to this directory",
+)
+@click.option(
+    "--nvs-size",
+    type=str,
+    default=bulk.DEFAULT_NVS_PARTITION_SIZE,
+    show_default=True,
+    help="The size of the nvs partition in the partition table",
+)
+@click.option(
+    "--nvs-csv-only",
+    is_flag=True,
+    help="Only write the NVS CSVs, without the `esp-idf-nvs-partition-gen` package",
+)
+@click.option(
+    "--checkpoint",
+    type=click.Path(resolve_path=True),
+    default=None,
+    help="The checkpoint file, to resume an interrupted run [default: <device-csv>.checkpoint.jsonl]",
+)
+@click.option("--workers", "-w", type=click.IntRange(min=1), default=16, show_default=True,
+              help="The number of devices provisioned concurrently (and of pooled connections)")
+@click.option("--rate", "-r", type=float, default=20.0, show_default=True,
+              help="The maximum rate of the token exchange requests per second, 0 for no limit")
+@click.option("--max-retries", type=click.IntRange(min=0), default=4, show_default=True,
+              help="Retries of an exchange request that is throttled (429) or failed (5xx or connection)")
+@click.option(
+    "--endpoint",
+    type=str,
+    default=bulk.SIGN_IN_WITH_CUSTOM_TOKEN_ENDPOINT,
+    show_default=True,
+    help="The signInWithCustomToken endpoint, e.g. of the Firebase Auth emulator or a local stub",
+)
+def bulk_provision(private_key_json: str, device_csv: str, api_key: str, manifest: str, nvs_dir: str,
+                   nvs_size: str, nvs_csv_only: bool, checkpoint: str, workers: int, rate: float,
+                   max_retries: int, endpoint: str):
+    """
+    This function provisions the refresh tokens of all the devices in a CSV.
+    """
+    if manifest is None and nvs_dir is None:
+        raise click.UsageError("Give --manifest and/or --nvs-dir")
+
+    device_ids = bulk.read_device_ids(device_csv)
+    checkpoint = checkpoint or f'{device_csv}.checkpoint.jsonl'
+    initialize_firebase_app(private_key_json)
+
+    last_echo = [0.0]
+
+    def progress(finished: int, total: int):
+        # at most one line per second
+        if finished == total or time.monotonic() - last_echo[0] >= 1:
+            last_echo[0] = time.monotonic()
+            click.echo(f"{finished}/{total} devices", err=True)
+
+    provisioned, report = bulk.bulk_provision(
+        device_ids, create_custom_token, api_key, checkpoint,
+        endpoint=endpoint, workers=workers, rate_per_s=rate, max_retries=max_retries, progress=progress)
+
+    if manifest:
+        bulk.write_manifest(manifest, device_ids, provisioned)
+    if nvs_dir:
+        bulk.write_nvs_images(nvs_dir, device_ids, provisioned, nvs_size, generate_bin=not nvs_csv_only)
+
+    click.echo(report.summary())
+    for device_id, error in report.failed.items():
+        click.echo(f"{device_id}: {error}", err=True)
+    if report.failed:
+        raise SystemExit(1)
@@ -0,0 +1,142 @@
+"""
+Offline tests of bulk_provision: the HTTP layer is a fake transport, and the custom tokens are not signed.
+Run from gcp_auth: python -m unittest discover -s tests
+"""
+import csv
+import json
+import os
+import sys
+import tempfile
+import threading
+import unittest
+from unittest import mock
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'src'))
+
+from gcp_service_account_utils import bulk_provision as bulk  # noqa: E402
+
+
+class FakeTransport:
+    """
+    Answers the exchange requests from a script per custom token: a list of status codes, the last one repeats.
+    """
+
+    def __init__(self, scripts=None, default=(200,)):
+        self.scripts = scripts or {}
+        self.default = default
+        self.calls = {}
+        self.lock = threading.Lock()
+
+    def post_json(self, url, payload):
+        token = payload['token']
+        with self.lock:
+            attempt = self.calls.get(token, 0)
+            self.calls[token] = attempt + 1
+        script = self.scripts.get(token, self.default)
+        status = script[min(attempt, len(script) - 1)]
+        if status == 200:
+            return 200, {'refreshToken': f'refresh-{token}'}
+        return status, {'error': {'code': status}}
+
+
+def mint(device_id):
+    return f'custom-{device_id}'
+
+
+class BulkProvisionTest(unittest.TestCase):
+    def setUp(self):
+        self.directory = tempfile.TemporaryDirectory()
+        self.checkpoint = os.path.join(self.directory.name, 'checkpoint.jsonl')
+        # the backoff between retries is not waited
+        patcher = mock.patch.object(bulk.time, 'sleep')
+        patcher.start()
+        self.addCleanup(patcher.stop)
+
+    def tearDown(self):
+        self.directory.cleanup()
+
+    def provision(self, device_ids, transport, max_retries=3):
+        return bulk.bulk_provision(device_ids, mint, 'key', self.checkpoint, transport=transport,
+                                   endpoint='http://stub/token', workers=4, rate_per_s=0, max_retries=max_retries)
+
+    def write_file(self, name, content):
+        path = os.path.join(self.directory.name, name)
+        with open(path, 'w') as f:
+            f.write(content)
+        return path
+
+    def test_retries_throttled_and_server_errors(self):
+        transport = FakeTransport({'custom-dev-1': (429, 503, 200)})
+        provisioned, report = self.provision(['dev-1', 'dev-2'], transport)
+        self.assertEqual(provisioned, {'dev-1': 'refresh-custom-dev-1', 'dev-2': 'refresh-custom-dev-2'})
+        self.assertEqual(transport.calls['custom-dev-1'], 3)
+        self.assertEqual(report.exchange_requests, 4)
+        self.assertEqual(report.failed, {})
+
+    def test_gives_up_after_max_retries(self):
+        transport = FakeTransport({'custom-dev-1': (503,)})
+        provisioned, report = self.provision(['dev-1'], transport, max_retries=2)
+        self.assertEqual(provisioned, {})
+        self.assertEqual(transport.calls['custom-dev-1'], 3)
+        self.assertIn('dev-1', report.failed)
+
+    def test_does_not_retry_client_errors(self):
+        transport = FakeTransport({'custom-dev-1': (400, 200)})
+        provisioned, report = self.provision(['dev-1'], transport)
+        self.assertEqual(transport.calls['custom-dev-1'], 1)
+        self.assertIn('dev-1', report.failed)
+
+    def test_resumes_from_checkpoint(self):
+        failing = FakeTransport({'custom-dev-2': (400,)})
+        provisioned, report = self.provision(['dev-1', 'dev-2', 'dev-3'], failing)
+        self.assertEqual(sorted(provisioned), ['dev-1', 'dev-3'])
+        # a line cut by an interruption is ignored
+        with open(self.checkpoint, 'a') as f:
+            f.write('{"device_id": "dev-2", "refr')
+
+        transport = FakeTransport()
+        provisioned, report = self.provision(['dev-1', 'dev-2', 'dev-3'], transport)
+        self.assertEqual(transport.calls, {'custom-dev-2': 1})
+        self.assertEqual(report.skipped, 2)
+        self.assertEqual(report.provisioned, 1)
+        self.assertEqual(sorted(provisioned), ['dev-1', 'dev-2', 'dev-3'])
+
+    def test_reads_device_csv(self):
+        path = self.write_file('devices.csv', 'device_id,model\n# comment\ndev-1,a\n\n dev_2 ,b\n')
+        self.assertEqual(bulk.read_device_ids(path), ['dev-1', 'dev_2'])
+
+    def test_rejects_invalid_and_duplicated_device_ids(self):
+        for content in ['dev-1\n../../etc/passwd\n', 'dev-1\ndev 2\n', 'dev-1\n/abs\n', 'dev-1\ndev-1\n']:
+            with self.subTest(content=content):
+                with self.assertRaises(ValueError):
+                    bulk.read_device_ids(self.write_file('devices.csv', content))
+        with self.assertRaises(ValueError):
+            self.provision(['dev-1', '../dev-2'], FakeTransport())
+
+    def test_writes_manifest_in_device_order(self):
+        manifest = os.path.join(self.directory.name, 'manifest.csv')
+        bulk.write_manifest(manifest, ['dev-2', 'dev-1', 'dev-3'], {'dev-1': 'r1', 'dev-2': 'r2'})
+        with open(manifest, newline='') as f:
+            self.assertEqual(list(csv.reader(f)), [['device_id', 'refresh_token'], ['dev-2', 'r2'], ['dev-1', 'r1']])
+
+    def test_writes_nvs_csv(self):
+        nvs_dir = os.path.join(self.directory.name, 'nvs')
+        bulk.write_nvs_images(nvs_dir, ['dev-1', 'dev-2'], {'dev-1': 'r1'}, generate_bin=False)
+        self.assertEqual(os.listdir(nvs_dir), ['dev-1.csv'])
+        with open(os.path.join(nvs_dir, 'dev-1.csv'), newline='') as f:
+            self.assertEqual(list(csv.reader(f)), [
+                ['key', 'type', 'encoding', 'value'],
+                ['firebase', 'namespace', '', ''],
+                ['device_id', 'data', 'string', 'dev-1'],
+                ['refresh_token', 'data', 'string', 'r1'],
+            ])
+
+    def test_nvs_images_reject_invalid_device_ids(self):
+        nvs_dir = os.path.join(self.directory.name, 'nvs')
+        with self.assertRaises(ValueError):
+            bulk.write_nvs_images(nvs_dir, ['../evil'], {'../evil': 'r'}, generate_bin=False)
+        self.assertFalse(os.path.exists(os.path.join(self.directory.name, 'evil.csv')))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,400 @@
+/**
+ * @file fleet_sim.cc
+ * @brief Fleet load simulator: runs N virtual devices of the real firestore_utils.cc / firebase_auth.cc on Linux
+ * The component keeps its buffers in static variables (like on the device), so every virtual device
+ * is a forked process with its own copy of them. The devices report into a shared memory array,
+ * and the parent aggregates it when they are done.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <random>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "firebase_auth.h"
+#include "firestore_utils.h"
+#include "mock_backend.h"
+
+#define LINEAR_BUCKETS 1000 // 1 ms buckets below 1 s
+#define TAIL_BUCKETS 900    // 10 ms buckets from 1 s to 10 s
+#define HISTOGRAM_BUCKETS (LINEAR_BUCKETS + TAIL_BUCKETS + 1)
+
+typedef struct
+{
+    int devices;
+    double duration_s;
+    double rate;        // operations per second per device
+    double write_ratio; // the rest are reads
+    int docs_per_device;
+    int max_retries;
+    int backoff_ms; // base of the exponential backoff between retries, 0 means retry immediately
+    uint64_t seed;
+    mock_backend_config_t backend;
+} sim_config_t;
+
+typedef struct
+{
+    bool done;
+    uint64_t ops;
+    uint64_t writes;
+    uint64_t reads;
+    uint64_t failed_ops; // failed after all the retries
+    uint64_t retries;
+    uint64_t token_requests;
+    mock_backend_counters_t backend;
+    uint64_t peak_heap_bytes;
+    long max_rss_kb;
+    uint32_t latency_histogram[HISTOGRAM_BUCKETS];
+} device_stats_t;
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_s(double seconds)
+{
+    if (seconds > 0)
+    {
+        usleep((useconds_t)(seconds * 1e6));
+    }
+}
+
+static int latency_bucket(double latency_ms)
+{
+    if (latency_ms < LINEAR_BUCKETS)
+    {
+        return (int)latency_ms;
+    }
+    int bucket = LINEAR_BUCKETS + (int)((latency_ms - LINEAR_BUCKETS) / 10);
+    return bucket < HISTOGRAM_BUCKETS - 1 ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+static double bucket_upper_ms(int bucket)
+{
+    return bucket < LINEAR_BUCKETS ? bucket + 1 : LINEAR_BUCKETS + (bucket - LINEAR_BUCKETS + 1) * 10.0;
+}
+
+/**
+ * @brief Run an operation of the component, retrying it like a device firmware would
+ */
+template <typename OP>
+static esp_err_t with_retries(const sim_config_t *config, device_stats_t *stats, std::mt19937_64 &rng, OP op)
+{
+    for (int attempt = 0;; attempt++)
+    {
+        if (op() == ESP_OK)
+        {
+            return ESP_OK;
+        }
+        if (attempt == config->max_retries)
+        {
+            return ESP_FAIL;
+        }
+        stats->retries++;
+        if (config->backoff_ms > 0)
+        {
+            // exponential backoff with full jitter
+            double backoff_ms = config->backoff_ms * pow(2, attempt);
+            sleep_s(std::uniform_real_distribution<double>(0, backoff_ms)(rng) / 1000);
+        }
+    }
+}
+
+static void run_device(const sim_config_t *config, int device_index, device_stats_t *stats)
+{
+    sim_heap_install_cjson_hooks();
+    mock_backend_configure(&config->backend, config->seed + device_index);
+    std::mt19937_64 rng(config->seed * 7919 + device_index);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    char refresh_token[32];
+    snprintf(refresh_token, sizeof(refresh_token), "refresh-%05d", device_index);
+    static char access_token[1024];
+
+    with_retries(config, stats, rng, [&]()
+                 { stats->token_requests++;
+                   return firebase_get_access_token_from_refresh_token(refresh_token, access_token); });
+
+    char device_doc[64];
+    snprintf(device_doc, sizeof(device_doc), "dev/sim/devices/dev-%05d", device_index);
+    char field_to_get[] = "cmd";
+    char field_value[64];
+
+    // start at a random phase, so the devices don't hit the backend in lockstep
+    sleep_s(uniform(rng) / config->rate);
+    double start = now_s();
+    double next_op = start;
+    while (now_s() - start < config->duration_s)
+    {
+        double op_start = now_s();
+        esp_err_t result;
+        if (uniform(rng) < config->write_ratio)
+        {
+            char log_doc[96];
+            snprintf(log_doc, sizeof(log_doc), "%s/log/%d", device_doc, (int)(stats->writes % config->docs_per_device));
+            char record[96];
+            snprintf(record, sizeof(record), "{\"fields\": {\"t%02d\": {\"integerValue\": \"%d\"}}}",
+                     (int)(stats->writes % 60), (int)stats->writes);
+            result = with_retries(config, stats, rng, [&]()
+                                  { return firestore_patch(log_doc, record, access_token, FIRESTORE_DOC_UPSERT); });
+            stats->writes++;
+        }
+        else
+        {
+            result = with_retries(config, stats, rng, [&]()
+                                  { return firestore_get_a_field_value(device_doc, field_to_get, access_token, field_value); });
+            stats->reads++;
+        }
+        stats->ops++;
+        if (result != ESP_OK)
+        {
+            stats->failed_ops++;
+        }
+        stats->latency_histogram[latency_bucket((now_s() - op_start) * 1000)]++;
+
+        // Poisson arrivals at the configured rate; if the device is behind, the next operation starts right away
+        next_op += -log(1.0 - uniform(rng)) / config->rate;
+        sleep_s(next_op - now_s());
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    stats->backend = *mock_backend_counters();
+    stats->peak_heap_bytes = sim_heap_peak_bytes();
+    stats->max_rss_kb = usage.ru_maxrss;
+    stats->done = true;
+}
+
+static double histogram_percentile(const uint64_t *histogram, uint64_t total, double percentile)
+{
+    uint64_t target = (uint64_t)ceil(total * percentile / 100);
+    uint64_t count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        count += histogram[i];
+        if (count >= target && count > 0)
+        {
+            return bucket_upper_ms(i);
+        }
+    }
+    return 0;
+}
+
+static void report(const sim_config_t *config, const device_stats_t *all_stats, double elapsed_s)
+{
+    static uint64_t histogram[HISTOGRAM_BUCKETS];
+    device_stats_t total = {};
+    int finished = 0;
+    uint64_t max_heap = 0, sum_heap = 0;
+    long max_rss = 0, sum_rss = 0;
+    for (int d = 0; d < config->devices; d++)
+    {
+        const device_stats_t *stats = &all_stats[d];
+        if (!stats->done)
+        {
+            continue;
+        }
+        finished++;
+        total.ops += stats->ops;
+        total.writes += stats->writes;
+        total.reads += stats->reads;
+        total.failed_ops += stats->failed_ops;
+        total.retries += stats->retries;
+        total.token_requests += stats->token_requests;
+        total.backend.requests += stats->backend.requests;
+        total.backend.responses_429 += stats->backend.responses_429;
+        total.backend.resets += stats->backend.resets;
+        total.backend.contention += stats->backend.contention;
+        total.backend.unauthorized += stats->backend.unauthorized;
+        sum_heap += stats->peak_heap_bytes;
+        max_heap = stats->peak_heap_bytes > max_heap ? stats->peak_heap_bytes : max_heap;
+        sum_rss += stats->max_rss_kb;
+        max_rss = stats->max_rss_kb > max_rss ? stats->max_rss_kb : max_rss;
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            histogram[i] += stats->latency_histogram[i];
+        }
+    }
+    if (finished == 0)
+    {
+        printf("No virtual device finished\n");
+        return;
+    }
+
+    printf("devices: %d finished / %d, elapsed: %.1f s\n", finished, config->devices, elapsed_s);
+    printf("operations: %llu (%llu writes, %llu reads), %.1f ops/s, failed after retries: %llu (%.2f%%)\n",
+           (unsigned long long)total.ops, (unsigned long long)total.writes, (unsigned long long)total.reads,
+           total.ops / elapsed_s, (unsigned long long)total.failed_ops, total.ops ? 100.0 * total.failed_ops / total.ops : 0);
+    printf("backend requests: %llu, %.1f req/s, %.2f requests per operation (token requests: %llu)\n",
+           (unsigned long long)total.backend.requests, total.backend.requests / elapsed_s,
+           total.ops ? (double)total.backend.requests / total.ops : 0, (unsigned long long)total.token_requests);
+    printf("retries: %llu, 429: %llu, resets: %llu, contention (409): %llu, unauthorized (401): %llu\n",
+           (unsigned long long)total.retries, (unsigned long long)total.backend.responses_429,
+           (unsigned long long)total.backend.resets, (unsigned long long)total.backend.contention,
+           (unsigned long long)total.backend.unauthorized);
+    printf("operation latency (incl. retries) ms: p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, max <= %.0f\n",
+           histogram_percentile(histogram, total.ops, 50), histogram_percentile(histogram, total.ops, 90),
+           histogram_percentile(histogram, total.ops, 99), histogram_percentile(histogram, total.ops, 99.9),
+           histogram_percentile(histogram, total.ops, 100));
+    printf("per-device peak heap (component + cJSON): avg %llu B, max %llu B; process max RSS: avg %ld KB, max %ld KB\n",
+           (unsigned long long)(sum_heap / finished), (unsigned long long)max_heap, sum_rss / finished, max_rss);
+}
+
+static void usage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  --devices N               number of virtual devices (default 100)\n"
+           "  --duration S              seconds each device runs (default 10)\n"
+           "  --rate R                  operations per second per device (default 1)\n"
+           "  --write-ratio F           fraction of the operations that are writes, the rest are reads (default 0.8)\n"
+           "  --docs-per-device N       number of log documents each device writes to in turn (default 1)\n"
+           "  --max-retries N           retries of a failed operation (default 3)\n"
+           "  --backoff-ms MS           base of the exponential backoff between retries, 0 retries immediately (default 200)\n"
+           "  --latency-ms MS           base latency of the mock backend (default 80)\n"
+           "  --jitter-ms MS            mean extra latency, exponentially distributed (default 40)\n"
+           "  --error-429-rate F        probability of 429 RESOURCE_EXHAUSTED (default 0.01)\n"
+           "  --reset-rate F            probability of a connection reset (default 0.005)\n"
+           "  --doc-write-interval-ms MS  min interval between writes of a document, else 409 ABORTED (default 1000)\n"
+           "  --seed N                  random seed (default 1)\n"
+           "  --verbose                 print the logs of the component\n",
+           program);
+}
+
+int main(int argc, char **argv)
+{
+    sim_config_t config = {};
+    config.devices = 100;
+    config.duration_s = 10;
+    config.rate = 1;
+    config.write_ratio = 0.8;
+    config.docs_per_device = 1;
+    config.max_retries = 3;
+    config.backoff_ms = 200;
+    config.seed = 1;
+    config.backend.latency_ms = 80;
+    config.backend.jitter_ms = 40;
+    config.backend.error_429_rate = 0.01;
+    config.backend.reset_rate = 0.005;
+    config.backend.doc_write_interval_ms = 1000;
+
+    static const struct option options[] = {
+        {"devices", required_argument, NULL, 'n'},
+        {"duration", required_argument, NULL, 'd'},
+        {"rate", required_argument, NULL, 'r'},
+        {"write-ratio", required_argument, NULL, 'w'},
+        {"docs-per-device", required_argument, NULL, 'D'},
+        {"max-retries", required_argument, NULL, 'R'},
+        {"backoff-ms", required_argument, NULL, 'b'},
+        {"latency-ms", required_argument, NULL, 'l'},
+        {"jitter-ms", required_argument, NULL, 'j'},
+        {"error-429-rate", required_argument, NULL, 'e'},
+        {"reset-rate", required_argument, NULL, 'x'},
+        {"doc-write-interval-ms", required_argument, NULL, 'i'},
+        {"seed", required_argument, NULL, 's'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            config.devices = atoi(optarg);
+            break;
+        case 'd':
+            config.duration_s = atof(optarg);
+            break;
+        case 'r':
+            config.rate = atof(optarg);
+            break;
+        case 'w':
+            config.write_ratio = atof(optarg);
+            break;
+        case 'D':
+            config.docs_per_device = atoi(optarg);
+            break;
+        case 'R':
+            config.max_retries = atoi(optarg);
+            break;
+        case 'b':
+            config.backoff_ms = atoi(optarg);
+            break;
+        case 'l':
+            config.backend.latency_ms = atoi(optarg);
+            break;
+        case 'j':
+            config.backend.jitter_ms = atoi(optarg);
+            break;
+        case 'e':
+            config.backend.error_429_rate = atof(optarg);
+            break;
+        case 'x':
+            config.backend.reset_rate = atof(optarg);
+            break;
+        case 'i':
+            config.backend.doc_write_interval_ms = atoi(optarg);
+            break;
+        case 's':
+            config.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'v':
+            sim_set_log_level(ESP_LOG_INFO);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 1;
+        }
+    }
+    if (config.devices <= 0 || config.rate <= 0 || config.docs_per_device <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t stats_size = sizeof(device_stats_t) * config.devices;
+    device_stats_t *all_stats = (device_stats_t *)mmap(NULL, stats_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (all_stats == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("Running %d virtual devices for %.0f s at %.2f ops/s each...\n", config.devices, config.duration_s, config.rate);
+    fflush(stdout);
+    double start = now_s();
+    for (int d = 0; d < config.devices; d++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            config.devices = d;
+            break;
+        }
+        if (pid == 0)
+        {
+            run_device(&config, d, &all_stats[d]);
+            _exit(0);
+        }
+    }
+    while (wait(NULL) > 0)
+    {
+    }
+
+    report(&config, all_stats, now_s() - start);
+    munmap(all_stats, stats_size);
+    return 0;
+}
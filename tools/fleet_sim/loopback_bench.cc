@@ -0,0 +1,225 @@
+/**
+ * @file loopback_bench.cc
+ * @brief Benchmark and regression check of the request building and response parsing of firestore_utils.cc
+ * The `_at` functions are run against the in-process loopback transport (`firebase_transport_loopback_init`),
+ * so no network and no latency is involved: the time per call is the CPU time of the component (and cJSON).
+ * Every call is checked (its result, and what it parsed from the response), and the program exits with 1 if any check fails.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <functional>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "firebase_transport.h"
+#include "firestore_blob.h"
+#include "firestore_utils.h"
+
+static const char DOCUMENT[] =
+    "{\"name\": \"projects/fleet-sim/databases/(default)/documents/dev/bench/devices/dev1\", "
+    "\"fields\": {\"cmd\": {\"stringValue\": \"reboot\"}, \"Aug05\": {\"integerValue\": \"700\"}}, "
+    "\"createTime\": \"2024-08-05T00:00:00.000000Z\", \"updateTime\": \"2024-08-05T00:00:01.000000Z\"}";
+static const char AGGREGATION_RESULT[] =
+    "[{\"result\": {\"aggregateFields\": {\"a0\": {\"integerValue\": \"42\"}, \"a1\": {\"doubleValue\": 1.5}}}, "
+    "\"readTime\": \"2024-08-05T00:00:01.000000Z\"}]";
+
+static char token[] = "bench-token";
+static char record[] = "{\"fields\": { \"Aug05\": {\"integerValue\": \"700\"}, \"Aug06\": {\"integerValue\": \"700\"}}}";
+static uint8_t blob[2500]; // 3 chunks of CONFIG_FIRESTORE_BLOB_CHUNK_SIZE (1024 in the simulator)
+
+static int failed_checks = 0;
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Run `call` `iterations` times, and print the time per call. `call` returns false if its check failed.
+ */
+static void bench(const char *name, int iterations, const std::function<bool()> &call)
+{
+    int failed = 0;
+    double start_s = now_s();
+    for (int i = 0; i < iterations; i++)
+    {
+        if (!call())
+        {
+            failed++;
+        }
+    }
+    double elapsed_s = now_s() - start_s;
+    printf("%-34s %8.2f us/call %10.0f calls/s%s\n", name, elapsed_s * 1e6 / iterations, iterations / elapsed_s,
+           failed > 0 ? "  FAILED" : "");
+    if (failed > 0)
+    {
+        printf("  %d / %d calls failed their check\n", failed, iterations);
+        failed_checks++;
+    }
+}
+
+typedef struct
+{
+    int pos; // how much of the record is produced
+} record_producer_t;
+
+static int produce_record(char *buffer, int buffer_size, void *user_ctx)
+{
+    record_producer_t *producer = (record_producer_t *)user_ctx;
+    int left = (int)strlen(record) - producer->pos;
+    int len = left < buffer_size ? left : buffer_size;
+    memcpy(buffer, record + producer->pos, len);
+    producer->pos += len;
+    return len;
+}
+
+static void usage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  --iterations N  calls of each function (default 100000)\n"
+           "  --chunk-size N  size of the pieces the loopback gives the response in, 0 for one piece (default 0)\n"
+           "  --body-piece-size N  size of the buffer a streamed request body is produced into, 0 for the default (default 0)\n",
+           program);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 100000;
+    int chunk_size = 0;
+    int body_piece_size = 0;
+    static const struct option options[] = {
+        {"iterations", required_argument, NULL, 'i'},
+        {"chunk-size", required_argument, NULL, 'c'},
+        {"body-piece-size", required_argument, NULL, 'b'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'c':
+            chunk_size = atoi(optarg);
+            break;
+        case 'b':
+            body_piece_size = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+    if (iterations <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    firebase_loopback_response_t responses[] = {
+        {HTTP_METHOD_POST, ":runAggregationQuery", 200, AGGREGATION_RESULT, 0},
+        {HTTP_METHOD_GET, "/missing", 404, "{\"error\": {\"code\": 404, \"status\": \"NOT_FOUND\"}}", 0},
+        {-1, NULL, 200, DOCUMENT, 0},
+    };
+    firebase_loopback_config_t loopback = {responses, sizeof(responses) / sizeof(responses[0]), chunk_size, 0, body_piece_size};
+    firebase_transport_t transport;
+    firebase_transport_loopback_init(&transport, &loopback);
+    firestore_set_transport(&transport);
+
+    firestore_path_t document, missing, collection;
+    firestore_document_path_init(&document, "dev/bench/devices/dev1");
+    firestore_document_path_init(&missing, "dev/bench/missing/dev1");
+    firestore_collection_path_init(&collection, "dev/bench/devices", "dev2");
+
+    printf("%d calls of each function, response in %s\n", iterations, chunk_size > 0 ? "pieces" : "one piece");
+
+    // the string functions parse and check the path on every call, the `_at` ones take it prepared once
+    bench("firestore_patch (upsert)", iterations, [&] {
+        return firestore_patch((char *)"dev/bench/devices/dev1", record, token, FIRESTORE_DOC_UPSERT) == ESP_OK;
+    });
+    bench("firestore_patch_at (upsert)", iterations, [&] {
+        return firestore_patch_at(&document, record, token, FIRESTORE_DOC_UPSERT, NULL) == ESP_OK;
+    });
+    firestore_path_t masked_document = document;
+    const char *mask_fields[] = {"Aug05", "Aug06"};
+    firestore_document_path_set_update_mask(&masked_document, mask_fields, 2);
+    bench("firestore_patch_at (upsert, mask)", iterations, [&] {
+        return firestore_patch_at(&masked_document, record, token, FIRESTORE_DOC_UPSERT, NULL) == ESP_OK;
+    });
+    bench("firestore_patch_at (overwrite)", iterations, [&] {
+        return firestore_patch_at(&document, record, token, FIRESTORE_DOC_OVERWRITE, NULL) == ESP_OK;
+    });
+    bench("firestore_createDocument", iterations, [&] {
+        return firestore_createDocument((char *)"dev/bench/devices", (char *)"dev2", record, token) == ESP_OK;
+    });
+    bench("firestore_createDocument_at", iterations, [&] {
+        return firestore_createDocument_at(&collection, record, token, NULL) == ESP_OK;
+    });
+    bench("firestore_patch_stream_at", iterations, [&] {
+        record_producer_t producer = {0};
+        char *fields[] = {(char *)"Aug05", (char *)"Aug06"};
+        return firestore_patch_stream_at(&document, produce_record, &producer, strlen(record), fields, 2, token, FIRESTORE_DOC_UPSERT, NULL) == ESP_OK;
+    });
+    bench("firestore_get_a_field_value", iterations, [&] {
+        char value[32];
+        return firestore_get_a_field_value((char *)"dev/bench/devices/dev1", (char *)"cmd", token, value) == ESP_OK && strcmp(value, "reboot") == 0;
+    });
+    bench("firestore_get_a_field_value_at", iterations, [&] {
+        char value[32];
+        return firestore_get_a_field_value_at(&document, (char *)"cmd", token, value, NULL) == ESP_OK && strcmp(value, "reboot") == 0;
+    });
+    bench("firestore_get_document_at", iterations, [&] {
+        const char *fields[] = {"Aug05"};
+        char response[512];
+        char update_time[FIRESTORE_TIMESTAMP_MAX_LEN];
+        firestore_request_options_t get_options = {};
+        get_options.projection = FIRESTORE_PROJECTION_FIELDS;
+        get_options.fields = fields;
+        get_options.num_fields = 1;
+        get_options.response = response;
+        get_options.response_size = sizeof(response);
+        get_options.update_time = update_time;
+        return firestore_get_document_at(&document, token, &get_options) == ESP_OK &&
+               strstr(response, "\"700\"") != NULL && strcmp(update_time, "2024-08-05T00:00:01.000000Z") == 0;
+    });
+    bench("firestore_document_exists_at (404)", iterations, [&] {
+        bool exists = true;
+        return firestore_document_exists_at(&missing, token, &exists) == ESP_OK && !exists;
+    });
+    for (size_t i = 0; i < sizeof(blob); i++)
+    {
+        blob[i] = (uint8_t)(i * 7);
+    }
+    uint32_t blob_crc32 = esp_rom_crc32_le(0, blob, sizeof(blob));
+    bench("firestore_blob_upload (3 chunks)", iterations, [&] {
+        // the loopback checks that each chunk body adds up to its content length
+        firestore_blob_source_t source;
+        firestore_blob_source_from_buffer(&source, blob, sizeof(blob));
+        firestore_blob_info_t info;
+        return firestore_blob_upload("dev/bench/devices/dev1/blobs/dump", &source, token, &info) == ESP_OK &&
+               info.num_chunks == 3 && info.crc32 == blob_crc32;
+    });
+    bench("firestore_run_aggregation_query", iterations, [&] {
+        firestore_aggregation_t aggregations[] = {{FIRESTORE_AGGREGATION_COUNT, NULL, 0}, {FIRESTORE_AGGREGATION_AVG, "kwh", 0}};
+        firestore_number_t results[2];
+        return firestore_run_aggregation_query("dev/bench/devices", NULL, aggregations, 2, token, results) == ESP_OK &&
+               results[0].type == FIRESTORE_NUMBER_INTEGER && results[0].integer_value == 42 &&
+               results[1].type == FIRESTORE_NUMBER_DOUBLE && results[1].double_value == 1.5;
+    });
+
+    if (loopback.unmatched > 0)
+    {
+        printf("%u requests had no matching response\n", (unsigned)loopback.unmatched);
+        failed_checks++;
+    }
+    printf("%s\n", failed_checks == 0 ? "all checks passed" : "some checks FAILED");
+    return failed_checks == 0 ? 0 : 1;
+}
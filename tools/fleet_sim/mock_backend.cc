@@ -0,0 +1,170 @@
+/**
+ * @file mock_backend.cc
+ * @brief In-process mock of the secure token API and the Firestore REST API, with fault injection
+ */
+
+#include "mock_backend.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <random>
+#include <unordered_map>
+
+static mock_backend_config_t config;
+static mock_backend_counters_t counters;
+static std::mt19937_64 rng;
+static std::unordered_map<std::string, int64_t> last_write_ms; // document path -> last write time
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double uniform()
+{
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+static std::string query_param(const std::string &query, const std::string &key)
+{
+    size_t start = 0;
+    while (start < query.size())
+    {
+        size_t end = query.find('&', start);
+        if (end == std::string::npos)
+        {
+            end = query.size();
+        }
+        if (query.compare(start, key.size() + 1, key + "=") == 0)
+        {
+            return query.substr(start + key.size() + 1, end - start - key.size() - 1);
+        }
+        start = end + 1;
+    }
+    return "";
+}
+
+static std::string error_body(int code, const char *status, const char *message)
+{
+    return "{\"error\": {\"code\": " + std::to_string(code) + ", \"message\": \"" + message + "\", \"status\": \"" + status + "\"}}";
+}
+
+static std::string timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    char buffer[64];
+    struct tm tm_utc;
+    gmtime_r(&ts.tv_sec, &tm_utc);
+    size_t len = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm_utc);
+    snprintf(buffer + len, sizeof(buffer) - len, ".%06ldZ", ts.tv_nsec / 1000);
+    return buffer;
+}
+
+static void handle_token_request(const mock_request &request, mock_response *response)
+{
+    size_t pos = request.body.find("refresh_token=");
+    if (pos == std::string::npos)
+    {
+        response->status_code = 400;
+        response->body = error_body(400, "INVALID_ARGUMENT", "MISSING_REFRESH_TOKEN");
+        return;
+    }
+    std::string refresh_token = request.body.substr(pos + strlen("refresh_token="));
+    response->status_code = 200;
+    response->body = "{\"expires_in\": \"3600\", \"token_type\": \"Bearer\", \"refresh_token\": \"" + refresh_token +
+                     "\", \"id_token\": \"id-" + refresh_token + "\", \"user_id\": \"" + refresh_token + "\"}";
+}
+
+static void handle_firestore_request(const mock_request &request, mock_response *response)
+{
+    if (request.authorization.compare(0, strlen("Bearer id-"), "Bearer id-") != 0)
+    {
+        counters.unauthorized++;
+        response->status_code = 401;
+        response->body = error_body(401, "UNAUTHENTICATED", "Request had invalid authentication credentials.");
+        return;
+    }
+
+    std::string document = request.path;
+    if (request.method == HTTP_METHOD_POST)
+    {
+        document += "/" + query_param(request.query, "documentId");
+    }
+
+    if (request.method == HTTP_METHOD_PATCH || request.method == HTTP_METHOD_POST)
+    {
+        int64_t now = now_ms();
+        auto last = last_write_ms.find(document);
+        if (last != last_write_ms.end() && now - last->second < config.doc_write_interval_ms)
+        {
+            counters.contention++;
+            response->status_code = 409;
+            response->body = error_body(409, "ABORTED", "Too much contention on these documents. Please try again.");
+            return;
+        }
+        last_write_ms[document] = now;
+        std::string update_time = timestamp();
+        response->status_code = 200;
+        response->body = "{\"name\": \"" + document + "\", \"fields\": {}, \"createTime\": \"" + update_time +
+                         "\", \"updateTime\": \"" + update_time + "\"}";
+        return;
+    }
+
+    // GET, answer the masked field with a value
+    std::string field = query_param(request.query, "mask.fieldPaths");
+    response->status_code = 200;
+    response->body = "{\"name\": \"" + document + "\", \"fields\": {\"" + field + "\": {\"integerValue\": \"42\"}}, " +
+                     "\"createTime\": \"2024-01-01T00:00:00.000000Z\", \"updateTime\": \"2024-01-01T00:00:00.000000Z\"}";
+}
+
+void mock_backend_configure(const mock_backend_config_t *new_config, uint64_t seed)
+{
+    config = *new_config;
+    counters = {};
+    rng.seed(seed);
+    last_write_ms.clear();
+}
+
+void mock_backend_handle(const mock_request &request, mock_response *response)
+{
+    counters.requests++;
+    response->latency_ms = config.latency_ms;
+    if (config.jitter_ms > 0)
+    {
+        response->latency_ms += (int)(-log(1.0 - uniform()) * config.jitter_ms);
+    }
+    response->connection_reset = false;
+
+    double dice = uniform();
+    if (dice < config.reset_rate)
+    {
+        counters.resets++;
+        response->connection_reset = true;
+        return;
+    }
+    if (dice < config.reset_rate + config.error_429_rate)
+    {
+        counters.responses_429++;
+        response->status_code = 429;
+        response->body = error_body(429, "RESOURCE_EXHAUSTED", "Quota exceeded.");
+        return;
+    }
+
+    if (request.host == "securetoken.googleapis.com")
+    {
+        handle_token_request(request, response);
+    }
+    else
+    {
+        handle_firestore_request(request, response);
+    }
+}
+
+const mock_backend_counters_t *mock_backend_counters(void)
+{
+    return &counters;
+}
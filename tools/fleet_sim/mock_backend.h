@@ -0,0 +1,57 @@
+#ifndef FLEET_SIM_MOCK_BACKEND_H_
+#define FLEET_SIM_MOCK_BACKEND_H_
+
+#include <stdint.h>
+#include <string>
+#include "esp_http_client.h"
+
+/**
+ * In-process mock of the Firebase secure token API and the Firestore REST API.
+ * Every virtual device runs in its own process, so each has its own mock, with the injected faults
+ * drawn from its own random stream. The mock keeps the last write time of each document, so writing
+ * the same document faster than Firestore sustains is answered with 409 ABORTED (contention).
+ */
+
+typedef struct
+{
+    int latency_ms;               // base latency of a request
+    int jitter_ms;                // mean of the exponentially distributed extra latency (the tail)
+    double error_429_rate;        // probability of 429 RESOURCE_EXHAUSTED
+    double reset_rate;            // probability of a connection reset (the request fails without response)
+    int doc_write_interval_ms;    // writing the same document again within this interval is answered with 409 ABORTED
+} mock_backend_config_t;
+
+typedef struct
+{
+    uint64_t requests;
+    uint64_t responses_429;
+    uint64_t resets;
+    uint64_t contention;
+    uint64_t unauthorized;
+} mock_backend_counters_t;
+
+struct mock_request
+{
+    std::string host;
+    std::string path;
+    std::string query;
+    esp_http_client_method_t method;
+    std::string authorization;
+    std::string body;
+};
+
+struct mock_response
+{
+    bool connection_reset;
+    int latency_ms;
+    int status_code;
+    std::string body;
+};
+
+void mock_backend_configure(const mock_backend_config_t *config, uint64_t seed);
+
+void mock_backend_handle(const mock_request &request, mock_response *response);
+
+const mock_backend_counters_t *mock_backend_counters(void);
+
+#endif /* FLEET_SIM_MOCK_BACKEND_H_ */
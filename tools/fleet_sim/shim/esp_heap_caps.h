@@ -0,0 +1,31 @@
+#ifndef SIM_ESP_HEAP_CAPS_H_
+#define SIM_ESP_HEAP_CAPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+
+    /**
+     * The heap functions are tracked, so the simulator can report the peak heap usage of each virtual device.
+     * cJSON is hooked to them too (see `sim_heap_install_cjson_hooks`).
+     */
+    void *heap_caps_malloc(size_t size, uint32_t caps);
+    void *heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+    void heap_caps_free(void *ptr);
+
+    void sim_heap_install_cjson_hooks(void);
+    size_t sim_heap_current_bytes(void);
+    size_t sim_heap_peak_bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_ESP_HEAP_CAPS_H_ */
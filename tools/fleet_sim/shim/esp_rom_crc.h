@@ -0,0 +1,20 @@
+#ifndef SIM_ESP_ROM_CRC_H_
+#define SIM_ESP_ROM_CRC_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief CRC-32 (little endian, same as zlib's `crc32`), continued from `crc`
+     */
+    uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_ESP_ROM_CRC_H_ */
@@ -0,0 +1,20 @@
+#ifndef SIM_ESP_TIMER_H_
+#define SIM_ESP_TIMER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief The time since the start of the process in us, from the monotonic clock
+     */
+    int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_ESP_TIMER_H_ */
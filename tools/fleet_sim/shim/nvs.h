@@ -0,0 +1,37 @@
+#ifndef SIM_NVS_H_
+#define SIM_NVS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+
+    typedef uint32_t nvs_handle_t;
+
+    typedef enum
+    {
+        NVS_READONLY,
+        NVS_READWRITE,
+    } nvs_open_mode_t;
+
+    /* An in-memory NVS of the process, its blobs are lost when the process exits */
+
+    esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+    esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+    esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+    esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+    esp_err_t nvs_commit(nvs_handle_t handle);
+    void nvs_close(nvs_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_NVS_H_ */
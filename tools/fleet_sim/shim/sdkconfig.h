@@ -0,0 +1,15 @@
+/**
+ * @file sdkconfig.h
+ * @brief The menuconfig options the component is built with in the simulator
+ * The mock backend accepts any project ID, API key and database root.
+ */
+
+#ifndef SIM_SDKCONFIG_H_
+#define SIM_SDKCONFIG_H_
+
+#define CONFIG_FIREBASE_PROJECT_ID "fleet-sim"
+#define CONFIG_FIREBASE_API_KEY "fleet-sim-api-key"
+#define CONFIG_FIRESTORE_DB_ROOT "databases/(default)/documents"
+#define CONFIG_FIRESTORE_BLOB_CHUNK_SIZE 1024 // the smallest, so a small blob has several chunks
+
+#endif /* SIM_SDKCONFIG_H_ */
@@ -0,0 +1,466 @@
+/**
+ * @file sim_shim.cc
+ * @brief Host implementations of the ESP-IDF functions used by the component: log, heap, esp_timer, CRC, NVS and esp_http_client
+ * The HTTP client does not touch the network, each request is answered by the mock backend,
+ * after sleeping for the latency the mock decided (or the timeout of the request, if it is shorter).
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "cJSON.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "../mock_backend.h"
+
+static const int DEFAULT_TIMEOUT_MS = 5000; // same as esp_http_client
+static const int DEFAULT_BUFFER_SIZE = 512;
+
+/* log */
+
+static esp_log_level_t log_level = ESP_LOG_NONE;
+
+void sim_set_log_level(esp_log_level_t level)
+{
+    log_level = level;
+}
+
+void sim_log(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char LEVEL_LETTERS[] = "NEWIDV";
+    if (level > log_level)
+    {
+        return;
+    }
+    // one write per line, so the lines of the devices (processes) are not interleaved
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%c (%d) %s: ", LEVEL_LETTERS[level], (int)getpid(), tag);
+    va_list args;
+    va_start(args, format);
+    len += vsnprintf(line + len, sizeof(line) - len - 1, format, args);
+    va_end(args);
+    len = std::min(len, (int)sizeof(line) - 2);
+    line[len++] = '\n';
+    write(STDERR_FILENO, line, len);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_HTTP_CONNECT:
+        return "ESP_ERR_HTTP_CONNECT";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+/* heap */
+
+static const size_t ALLOC_HEADER_SIZE = 16; // keeps the size of the allocation, and the alignment of the returned pointer
+static size_t heap_current_bytes = 0;
+static size_t heap_peak_bytes = 0;
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    char *block = (char *)malloc(size + ALLOC_HEADER_SIZE);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    *(size_t *)block = size;
+    heap_current_bytes += size;
+    if (heap_current_bytes > heap_peak_bytes)
+    {
+        heap_peak_bytes = heap_current_bytes;
+    }
+    return block + ALLOC_HEADER_SIZE;
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    void *ptr = heap_caps_malloc(n * size, caps);
+    if (ptr != NULL)
+    {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+void heap_caps_free(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    char *block = (char *)ptr - ALLOC_HEADER_SIZE;
+    heap_current_bytes -= *(size_t *)block;
+    free(block);
+}
+
+static void *cjson_malloc(size_t size)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_8BIT);
+}
+
+void sim_heap_install_cjson_hooks(void)
+{
+    cJSON_Hooks hooks = {cjson_malloc, heap_caps_free};
+    cJSON_InitHooks(&hooks);
+}
+
+size_t sim_heap_current_bytes(void)
+{
+    return heap_current_bytes;
+}
+
+size_t sim_heap_peak_bytes(void)
+{
+    return heap_peak_bytes;
+}
+
+/* esp_timer */
+
+int64_t esp_timer_get_time(void)
+{
+    static int64_t start_us = -1;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (start_us < 0)
+    {
+        start_us = now_us;
+    }
+    return now_us - start_us;
+}
+
+/* esp_rom_crc */
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+/* nvs */
+
+static std::vector<std::string> nvs_namespaces;      // a handle is the index of its namespace + 1
+static std::map<std::string, std::string> nvs_blobs; // "<namespace>/<key>" -> blob
+
+static std::string nvs_key_of(nvs_handle_t handle, const char *key)
+{
+    return nvs_namespaces[handle - 1] + "/" + key;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    auto found = std::find(nvs_namespaces.begin(), nvs_namespaces.end(), name);
+    if (found == nvs_namespaces.end())
+    {
+        if (open_mode == NVS_READONLY)
+        {
+            return ESP_ERR_NVS_NOT_FOUND; // like NVS, a namespace is only created by opening it read-write
+        }
+        found = nvs_namespaces.insert(nvs_namespaces.end(), name);
+    }
+    *out_handle = found - nvs_namespaces.begin() + 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    auto found = nvs_blobs.find(nvs_key_of(handle, key));
+    if (found == nvs_blobs.end())
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value != NULL)
+    {
+        memcpy(out_value, found->second.data(), std::min(*length, found->second.size()));
+    }
+    *length = found->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    nvs_blobs[nvs_key_of(handle, key)].assign((const char *)value, length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    return nvs_blobs.erase(nvs_key_of(handle, key)) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+/* esp_http_client */
+
+struct esp_http_client
+{
+    std::string host;
+    std::string path;
+    std::string query;
+    esp_http_client_method_t method;
+    int timeout_ms;
+    int buffer_size;
+    http_event_handle_cb event_handler;
+    void *user_data;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string post_data;
+
+    bool connected;
+    bool chunked_request; // opened with a negative write length
+    std::string written;  // the body written with esp_http_client_write
+
+    int status_code;
+    std::string response;
+    size_t read_offset;
+};
+
+static void dispatch_event(esp_http_client_handle_t client, esp_http_client_event_id_t event_id, const char *data, int data_len)
+{
+    if (client->event_handler == NULL)
+    {
+        return;
+    }
+    esp_http_client_event_t event = {};
+    event.event_id = event_id;
+    event.client = client;
+    event.data = (void *)data;
+    event.data_len = data_len;
+    event.user_data = client->user_data;
+    client->event_handler(&event);
+}
+
+static std::string header_value(esp_http_client_handle_t client, const char *key)
+{
+    for (const auto &header : client->headers)
+    {
+        if (strcasecmp(header.first.c_str(), key) == 0)
+        {
+            return header.second;
+        }
+    }
+    return "";
+}
+
+static std::string dechunk(const std::string &body)
+{
+    std::string result;
+    size_t pos = 0;
+    while (pos < body.size())
+    {
+        size_t line_end = body.find("\r\n", pos);
+        if (line_end == std::string::npos)
+        {
+            break;
+        }
+        size_t chunk_len = strtoul(body.c_str() + pos, NULL, 16);
+        if (chunk_len == 0)
+        {
+            break;
+        }
+        result.append(body, line_end + 2, chunk_len);
+        pos = line_end + 2 + chunk_len + 2;
+    }
+    return result;
+}
+
+/**
+ * @brief Send the request to the mock backend and wait for the latency of it
+ *
+ * @return ESP_OK if a response is received
+ */
+static esp_err_t exchange_with_backend(esp_http_client_handle_t client, const std::string &body)
+{
+    mock_request request = {client->host, client->path, client->query, client->method, header_value(client, "Authorization"), body};
+    mock_response response;
+    mock_backend_handle(request, &response);
+
+    client->connected = true;
+    dispatch_event(client, HTTP_EVENT_ON_CONNECTED, NULL, 0);
+    if (response.latency_ms > client->timeout_ms)
+    {
+        usleep(client->timeout_ms * 1000);
+        dispatch_event(client, HTTP_EVENT_ERROR, NULL, 0);
+        return ESP_FAIL;
+    }
+    usleep(response.latency_ms * 1000);
+    if (response.connection_reset)
+    {
+        dispatch_event(client, HTTP_EVENT_ERROR, NULL, 0);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+
+    dispatch_event(client, HTTP_EVENT_HEADERS_SENT, NULL, 0);
+    dispatch_event(client, HTTP_EVENT_ON_HEADER, NULL, 0);
+    client->status_code = response.status_code;
+    client->response = response.body;
+    client->read_offset = 0;
+    return ESP_OK;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = new esp_http_client();
+    client->host = config->host ? config->host : "";
+    client->path = config->path ? config->path : "/";
+    client->query = config->query ? config->query : "";
+    client->method = config->method;
+    client->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms : DEFAULT_TIMEOUT_MS;
+    client->buffer_size = config->buffer_size > 0 ? config->buffer_size : DEFAULT_BUFFER_SIZE;
+    client->event_handler = config->event_handler;
+    client->user_data = config->user_data;
+    return client;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    esp_err_t result = exchange_with_backend(client, client->post_data);
+    if (result != ESP_OK)
+    {
+        return result;
+    }
+    // the response body is delivered in pieces of the receive buffer size, like esp_http_client does
+    for (size_t offset = 0; offset < client->response.size(); offset += client->buffer_size)
+    {
+        size_t piece_len = std::min(client->response.size() - offset, (size_t)client->buffer_size);
+        dispatch_event(client, HTTP_EVENT_ON_DATA, client->response.data() + offset, piece_len);
+    }
+    dispatch_event(client, HTTP_EVENT_ON_FINISH, NULL, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len)
+{
+    client->post_data.assign(data, len);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    for (auto &header : client->headers)
+    {
+        if (strcasecmp(header.first.c_str(), key) == 0)
+        {
+            header.second = value;
+            return ESP_OK;
+        }
+    }
+    client->headers.emplace_back(key, value);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+    client->method = method;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeout_ms)
+{
+    client->timeout_ms = timeout_ms;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    client->chunked_request = write_len < 0;
+    client->written.clear();
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char *buffer, int len)
+{
+    client->written.append(buffer, len);
+    return len;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    if (exchange_with_backend(client, client->chunked_request ? dechunk(client->written) : client->written) != ESP_OK)
+    {
+        return -1;
+    }
+    return client->response.size();
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    size_t piece_len = std::min(client->response.size() - client->read_offset, (size_t)len);
+    memcpy(buffer, client->response.data() + client->read_offset, piece_len);
+    client->read_offset += piece_len;
+    if (piece_len > 0)
+    {
+        // esp_http_client fires the data event for what is read too
+        dispatch_event(client, HTTP_EVENT_ON_DATA, buffer, piece_len);
+    }
+    return piece_len;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status_code;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->response.size();
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->connected)
+    {
+        client->connected = false;
+        dispatch_event(client, HTTP_EVENT_DISCONNECTED, NULL, 0);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    delete client;
+    return ESP_OK;
+}
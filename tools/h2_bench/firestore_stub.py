@@ -0,0 +1,83 @@
+"""
+A local stand-in of the Firestore REST API for the HTTP/1.1 vs HTTP/2 benchmark (main/h2_bench.c).
+It speaks plain HTTP/1.1, put nghttpx in front of it to serve both HTTP/1.1 and HTTP/2 over TLS (see README.md).
+
+- `PATCH` and `POST` are answered with the document of the request, `GET` with an empty document.
+- Every response is delayed by --latency-ms, the time Firestore takes to process a request.
+
+The requests of each protocol (from the `Via` header of nghttpx) are counted and printed on exit.
+Only the standard library is used.
+"""
+import argparse
+import json
+import signal
+import threading
+import time
+from collections import Counter
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlsplit
+
+
+class FirestoreStubHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'  # keep the connections from nghttpx open
+    disable_nagle_algorithm = True  # the headers and the body are written separately
+    latency_s = 0.0
+    counts = Counter()
+    counts_lock = threading.Lock()
+
+    def log_message(self, format, *args):
+        pass
+
+    def respond(self, fields: dict):
+        time.sleep(self.latency_s)
+        name = urlsplit(self.path).path.split('/documents/', 1)[-1]
+        body = json.dumps({'name': name, 'fields': fields,
+                           'createTime': '2024-08-05T00:00:00.000000Z',
+                           'updateTime': '2024-08-05T00:00:00.000000Z'}).encode()
+        protocol = self.headers.get('Via', 'direct').split(' ')[0]
+        with self.counts_lock:
+            self.counts[f'{self.command} {protocol}'] += 1
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json; charset=UTF-8')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def read_document(self) -> dict:
+        length = int(self.headers.get('Content-Length', 0))
+        try:
+            return json.loads(self.rfile.read(length) or b'{}').get('fields', {})
+        except ValueError:
+            return {}
+
+    def do_GET(self):
+        self.respond({})
+
+    def do_PATCH(self):
+        self.respond(self.read_document())
+
+    def do_POST(self):
+        self.respond(self.read_document())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8080)
+    parser.add_argument('--latency-ms', type=float, default=20.0, help='the processing time added to every response')
+    args = parser.parse_args()
+
+    FirestoreStubHandler.latency_s = args.latency_ms / 1000
+    server = ThreadingHTTPServer((args.host, args.port), FirestoreStubHandler)
+    signal.signal(signal.SIGTERM, lambda *_: threading.Thread(target=server.shutdown).start())
+    print(f'Firestore stub on http://{args.host}:{args.port}, latency {args.latency_ms} ms', flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    for request, count in sorted(FirestoreStubHandler.counts.items()):
+        print(f'{request}: {count}')
+
+
+if __name__ == '__main__':
+    main()
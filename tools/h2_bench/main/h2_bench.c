@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "firestore_utils.h"
+#include "firestore_http2.h"
+#include "station_mode.h"
+
+/**
+ * Sends CONFIG_H2_BENCH_REQUESTS upsert patches to CONFIG_H2_BENCH_HOST in three ways, and prints the time per request:
+ * - HTTP/1.1: the default transport, esp_http_client opens a TLS connection for every request,
+ * - HTTP/2, one at a time: the same calls, over one HTTP/2 connection (`firestore_h2_transport_init`),
+ * - HTTP/2, multiplexed: CONFIG_FIRESTORE_HTTP2_MAX_CONCURRENT_STREAMS requests in flight at once (`firestore_h2_submit`).
+ */
+
+static const char *TAG = "H2_BENCH";
+
+static char token[] = CONFIG_H2_BENCH_TOKEN;
+static char record[] = "{\"fields\": { \"Aug05\": {\"integerValue\": \"700\"}, \"Aug06\": {\"integerValue\": \"700\"}}}";
+
+static int failed_requests = 0;
+
+static void print_result(const char *name, int64_t start_us, int failed)
+{
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    printf("%-24s %d requests, %d failed, %.1f ms per request, %.1f requests/s\n", name, CONFIG_H2_BENCH_REQUESTS, failed,
+           elapsed_us / 1000.0 / CONFIG_H2_BENCH_REQUESTS, CONFIG_H2_BENCH_REQUESTS * 1e6 / elapsed_us);
+}
+
+static void run_sequential(const char *name, firestore_client_handle_t client)
+{
+    firestore_path_t document;
+    firestore_client_document_path_init(client, &document, "bench/dev1/log/2408");
+    int failed = 0;
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i < CONFIG_H2_BENCH_REQUESTS; i++)
+    {
+        if (firestore_patch_at(&document, record, token, FIRESTORE_DOC_UPSERT, NULL) != ESP_OK)
+        {
+            failed++;
+        }
+    }
+    print_result(name, start_us, failed);
+}
+
+static void on_response(int status_code, const char *body, int body_len, void *user_ctx)
+{
+    if (status_code != 200)
+    {
+        failed_requests++;
+    }
+}
+
+static void run_multiplexed(const char *name, firestore_client_handle_t client, firestore_h2_client_handle_t h2_client)
+{
+    firestore_path_t document;
+    firestore_client_document_path_init(client, &document, "bench/dev1/log/2408");
+    const char *mask_fields[] = {"Aug05", "Aug06"};
+    firestore_document_path_set_update_mask(&document, mask_fields, 2);
+    failed_requests = 0;
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i < CONFIG_H2_BENCH_REQUESTS; i++)
+    {
+        if (firestore_h2_submit(h2_client, HTTP_METHOD_PATCH, &document, "mask.fieldPaths=z", record, token, on_response, NULL) != ESP_OK)
+        {
+            failed_requests++;
+        }
+        if (firestore_h2_in_flight(h2_client) == CONFIG_FIRESTORE_HTTP2_MAX_CONCURRENT_STREAMS || i == CONFIG_H2_BENCH_REQUESTS - 1)
+        {
+            firestore_h2_wait_all(h2_client, 10000);
+        }
+    }
+    print_result(name, start_us, failed_requests);
+}
+
+void app_main(void)
+{
+    initWifiSta();
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    firestore_client_config_t config = {};
+    config.project_id = CONFIG_H2_BENCH_PROJECT_ID;
+    config.host = CONFIG_H2_BENCH_HOST;
+    firestore_client_handle_t http1_client;
+    ESP_ERROR_CHECK(firestore_client_create(&config, &http1_client));
+    run_sequential("HTTP/1.1", http1_client);
+
+    firestore_h2_client_handle_t h2_client;
+    ESP_ERROR_CHECK(firestore_h2_connect_client(http1_client, &h2_client));
+    firebase_transport_t h2_transport;
+    firestore_h2_transport_init(&h2_transport, h2_client);
+    config.transport = &h2_transport;
+    firestore_client_handle_t h2_transport_client;
+    ESP_ERROR_CHECK(firestore_client_create(&config, &h2_transport_client));
+    run_sequential("HTTP/2, one at a time", h2_transport_client);
+    run_multiplexed("HTTP/2, multiplexed", http1_client, h2_client);
+
+    firestore_client_destroy(h2_transport_client);
+    firestore_h2_disconnect(h2_client);
+    firestore_client_destroy(http1_client);
+    ESP_LOGW(TAG, "Done");
+}
@@ -0,0 +1,272 @@
+"""
+A local stand-in of the Firebase Realtime Database REST API, to measure how fast a device gets its commands
+with the streaming listener (firebase_rtdb.h) compared with polling.
+
+- `GET /<path>.json` with `Accept: text/event-stream` is a stream: the `put` of the whole data at the path,
+  then a `put` / `patch` for every write at, above or below it, and a `keep-alive` every --keepalive seconds.
+- `GET /<path>.json` is a read (a poll), `PUT` and `PATCH` are writes (`print=silent` is answered with 204).
+- Every --command-interval seconds, `{"id": n, "issuedAt": <ms>}` is written at --command-path.
+- When the device writes `{"id": n, "mode": "stream" | "poll"}` at --ack-path, the delivery latency of
+  command n (from issued to acknowledged) is recorded for that mode.
+- --drop-every and --revoke-every close the streams, or send them `auth_revoked`, to exercise the reconnects.
+
+The latency and request counts of each mode are printed every --report-interval seconds, and on exit.
+Only the standard library is used.
+"""
+import argparse
+import json
+import queue
+import signal
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlsplit
+
+
+def now_ms() -> int:
+    return int(time.time() * 1000)
+
+
+def split_path(path: str) -> list:
+    return [segment for segment in path.strip('/').split('/') if segment]
+
+
+def join_path(segments: list) -> str:
+    return '/' + '/'.join(segments)
+
+
+class Database:
+    """
+    The JSON tree, and the streams listening to it.
+    """
+
+    def __init__(self):
+        self.root = None
+        self.lock = threading.Lock()
+        self.streams = []  # (segments, queue of (event, data))
+
+    def get(self, segments: list):
+        node = self.root
+        for segment in segments:
+            if not isinstance(node, dict) or segment not in node:
+                return None
+            node = node[segment]
+        return node
+
+    def _set(self, segments: list, value):
+        if not segments:
+            self.root = value
+            return
+        if not isinstance(self.root, dict):
+            self.root = {}
+        node = self.root
+        for segment in segments[:-1]:
+            if not isinstance(node.get(segment), dict):
+                node[segment] = {}
+            node = node[segment]
+        if value is None:
+            node.pop(segments[-1], None)
+        else:
+            node[segments[-1]] = value
+
+    def write(self, segments: list, value, patch: bool):
+        with self.lock:
+            if patch:
+                for key, child in value.items():
+                    self._set(segments + split_path(key), child)
+            else:
+                self._set(segments, value)
+            for stream_segments, events in self.streams:
+                if segments[:len(stream_segments)] == stream_segments:
+                    # the write is at or below the stream
+                    relative = join_path(segments[len(stream_segments):])
+                    events.put(('patch' if patch else 'put', {'path': relative, 'data': value}))
+                elif stream_segments[:len(segments)] == segments:
+                    # the write is above the stream, send the new data of the stream
+                    events.put(('put', {'path': '/', 'data': self.get(stream_segments)}))
+
+    def listen(self, segments: list):
+        events = queue.Queue()
+        with self.lock:
+            events.put(('put', {'path': '/', 'data': self.get(segments)}))
+            self.streams.append((segments, events))
+        return events
+
+    def unlisten(self, events):
+        with self.lock:
+            self.streams = [stream for stream in self.streams if stream[1] is not events]
+
+    def broadcast(self, event: str, data):
+        with self.lock:
+            for _, events in self.streams:
+                events.put((event, data))
+
+
+class Measurements:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.issued = {}  # command id -> issued at (ms)
+        self.latencies = {'stream': [], 'poll': []}
+        self.polls = 0
+        self.stream_connects = 0
+        self.writes = 0
+
+    def report(self) -> str:
+        with self.lock:
+            lines = [f'commands issued: {len(self.issued)}, polls: {self.polls}, '
+                     f'stream connects: {self.stream_connects}, writes: {self.writes}']
+            for mode, latencies in self.latencies.items():
+                if not latencies:
+                    continue
+                ordered = sorted(latencies)
+                p50 = ordered[len(ordered) // 2]
+                p95 = ordered[min(len(ordered) - 1, int(len(ordered) * 0.95))]
+                lines.append(f'{mode:>6}: {len(ordered)} commands acknowledged, latency ms: '
+                             f'p50 {p50}, p95 {p95}, max {ordered[-1]}')
+            return '\n'.join(lines)
+
+
+def make_handler(database: Database, measurements: Measurements, args):
+    class Handler(BaseHTTPRequestHandler):
+        # HTTP/1.0: a stream is delimited by closing the connection, like any other response here
+        protocol_version = 'HTTP/1.0'
+
+        def log_message(self, format, *log_args):
+            if args.verbose:
+                super().log_message(format, *log_args)
+
+        def _segments(self):
+            path = urlsplit(self.path).path
+            if not path.endswith('.json'):
+                return None
+            return split_path(path[:-len('.json')])
+
+        def _reply(self, status: int, body=None):
+            data = b'' if body is None else json.dumps(body).encode()
+            self.send_response(status)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(data)))
+            self.end_headers()
+            self.wfile.write(data)
+
+        def do_GET(self):
+            segments = self._segments()
+            if segments is None:
+                return self._reply(404, {'error': 'not a .json path'})
+            if 'text/event-stream' in self.headers.get('Accept', ''):
+                return self._stream(segments)
+            with measurements.lock:
+                measurements.polls += 1
+            with database.lock:
+                value = database.get(segments)
+            self._reply(200, value)
+
+        def _stream(self, segments: list):
+            self.send_response(200)
+            self.send_header('Content-Type', 'text/event-stream')
+            self.send_header('Cache-Control', 'no-cache')
+            self.end_headers()
+            with measurements.lock:
+                measurements.stream_connects += 1
+            events = database.listen(segments)
+            opened = time.monotonic()
+            try:
+                while True:
+                    try:
+                        event, data = events.get(timeout=args.keepalive)
+                    except queue.Empty:
+                        event, data = 'keep-alive', None
+                    self.wfile.write(f'event: {event}\ndata: {json.dumps(data)}\n\n'.encode())
+                    self.wfile.flush()
+                    if event in ('auth_revoked', 'cancel', 'drop'):
+                        break
+                    if args.drop_every > 0 and time.monotonic() - opened > args.drop_every:
+                        break
+            except (BrokenPipeError, ConnectionResetError):
+                pass
+            finally:
+                database.unlisten(events)
+
+        def _write(self, patch: bool):
+            segments = self._segments()
+            if segments is None:
+                return self._reply(404, {'error': 'not a .json path'})
+            try:
+                value = json.loads(self.rfile.read(int(self.headers.get('Content-Length', 0))))
+            except ValueError:
+                return self._reply(400, {'error': 'Invalid data; couldn\'t parse JSON object.'})
+            if patch and not isinstance(value, dict):
+                return self._reply(400, {'error': 'Invalid data; a patch has to be an object.'})
+            database.write(segments, value, patch)
+            with measurements.lock:
+                measurements.writes += 1
+                if join_path(segments) == args.ack_path and isinstance(value, dict):
+                    issued_at = measurements.issued.get(value.get('id'))
+                    mode = value.get('mode')
+                    if issued_at is not None and mode in measurements.latencies:
+                        measurements.latencies[mode].append(now_ms() - issued_at)
+            silent = parse_qs(urlsplit(self.path).query).get('print') == ['silent']
+            self._reply(204 if silent else 200, None if silent else value)
+
+        def do_PUT(self):
+            self._write(patch=False)
+
+        def do_PATCH(self):
+            self._write(patch=True)
+
+    return Handler
+
+
+def issue_commands(database: Database, measurements: Measurements, args):
+    command_id = 0
+    while True:
+        time.sleep(args.command_interval)
+        command_id += 1
+        issued_at = now_ms()
+        with measurements.lock:
+            measurements.issued[command_id] = issued_at
+        database.write(split_path(args.command_path), {'id': command_id, 'issuedAt': issued_at}, patch=False)
+
+
+def disturb_streams(database: Database, args):
+    while True:
+        time.sleep(args.revoke_every)
+        database.broadcast('auth_revoked', 'credential is no longer valid')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--port', type=int, default=9000)
+    parser.add_argument('--command-path', default='/devices/dev1/command')
+    parser.add_argument('--ack-path', default='/devices/dev1/ack')
+    parser.add_argument('--command-interval', type=float, default=5.0, help='seconds between the commands')
+    parser.add_argument('--keepalive', type=float, default=30.0, help='seconds between the keep-alive events')
+    parser.add_argument('--drop-every', type=float, default=0, help='close each stream after this many seconds (0: never)')
+    parser.add_argument('--revoke-every', type=float, default=0, help='send auth_revoked to the streams this often (0: never)')
+    parser.add_argument('--report-interval', type=float, default=30.0)
+    parser.add_argument('--verbose', action='store_true')
+    args = parser.parse_args()
+
+    database = Database()
+    measurements = Measurements()
+    server = ThreadingHTTPServer(('', args.port), make_handler(database, measurements, args))
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    threading.Thread(target=issue_commands, args=(database, measurements, args), daemon=True).start()
+    if args.revoke_every > 0:
+        threading.Thread(target=disturb_streams, args=(database, args), daemon=True).start()
+    signal.signal(signal.SIGTERM, signal.default_int_handler)  # print the report on `kill` too
+    print(f'Serving on port {args.port}, commands at {args.command_path}, acknowledgements at {args.ack_path}')
+    try:
+        while True:
+            time.sleep(args.report_interval)
+            print(measurements.report(), flush=True)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.shutdown()
+        print(measurements.report())
+
+
+if __name__ == '__main__':
+    main()